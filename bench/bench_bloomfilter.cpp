@@ -0,0 +1,61 @@
+// The throughput of the BEP33 bloom filter, the hash, the insert, the merge of the wire format and the hex round trip
+// Usage: bench_bloomfilter [--items N]
+// Build it in release mode (xmake f -m release)
+#include <iostream>
+#include <cstring>
+#include <format>
+#include <chrono>
+#include <array>
+#include "../src/bloomfilter.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+template <typename Fn>
+static auto measure(size_t n, Fn &&fn) -> double {
+    auto begin = Clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        fn(i);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin);
+    return double(elapsed.count()) / double(std::max<size_t>(n, 1));
+}
+
+int main(int argc, char **argv) {
+    size_t items = 100000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (::strcmp(argv[i], "--items") == 0) {
+            items = std::stoull(argv[i + 1]);
+        }
+    }
+
+    // Insert, hash once then by the indexes
+    std::vector<BEP33BloomFilter<>::Hash> hashes;
+    std::array<std::byte, 4>              ip4 = {std::byte {10}, std::byte {0}, std::byte {0}, std::byte {0}};
+    auto hash = measure(items, [&](size_t i) {
+        ip4[2] = std::byte(i >> 8);
+        ip4[3] = std::byte(i & 0xff);
+        hashes.push_back(BEP33BloomFilter<>::hash(ip4));
+    });
+    BEP33BloomFilter<> bf;
+    auto insert = measure(items, [&](size_t i) { bf.insertHash(hashes[i]); });
+    std::cout << std::format("hash {:.1f}ns/item, insertHash {:.1f}ns/item\n", hash, insert);
+
+    // Merge the filters in the wire format, as the scrape estimate does
+    BEP33BloomFilter<> part;
+    part.insert(ip4);
+    auto               bytes  = part.toBytes();
+    size_t             merged = 0;
+    BEP33BloomFilter<> result;
+    auto merge = measure(items, [&](size_t i) {
+        bytes[i % bytes.size()] |= std::byte(1 << (i % 8));
+        merged += result.merge(bytes);
+    });
+    std::cout << std::format("merge {:.1f}ns/filter, {} merged, estimated size {:.1f}\n", merge, merged,
+                             result.calculateEstimatedSize());
+
+    // Hex round trip
+    size_t same = 0;
+    auto   hex  = measure(10000, [&](size_t) { same += BEP33BloomFilter<>::fromHexString(bf.toHexString()) == bf; });
+    std::cout << std::format("hex round trip {:.1f}ns, {} of 10000 same\n", hex, same);
+    return same == 10000 ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+// The lookup benchmark on the simulated network
+// Usage: bench_lookup [--nodes N] [--lookups N] [--loss P] [--churn P] [--seed N]
+// Build it in release mode (xmake f -m release), or the dht logs will dominate the time
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <format>
+#include "../src/session.hpp"
+#include "simnet.hpp"
+
+struct LookupResult {
+    std::chrono::milliseconds latency;
+    size_t                    hops;
+    size_t                    messages;
+    bool                      found;
+};
+
+static auto percentile(std::vector<int64_t> values, double p) -> int64_t {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, size_t(p * values.size()))];
+}
+
+static auto report(const char *name, const std::vector<LookupResult> &results) -> void {
+    std::vector<int64_t> latency;
+    size_t hops = 0, messages = 0, found = 0;
+    for (auto &result : results) {
+        latency.push_back(result.latency.count());
+        hops     += result.hops;
+        messages += result.messages;
+        found    += result.found;
+    }
+    auto n = std::max<size_t>(results.size(), 1);
+    std::cout << std::format("{:<8} lookups {:>5} found {:>6.2f}% latency p50 {:>6}ms p95 {:>6}ms "
+                             "hops {:>5.2f} messages {:>7.2f}\n",
+                             name, results.size(), 100.0 * found / n, percentile(latency, 0.5),
+                             percentile(latency, 0.95), double(hops) / n, double(messages) / n);
+}
+
+int main(int argc, char **argv) {
+    size_t             nodesCount   = 1000;
+    size_t             lookupsCount = 200;
+    SimNetwork::Config config;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (::strcmp(argv[i], "--nodes") == 0) {
+            nodesCount = std::stoull(argv[i + 1]);
+        }
+        else if (::strcmp(argv[i], "--lookups") == 0) {
+            lookupsCount = std::stoull(argv[i + 1]);
+        }
+        else if (::strcmp(argv[i], "--loss") == 0) {
+            config.loss = std::stod(argv[i + 1]);
+        }
+        else if (::strcmp(argv[i], "--churn") == 0) {
+            config.churn = std::stod(argv[i + 1]);
+        }
+        else if (::strcmp(argv[i], "--seed") == 0) {
+            config.seed = std::stoull(argv[i + 1]);
+        }
+    }
+
+    SimContext ctxt;
+    ctxt.install();
+    SimNetwork network(ctxt, config);
+    TaskScope  scope(ctxt);
+    auto      &random = network.random();
+
+    // Make the ids from the seeded engine, so the network is the same on each run
+    auto randomId = [&]() {
+        uint8_t bytes[20];
+        for (auto &byte : bytes) {
+            byte = uint8_t(random());
+        }
+        return NodeId::from(bytes, sizeof(bytes));
+    };
+    auto addSession = [&](std::vector<std::unique_ptr<DhtSession>> &sessions, const NodeId &id) -> DhtSession & {
+        auto &transport = network.addNode();
+        auto &session   = *sessions.emplace_back(std::make_unique<DhtSession>(ctxt, id, transport));
+        session.setRandomSearch(false);
+        session.setDnsSeeds(false);
+        session.setClock([&ctxt]() { return ctxt.timePoint(); }); // The timestamps and the limiter run virtually
+        transport.setHandler([&](std::vector<std::byte> buffer, const IPEndpoint &from) {
+            scope.spawn([&session, buffer = std::move(buffer), from]() -> Task<void> {
+                co_await session.processUdp(buffer, from);
+            });
+        });
+        return session;
+    };
+
+    // Build the network, every node knows the others as a converged routing table does
+    std::vector<std::unique_ptr<DhtSession>> sessions;
+    std::vector<NodeEndpoint>                endpoints;
+    for (size_t i = 0; i < nodesCount; ++i) {
+        auto id = randomId();
+        addSession(sessions, id);
+        endpoints.push_back({id, network.nodes().back()->localEndpoint().value()});
+    }
+    for (size_t i = 0; i < nodesCount; ++i) {
+        for (size_t j = 0; j < nodesCount; ++j) {
+            if (i != j) {
+                sessions[i]->routingTable().updateNode(endpoints[j]);
+            }
+        }
+    }
+    std::cout << std::format("Network of {} nodes, loss {}, churn {}\n", nodesCount, config.loss, config.churn);
+
+    // Lookup the random existing node from the random node
+    auto lookup = [&](DhtSession::FindAlgo algo) {
+        for (auto &session : sessions) { // Each algorithm starts cold, not from the contacts the last pass cached
+            session->contacts().clear();
+        }
+        std::vector<LookupResult> results;
+        for (size_t i = 0; i < lookupsCount; ++i) {
+            auto  from      = random() % nodesCount;
+            auto &target    = endpoints[random() % nodesCount];
+            auto &session   = *sessions[from];
+            auto  begin     = ctxt.now();
+            auto  sent      = network.nodes()[from]->sent();
+            auto  hops      = session.statistics().lookupHops;
+            bool  done      = false;
+            bool  found     = false;
+            scope.spawn([&]() -> Task<void> {
+                auto res = co_await session.findNode(target.id, algo);
+                found    = res && std::find(res->begin(), res->end(), target) != res->end();
+                done     = true;
+            });
+            ctxt.runUntil([&]() { return done; });
+            results.push_back({
+                .latency  = ctxt.now() - begin,
+                .hops     = session.statistics().lookupHops - hops,
+                .messages = network.nodes()[from]->sent() - sent,
+                .found    = found,
+            });
+        }
+        return results;
+    };
+    report("AStar", lookup(DhtSession::AStar));
+    report("BfsDfs", lookup(DhtSession::BfsDfs));
+
+    // Cold start of a new node from 8 random seeds
+    auto &fresh = addSession(sessions, randomId());
+    for (size_t i = 0; i < 8; ++i) {
+        fresh.addBootstrapEndpoint(endpoints[random() % nodesCount].ip.toEndpoint());
+    }
+    auto begin = ctxt.now();
+    bool done  = false;
+    fresh.setOnBootstrapProgress([&](const DhtSession::BootstrapProgress &progress) {
+        std::cout << std::format("Bootstrap {:>6}ms nodes {:>4}\n", progress.elapsed.count(), progress.nodes);
+        done = progress.done;
+    });
+    scope.spawn(&DhtSession::start, &fresh);
+    ctxt.runUntil([&]() { return done || ctxt.now() - begin > std::chrono::minutes(10); });
+    std::cout << std::format("Delivered {} datagrams, dropped {}, virtual time {}ms\n", network.delivered(),
+                             network.dropped(), ctxt.now().count());
+
+    scope.cancel();
+    scope.wait();
+    return 0;
+}
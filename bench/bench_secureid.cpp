@@ -0,0 +1,82 @@
+// The cost of the BEP42 secure id check, the crc32c and the routing table update under each policy
+// Usage: bench_secureid [--nodes N]
+// Build it in release mode (xmake f -m release), or the dht logs will dominate the time
+#include <iostream>
+#include <cstring>
+#include <format>
+#include <random>
+#include <chrono>
+#include "../src/secureid.hpp"
+#include "../src/route.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+template <typename Fn>
+static auto measure(size_t n, Fn &&fn) -> double {
+    auto begin = Clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        fn(i);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin);
+    return double(elapsed.count()) / double(std::max<size_t>(n, 1));
+}
+
+int main(int argc, char **argv) {
+    size_t nodesCount = 100000;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (::strcmp(argv[i], "--nodes") == 0) {
+            nodesCount = std::stoull(argv[i + 1]);
+        }
+    }
+    std::mt19937 random {114514};
+
+    // The crc32c of the masked ip, 4 and 8 bytes as BEP42 does
+    constexpr size_t CRC_ROUNDS = 10000000;
+    std::array<std::byte, 8> input {};
+    uint32_t sink = 0;
+    for (size_t len : {4, 8}) {
+        auto hardware = measure(CRC_ROUNDS, [&](size_t i) {
+            input[0] = std::byte(i);
+            sink    ^= crc32c(std::span(input).first(len));
+        });
+        auto software = measure(CRC_ROUNDS, [&](size_t i) {
+            input[0] = std::byte(i);
+            sink    ^= crc32cSoftware(std::span(input).first(len));
+        });
+        std::cout << std::format("crc32c {} bytes: crc32c() {:.2f}ns (hardware {}), table {:.2f}ns\n", len, hardware,
+                                 crc32cHardware(), software);
+    }
+
+    // The public ipv4 nodes, half of them have the secure id
+    std::vector<NodeEndpoint> nodes;
+    while (nodes.size() < nodesCount) {
+        auto endpoint = IPEndpoint::fromString(std::format("{}.{}.{}.{}:6881", 1 + random() % 9, random() % 256,
+                                                           random() % 256, 1 + random() % 254)).value();
+        auto id = nodes.size() % 2 == 0 ? secureNodeId(endpoint.address()) : NodeId::rand();
+        nodes.push_back({id, endpoint});
+    }
+    size_t secure = 0;
+    auto check = measure(nodes.size(), [&](size_t i) {
+        secure += isSecureNodeId(nodes[i].id, nodes[i].ip.address());
+    });
+    std::cout << std::format("isSecureNodeId: {:.2f}ns, {} of {} secure\n", check, secure, nodes.size());
+
+    // The update of the routing table, the full buckets make the prefer policy scan them
+    auto self = NodeId::rand();
+    for (auto [name, policy] : {std::pair {"Ignore", RoutingTable::Ignore}, std::pair {"Prefer", RoutingTable::Prefer},
+                                std::pair {"Require", RoutingTable::Require}}) {
+        RoutingTable table {self};
+        table.setSecureIdPolicy(policy);
+        size_t rejected = 0;
+        auto   update   = measure(nodes.size(), [&](size_t i) {
+            rejected += table.updateNode(nodes[i]) == RoutingTable::Rejected;
+        });
+        size_t tableSecure = 0;
+        for (auto &node : table.nodes()) {
+            tableSecure += isSecureNodeId(node.id, node.ip.address());
+        }
+        std::cout << std::format("updateNode {:<8} {:.2f}ns, table {} nodes ({} secure), rejected {}\n", name, update,
+                                 table.size(), tableSecure, rejected);
+    }
+    return sink == 0x12345678; // Keep the crc from being optimized out
+}
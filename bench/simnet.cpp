@@ -0,0 +1,246 @@
+#include "simnet.hpp"
+#include <algorithm>
+
+SimContext::SimContext() {
+
+}
+
+SimContext::~SimContext() {
+    // Drain the ready tasks, they may be the cleanup of the canceled tasks
+    while (!mReady.empty()) {
+        auto [fn, args] = mReady.front();
+        mReady.pop_front();
+        fn(args);
+    }
+}
+
+auto SimContext::now() const -> std::chrono::milliseconds {
+    return mNow;
+}
+
+auto SimContext::timePoint() const -> std::chrono::steady_clock::time_point {
+    return std::chrono::steady_clock::time_point(mNow);
+}
+
+auto SimContext::schedule(std::chrono::milliseconds delay, std::function<void()> fn) -> void {
+    addTimer(delay, std::move(fn));
+}
+
+auto SimContext::runUntil(const std::function<bool()> &pred) -> bool {
+    while (!pred()) {
+        if (!runOnce()) {
+            return pred();
+        }
+    }
+    return true;
+}
+
+auto SimContext::runFor(std::chrono::milliseconds duration) -> void {
+    bool timeout = false;
+    addTimer(duration, [&]() { timeout = true; });
+    runUntil([&]() { return timeout; });
+}
+
+auto SimContext::post(void (*fn)(void *), void *args) -> void {
+    mReady.emplace_back(fn, args);
+}
+
+auto SimContext::run(CancellationToken &token) -> void {
+    while (!token.isCancelled()) {
+        if (!runOnce()) {
+            break;
+        }
+    }
+}
+
+auto SimContext::sleep(uint64_t ms) -> IoTask<void> {
+    Event event;
+    auto  key = addTimer(std::chrono::milliseconds(ms), [&event]() { event.set(); });
+    if (auto res = co_await event; !res) {
+        mTimers.erase(key);
+        co_return unexpected(Error::Canceled);
+    }
+    co_return {};
+}
+
+auto SimContext::addTimer(std::chrono::milliseconds delay, std::function<void()> fn) -> TimerKey {
+    auto key = TimerKey {mNow + std::max(delay, std::chrono::milliseconds(0)), mTimerSeq++};
+    mTimers.emplace(key, std::move(fn));
+    return key;
+}
+
+auto SimContext::runOnce() -> bool {
+    if (!mReady.empty()) {
+        auto [fn, args] = mReady.front();
+        mReady.pop_front();
+        fn(args);
+        return true;
+    }
+    if (mTimers.empty()) { // Nothing can happen anymore
+        return false;
+    }
+    // Nothing is ready, jump to the next timer
+    auto node = mTimers.extract(mTimers.begin());
+    mNow      = std::max(mNow, node.key().first);
+    node.mapped()();
+    return true;
+}
+
+// The simulation has no real io
+auto SimContext::addDescriptor(fd_t, IoDescriptor::Type) -> Result<IoDescriptor *> {
+    return unexpected(Error::OperationNotSupported);
+}
+
+auto SimContext::removeDescriptor(IoDescriptor *) -> Result<void> {
+    return unexpected(Error::OperationNotSupported);
+}
+
+auto SimContext::cancel(IoDescriptor *) -> Result<void> {
+    return unexpected(Error::OperationNotSupported);
+}
+
+auto SimContext::read(IoDescriptor *, std::span<std::byte>, std::optional<size_t>) -> IoTask<size_t> {
+    co_return unexpected(Error::OperationNotSupported);
+}
+
+auto SimContext::write(IoDescriptor *, std::span<const std::byte>, std::optional<size_t>) -> IoTask<size_t> {
+    co_return unexpected(Error::OperationNotSupported);
+}
+
+auto SimContext::accept(IoDescriptor *, IPEndpoint *) -> IoTask<socket_t> {
+    co_return unexpected(Error::OperationNotSupported);
+}
+
+auto SimContext::connect(IoDescriptor *, const IPEndpoint &) -> IoTask<void> {
+    co_return unexpected(Error::OperationNotSupported);
+}
+
+auto SimContext::sendto(IoDescriptor *, std::span<const std::byte>, int, const IPEndpoint *) -> IoTask<size_t> {
+    co_return unexpected(Error::OperationNotSupported);
+}
+
+auto SimContext::recvfrom(IoDescriptor *, std::span<std::byte>, int, IPEndpoint *) -> IoTask<size_t> {
+    co_return unexpected(Error::OperationNotSupported);
+}
+
+auto SimContext::poll(IoDescriptor *, uint32_t) -> IoTask<uint32_t> {
+    co_return unexpected(Error::OperationNotSupported);
+}
+
+// SimTransport
+SimTransport::SimTransport(SimNetwork &network, const IPEndpoint &endpoint) : mNetwork(network), mEndpoint(endpoint) {
+
+}
+
+auto SimTransport::sendto(std::span<const std::byte> buffer, const IPEndpoint &endpoint) -> IoTask<size_t> {
+    mSent += 1;
+    mNetwork.deliver(*this, buffer, endpoint);
+    co_return buffer.size();
+}
+
+auto SimTransport::recvfrom(std::span<std::byte> buffer, IPEndpoint &endpoint) -> IoTask<size_t> {
+    while (mQueue.empty()) {
+        mEvent.clear();
+        if (auto res = co_await mEvent; !res) {
+            co_return unexpected(Error::Canceled);
+        }
+    }
+    auto [data, from] = std::move(mQueue.front());
+    mQueue.pop_front();
+    auto n   = std::min(buffer.size(), data.size());
+    endpoint = from;
+    std::copy_n(data.begin(), n, buffer.begin());
+    co_return n;
+}
+
+auto SimTransport::localEndpoint() -> Result<IPEndpoint> {
+    return mEndpoint;
+}
+
+auto SimTransport::setHandler(Handler handler) -> void {
+    mHandler = std::move(handler);
+}
+
+auto SimTransport::sent() const -> size_t {
+    return mSent;
+}
+
+auto SimTransport::isOnline() const -> bool {
+    return mOnline;
+}
+
+auto SimTransport::setOnline(bool online) -> void {
+    mOnline = online;
+}
+
+// SimNetwork
+SimNetwork::SimNetwork(SimContext &ctxt, Config config) : mCtxt(ctxt), mConfig(config), mRandom(config.seed) {
+    if (mConfig.churn > 0) {
+        mCtxt.schedule(mConfig.churnInterval, [this]() { churn(); });
+    }
+}
+
+SimNetwork::~SimNetwork() {
+
+}
+
+auto SimNetwork::addNode() -> SimTransport & {
+    // 10.x.y.z:6881, skip the .0 address
+    auto idx      = uint32_t(mNodes.size() + 1);
+    auto address  = IPAddress4::fromUint8Array({10, uint8_t(idx >> 16), uint8_t(idx >> 8), uint8_t(idx)});
+    auto endpoint = IPEndpoint(address, 6881);
+    auto &node    = mNodes.emplace_back(std::make_unique<SimTransport>(*this, endpoint));
+    mEndpoints.emplace(endpoint, node.get());
+    return *node;
+}
+
+auto SimNetwork::nodes() const -> const std::vector<std::unique_ptr<SimTransport>> & {
+    return mNodes;
+}
+
+auto SimNetwork::random() -> std::mt19937_64 & {
+    return mRandom;
+}
+
+auto SimNetwork::delivered() const -> size_t {
+    return mDelivered;
+}
+
+auto SimNetwork::dropped() const -> size_t {
+    return mDropped;
+}
+
+auto SimNetwork::deliver(const SimTransport &from, std::span<const std::byte> buffer, const IPEndpoint &to) -> void {
+    auto it = mEndpoints.find(to);
+    if (it == mEndpoints.end() || !from.mOnline || std::bernoulli_distribution(mConfig.loss)(mRandom)) {
+        mDropped += 1;
+        return;
+    }
+    auto latency = std::uniform_int_distribution<int64_t>(mConfig.minLatency.count(), mConfig.maxLatency.count())(mRandom);
+    auto target  = it->second;
+    auto source  = from.mEndpoint;
+    auto data    = std::vector<std::byte>(buffer.begin(), buffer.end());
+    mCtxt.schedule(std::chrono::milliseconds(latency), [this, target, source, data = std::move(data)]() mutable {
+        if (!target->mOnline) { // The node left while the datagram in flight
+            mDropped += 1;
+            return;
+        }
+        mDelivered += 1;
+        if (target->mHandler) {
+            target->mHandler(std::move(data), source);
+            return;
+        }
+        target->mQueue.emplace_back(std::move(data), source);
+        target->mEvent.set();
+    });
+}
+
+auto SimNetwork::churn() -> void {
+    auto dist = std::bernoulli_distribution(mConfig.churn);
+    for (auto &node : mNodes) {
+        if (dist(mRandom)) {
+            node->mOnline = !node->mOnline;
+        }
+    }
+    mCtxt.schedule(mConfig.churnInterval, [this]() { churn(); });
+}
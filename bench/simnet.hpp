@@ -0,0 +1,213 @@
+/**
+ * @file simnet.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The in-process simulated network, for benchmarking the dht without the internet
+ * @version 0.1
+ * @date 2025-06-04
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include <ilias/task.hpp>
+#include <ilias/sync.hpp>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <deque>
+#include <map>
+#include "../src/transport.hpp"
+
+/**
+ * @brief The io context with a virtual clock, time only moves forward when nothing is ready to run
+ *
+ * So the timeouts and the latencies cost no real time, and the result is deterministic for the same seed.
+ * It has no real io, all the io methods return not supported
+ *
+ */
+class SimContext final : public IoContext {
+public:
+    SimContext();
+    SimContext(const SimContext &) = delete;
+    ~SimContext();
+
+    /**
+     * @brief Get the virtual time since the context was created
+     *
+     * @return std::chrono::milliseconds
+     */
+    auto now() const -> std::chrono::milliseconds;
+
+    /**
+     * @brief Get the virtual time as a time point of the steady clock, the time source of DhtSession::setClock
+     *
+     * @return std::chrono::steady_clock::time_point
+     */
+    auto timePoint() const -> std::chrono::steady_clock::time_point;
+
+    /**
+     * @brief Call the function after the virtual delay
+     *
+     * @param delay
+     * @param fn
+     */
+    auto schedule(std::chrono::milliseconds delay, std::function<void()> fn) -> void;
+
+    /**
+     * @brief Run the ready tasks and the timers until the predicate is true or nothing can happen anymore
+     *
+     * @param pred
+     * @return true On the predicate is true
+     */
+    auto runUntil(const std::function<bool()> &pred) -> bool;
+
+    /**
+     * @brief Run for the virtual duration
+     *
+     * @param duration
+     */
+    auto runFor(std::chrono::milliseconds duration) -> void;
+
+    // Executor
+    auto post(void (*fn)(void *), void *args) -> void override;
+    auto run(CancellationToken &token) -> void override;
+    auto sleep(uint64_t ms) -> IoTask<void> override;
+
+    // IoContext, no real io in the simulation
+    auto addDescriptor(fd_t fd, IoDescriptor::Type type) -> Result<IoDescriptor *> override;
+    auto removeDescriptor(IoDescriptor *fd) -> Result<void> override;
+    auto cancel(IoDescriptor *fd) -> Result<void> override;
+    auto read(IoDescriptor *fd, std::span<std::byte> buffer, std::optional<size_t> offset) -> IoTask<size_t> override;
+    auto write(IoDescriptor *fd, std::span<const std::byte> buffer, std::optional<size_t> offset)
+        -> IoTask<size_t> override;
+    auto accept(IoDescriptor *fd, IPEndpoint *endpoint) -> IoTask<socket_t> override;
+    auto connect(IoDescriptor *fd, const IPEndpoint &endpoint) -> IoTask<void> override;
+    auto sendto(IoDescriptor *fd, std::span<const std::byte> buffer, int flags, const IPEndpoint *endpoint)
+        -> IoTask<size_t> override;
+    auto recvfrom(IoDescriptor *fd, std::span<std::byte> buffer, int flags, IPEndpoint *endpoint)
+        -> IoTask<size_t> override;
+    auto poll(IoDescriptor *fd, uint32_t event) -> IoTask<uint32_t> override;
+private:
+    using TimerKey = std::pair<std::chrono::milliseconds, uint64_t>; // (expire time, sequence)
+
+    auto addTimer(std::chrono::milliseconds delay, std::function<void()> fn) -> TimerKey;
+    auto runOnce() -> bool; // Run one ready task or fire the next timer, false on nothing to do
+
+    std::deque<std::pair<void (*)(void *), void *>>  mReady;
+    std::map<TimerKey, std::function<void()>>        mTimers;
+    std::chrono::milliseconds                        mNow {0};
+    uint64_t                                         mTimerSeq = 0;
+};
+
+class SimNetwork;
+
+/**
+ * @brief The endpoint of a node in the simulated network
+ *
+ */
+class SimTransport final : public DatagramTransport {
+public:
+    using Handler = std::function<void(std::vector<std::byte> buffer, const IPEndpoint &from)>;
+
+    SimTransport(SimNetwork &network, const IPEndpoint &endpoint);
+    SimTransport(const SimTransport &) = delete;
+
+    auto sendto(std::span<const std::byte> buffer, const IPEndpoint &endpoint) -> IoTask<size_t> override;
+    auto recvfrom(std::span<std::byte> buffer, IPEndpoint &endpoint) -> IoTask<size_t> override;
+    auto localEndpoint() -> Result<IPEndpoint> override;
+
+    /**
+     * @brief Set the handler of the incoming datagram, without it the datagrams are queued for recvfrom
+     *
+     * @param handler
+     */
+    auto setHandler(Handler handler) -> void;
+
+    /**
+     * @brief Get the number of the datagrams sent from this endpoint
+     *
+     * @return size_t
+     */
+    auto sent() const -> size_t;
+
+    /**
+     * @brief Check the node is online, the offline node drops all the datagrams
+     *
+     * @return true
+     * @return false
+     */
+    auto isOnline() const -> bool;
+    auto setOnline(bool online) -> void;
+private:
+    SimNetwork &mNetwork;
+    IPEndpoint  mEndpoint;
+    Handler     mHandler;
+    size_t      mSent   = 0;
+    bool        mOnline = true;
+    Event       mEvent; // The queue is not empty
+    std::deque<std::pair<std::vector<std::byte>, IPEndpoint>> mQueue;
+friend class SimNetwork;
+};
+
+/**
+ * @brief The simulated network, delivers the datagrams between the transports with latency, loss and churn
+ *
+ */
+class SimNetwork {
+public:
+    struct Config {
+        std::chrono::milliseconds minLatency    = std::chrono::milliseconds(20);
+        std::chrono::milliseconds maxLatency    = std::chrono::milliseconds(200);
+        double                    loss          = 0.01; // The probability of dropping a datagram
+        double                    churn         = 0.0;  // The fraction of the nodes toggle online state per interval
+        std::chrono::milliseconds churnInterval = std::chrono::minutes(1);
+        uint64_t                  seed          = 114514;
+    };
+
+    SimNetwork(SimContext &ctxt, Config config);
+    SimNetwork(const SimNetwork &) = delete;
+    ~SimNetwork();
+
+    /**
+     * @brief Add a node to the network, the endpoint is allocated in 10.0.0.0/8
+     *
+     * @return SimTransport&
+     */
+    auto addNode() -> SimTransport &;
+
+    /**
+     * @brief Get all the nodes
+     *
+     * @return const std::vector<std::unique_ptr<SimTransport> >&
+     */
+    auto nodes() const -> const std::vector<std::unique_ptr<SimTransport>> &;
+
+    /**
+     * @brief Get the random engine of the network, seeded by the config
+     *
+     * @return std::mt19937_64&
+     */
+    auto random() -> std::mt19937_64 &;
+
+    /**
+     * @brief Get the number of the datagrams delivered / dropped
+     *
+     */
+    auto delivered() const -> size_t;
+    auto dropped() const -> size_t;
+private:
+    auto deliver(const SimTransport &from, std::span<const std::byte> buffer, const IPEndpoint &to) -> void;
+    auto churn() -> void;
+
+    SimContext                                &mCtxt;
+    Config                                     mConfig;
+    std::mt19937_64                            mRandom;
+    std::vector<std::unique_ptr<SimTransport>> mNodes;
+    std::map<IPEndpoint, SimTransport *>       mEndpoints;
+    size_t                                     mDelivered = 0;
+    size_t                                     mDropped   = 0;
+friend class SimTransport;
+};
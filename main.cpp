@@ -1,4 +1,5 @@
 #include <filesystem>
+#include <cstdlib>
 #include <QApplication>
 #include <QDir>
 #include <QFile>
@@ -16,10 +17,15 @@
 #include "src/fetchmanager.hpp"
 #include "src/samplemanager.hpp"
 #include "src/getpeersmanager.hpp"
+#include "src/hashstore.hpp"
+#include "src/bloomfilter.hpp"
+#include "src/mmap.hpp"
+#include "src/hashindex.hpp"
 #include "src/metafetcher.hpp"
 #include "src/session.hpp"
 #include "src/torrent.hpp"
 #include "src/utp.hpp"
+#include "src/uring.hpp"
 #include "ui/widgets/info_hash_list_widget.hpp"
 #include "ui/torrent_card.hpp"
 #include "ui_main.h"
@@ -32,6 +38,15 @@
 
 #pragma comment(linker, "/SUBSYSTEM:console")
 
+// The capacity of the crawler-wide hash filter, about 4 bytes per hash on disk
+constexpr size_t HASH_FILTER_CAPACITY = 16 * 1024 * 1024;
+// Re-queue the unfetched hashs of the previous runs, at most this many every interval, paging through the index
+constexpr size_t RESUME_BATCH_SIZE  = 64;
+constexpr size_t RESUME_SCAN_LIMIT  = 64 * 1024; // The records visited per page at most, the skipped ones included
+constexpr auto   RESUME_INTERVAL    = std::chrono::seconds(5);
+constexpr auto   RESUME_PASS_DELAY  = std::chrono::hours(1);  // Between the passes over the whole index
+constexpr auto   RESUME_RETRY_AFTER = std::chrono::hours(24); // A hash queued (Fetching) is not retried sooner
+
 template <typename... Args>
 auto qFormat(std::format_string<Args...> fmt, Args &&...args) -> QString {
     return QString::fromUtf8(std::format(fmt, std::forward<Args>(args)...));
@@ -59,6 +74,18 @@ public:
                 mFetchManager.markFetched(InfoHash::fromHex(path.stem().string()));
             }
         }
+        // Load the hashs we have seen from the last run
+        if (auto file = MappedFile::open("hashs.filter", CuckooFilter<>::requiredBytes(HASH_FILTER_CAPACITY)); file) {
+            mHashFilter = CuckooFilter<>::attach(file->span(), HASH_FILTER_CAPACITY);
+            mHashFilterFile = std::move(*file);
+            if (mHashFilter) {
+                APP_LOG("Hash filter loaded, {} hashs, load factor {}", mHashFilter->size(), mHashFilter->loadFactor());
+            }
+        }
+        mHashIndex = InfoHashIndex::open("hashs.index");
+        if (mHashIndex) {
+            APP_LOG("Hash index loaded, {} records", mHashIndex->size());
+        }
 
         connect(ui.startButton, &QPushButton::clicked, this, [this]() {
             ui.bindEdit->setDisabled(true);
@@ -123,12 +150,9 @@ public:
             if (!mSession) {
                 return;
             }
-            for (const auto &[hash, endpoints] : mSession->peers()) {
-                DHT_LOG("Hash {}", hash);
-                for (const auto &endpoint : endpoints) {
-                    DHT_LOG("  {}", endpoint);
-                }
-            }
+            mSession->peers().forEach([](const InfoHash &hash, const IPEndpoint &endpoint) {
+                DHT_LOG("Hash {} peer {}", hash, endpoint);
+            });
         });
 
         connect(ui.dumpSampleTableButton, &QPushButton::clicked, this, [this]() {
@@ -219,18 +243,33 @@ public:
         auto endpoint = IPEndpoint::fromString(ui.bindEdit->text().toStdString().c_str());
         auto nodeId   = idText.isEmpty() ? NodeId::rand() : NodeId::fromHex(idText.toStdString().c_str());
         // Make session and start it
-        mUdp = UdpClient(mIo, endpoint->family());
-        mUdp.setOption(sockopt::ReuseAddress(true));
-        mUdp.bind(*endpoint).value();
-        mScope.spawn(&App::processUdp, this);
+        mUdp = makeUdp(*endpoint);
+
+        mTransport = makeTransport(mUdp);
+        mScope.spawn(processUdp(*mTransport));
 
-        mUtp.emplace(mUdp);
+        // The socket of the other family, e.g. DHT_BIND6=[::]:6881, makes the session dual-stack
+        if (auto env = ::getenv("DHT_BIND6"); env) {
+            if (auto endpoint6 = IPEndpoint::fromString(env); endpoint6 && endpoint6->family() != endpoint->family()) {
+                mUdp6 = makeUdp(*endpoint6);
+                mTransport6 = makeTransport(mUdp6);
+                mScope.spawn(processUdp(*mTransport6));
+            }
+        }
+
+        mUtp.emplace(*mTransport);
         mFetchManager.setUtpContext(*mUtp);
 #if 1
-        mSession.emplace(mIo, nodeId, mUdp);
+        mSession.emplace(mIo, nodeId, *mTransport);
+        if (mTransport6) {
+            mSession->addTransport(*mTransport6);
+        }
+        mSession->setAdoptSecureId(idText.isEmpty()); // Keep the id the user gave, or switch to the BEP42 one
         mSession->setOnAnouncePeer([this](const InfoHash &hash, const IPEndpoint &endpoint) {
-            onHashFound(hash);
-            mFetchManager.addHash(hash, endpoint);
+            onHashFound(hash, GetPeersManager::Announce);
+            if (!isFetched(hash)) {
+                mFetchManager.addHash(hash, endpoint);
+            }
         });
         mSession->routingTable().setOnNodeChanged([&, this]() {
             setWindowTitle(QString("DhtClient Node: %1").arg(mSession->routingTable().size()));
@@ -241,6 +280,11 @@ public:
         if (ui.saveSessionBox->isChecked()) {
             mSession->loadFile("session.cache");
         }
+        if (auto env = ::getenv("DHT_BOOTSTRAP_NODE"); env) { // e.g. a local node, for offline testing
+            if (auto endpoint = IPEndpoint::fromString(env); endpoint) {
+                mSession->addBootstrapEndpoint(*endpoint);
+            }
+        }
         if (ui.skipBootstrapBox->isChecked()) {
             mSession->setSkipBootstrap(true);
         }
@@ -249,24 +293,122 @@ public:
         mSampleManager->setOnInfoHashs([this](const std::vector<InfoHash> &infohashs) {
             int count = 0;
             for (const auto &hash : infohashs) {
-                count += onHashFound(hash);
+                count += onHashFound(hash, GetPeersManager::Sample);
             }
             return count;
         });
         mGetPeersManager.emplace(*mSession);
         mGetPeersManager->setOnPeerGot([this](const InfoHash &hash, const IPEndpoint &peer) {
             APP_LOG("Got peer {} : {}", hash, peer);
-            mFetchManager.addHash(hash, peer);
+            if (!isFetched(hash)) {
+                mFetchManager.addHash(hash, peer);
+            }
         });
+        if (mHashIndex) {
+            mScope.spawn(resumeUnfetched());
+        }
 #endif
     }
 
-    auto processUdp() -> Task<void> {
+    /**
+     * @brief Look up the hashs seen but not fetched in the previous runs, the filter keeps them from coming back
+     *
+     * @return Task<void>
+     */
+    auto resumeUnfetched() -> Task<void> {
+        size_t cursor   = 0; // The slot to continue from
+        size_t capacity = mHashIndex->capacity();
+        while (true) {
+            if (mHashIndex->capacity() != capacity) { // Grown, the records moved to about the doubled slots
+                cursor   = cursor * (mHashIndex->capacity() / std::max<size_t>(capacity, 1));
+                capacity = mHashIndex->capacity();
+            }
+            auto now = std::chrono::duration_cast<std::chrono::seconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count();
+            size_t                visited = 0;
+            std::vector<InfoHash> hashs;
+            cursor = mHashIndex->scanFrom(cursor, [&](const InfoHashIndex::Record &record) {
+                if (hashs.size() >= RESUME_BATCH_SIZE || visited++ >= RESUME_SCAN_LIMIT) {
+                    return false;
+                }
+                auto retried = record.state == InfoHashIndex::Fetching &&
+                               now < record.lastSeen + std::chrono::seconds(RESUME_RETRY_AFTER).count();
+                if (record.state == InfoHashIndex::Fetched || retried) {
+                    return true;
+                }
+                if (!mGetPeersManager->addHash(record.hash, GetPeersManager::Sample)) {
+                    return false; // The queue is full, try it again on the next page
+                }
+                hashs.push_back(record.hash);
+                return true;
+            });
+            for (auto &hash : hashs) { // Not in the scan, the insert of the index may move the records
+                markQueued(hash);
+            }
+            auto delay = std::chrono::duration_cast<std::chrono::seconds>(RESUME_INTERVAL);
+            if (cursor >= mHashIndex->capacity()) {
+                APP_LOG("Resume pass over the index done");
+                cursor = 0;
+                delay  = RESUME_PASS_DELAY;
+            }
+            if (auto res = co_await sleep(delay); !res) {
+                co_return;
+            }
+        }
+    }
+
+    /**
+     * @brief Make the udp socket bound to the endpoint, the IPv6 one is v6 only, the IPv4 traffic belongs to the other
+     *
+     * @param endpoint
+     * @return UdpClient
+     */
+    auto makeUdp(const IPEndpoint &endpoint) -> UdpClient {
+        auto udp = UdpClient(mIo, endpoint.family());
+        udp.setOption(sockopt::ReuseAddress(true));
+        if (endpoint.family() == AF_INET6) { // Or the v4-mapped sources arrive here, and the session drops them
+            int v6only = 1;
+            ::setsockopt(udp.socket().get(), IPPROTO_IPV6, IPV6_V6ONLY, reinterpret_cast<const char *>(&v6only),
+                         sizeof(v6only));
+        }
+        udp.bind(endpoint).value();
+        return udp;
+    }
+
+    /**
+     * @brief Make the transport on the udp socket, select the backend by DHT_TRANSPORT (udp / mmsg / uring)
+     *
+     * @param udp The bound udp socket
+     * @return std::unique_ptr<DatagramTransport>
+     */
+    auto makeTransport(UdpClient &udp) -> std::unique_ptr<DatagramTransport> {
+        auto name = std::string_view(::getenv("DHT_TRANSPORT") ? ::getenv("DHT_TRANSPORT") : "udp");
+#if defined(DHT_HAS_URING)
+        if (name == "uring") {
+            if (auto transport = UringTransport::create(mIo, udp); transport) {
+                APP_LOG("Using the io_uring transport");
+                return transport;
+            }
+            APP_LOG("io_uring is not available, fallback to the mmsg transport");
+            name = "mmsg";
+        }
+#endif
+#if defined(__linux__)
+        if (name == "mmsg") {
+            APP_LOG("Using the mmsg transport");
+            return std::make_unique<MmsgTransport>(udp);
+        }
+#endif
+        return std::make_unique<UdpTransport>(udp);
+    }
+
+    auto processUdp(DatagramTransport &transport) -> Task<void> {
         APP_LOG("App::processUdp start");
         std::byte  buffer[65535];
         IPEndpoint endpoint;
         while (true) {
-            auto res = co_await mUdp.recvfrom(buffer, endpoint);
+            auto res = co_await transport.recvfrom(buffer, endpoint);
             if (!res) {
                 if (res.error() != Error::Canceled) {
                     APP_LOG("App::processUdp recvfrom failed: {}", res.error());
@@ -274,7 +416,7 @@ public:
                 break;
             }
             auto data = std::span(buffer, res.value());
-            if (mUtp->processUdp(data, endpoint)) { // Valid UTP packet
+            if (&transport == mTransport.get() && mUtp->processUdp(data, endpoint)) { // Valid UTP packet
                 continue;
             }
             else if (mSession) {
@@ -366,7 +508,7 @@ public:
                 std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
                     .count();
 
-            QStringList headers = {"IpEndpoint", "Status", "Timeout", "Hashs", "Success", "Failure"};
+            QStringList headers = {"IpEndpoint", "Status", "Timeout", "Hashs", "Success", "Failure", "Yield"};
             ui.sampleNodeTableWidget->setColumnCount(headers.size());
             ui.sampleNodeTableWidget->setHorizontalHeaderLabels(headers);
 
@@ -381,6 +523,7 @@ public:
                 QTableWidgetItem *hashsItem   = new QTableWidgetItem(QString::number(node.hashsCount));
                 QTableWidgetItem *successItem = new QTableWidgetItem(QString::number(node.successCount));
                 QTableWidgetItem *failureItem = new QTableWidgetItem(QString::number(node.failure));
+                QTableWidgetItem *yieldItem   = new QTableWidgetItem(QString::number(node.yield, 'f', 2));
 
                 // no edit
                 ipItem->setFlags(ipItem->flags() & ~Qt::ItemIsEditable);
@@ -393,6 +536,7 @@ public:
                 hashsItem->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
                 successItem->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
                 failureItem->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+                yieldItem->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
 
                 ui.sampleNodeTableWidget->setItem(row, 0, ipItem);
                 ui.sampleNodeTableWidget->setItem(row, 1, statusItem);
@@ -400,6 +544,7 @@ public:
                 ui.sampleNodeTableWidget->setItem(row, 3, hashsItem);
                 ui.sampleNodeTableWidget->setItem(row, 4, successItem);
                 ui.sampleNodeTableWidget->setItem(row, 5, failureItem);
+                ui.sampleNodeTableWidget->setItem(row, 6, yieldItem);
                 row++;
             }
             // Optional: Stretch the first column (IpEndpoint) if space allows
@@ -563,12 +708,24 @@ public:
             ui.statusbar->showMessage("Invalid endpoint or hash", 5000);
             co_return;
         }
-        mGetPeersManager->addHash(infoHash);
+        mGetPeersManager->addHash(infoHash, GetPeersManager::Announce);
+
+        // Show the size of the swarm by the BEP33 scrape, the peers are still got by the manager
+        auto estimate = co_await mGetPeersManager->estimateSwarm(infoHash);
+        auto message  = qFormat("Swarm of {}, about {:.0f} seeds and {:.0f} peers by {} nodes", infoHash,
+                                estimate.seeds, estimate.peers, estimate.responses);
+        ui.logWidget->addItem(message);
     }
 
     auto onMetadataFetched(InfoHash hash, std::vector<std::byte> data) -> void {
         auto torrent = Torrent::parse(data);
         APP_LOG("Got torrent {}", hash);
+        if (mGetPeersManager) { // Stop looking up the peers of it
+            mGetPeersManager->markFinished(hash);
+        }
+        if (mHashIndex) {
+            mHashIndex->setState(hash, InfoHashIndex::Fetched);
+        }
         auto items = ui.infoHashWidget->findItems(QString::fromUtf8(hash.toHex()), Qt::MatchFixedString);
         for (auto item : items) {
             item->setText(QString::fromUtf8(torrent.name()));
@@ -610,36 +767,90 @@ public:
         if (mSession && ui.saveSessionBox->isEnabled()) {
             mSession->saveFile("session.cache");
         }
+        mHashFilter.reset();
+        mHashFilterFile.flush();
+        if (mHashIndex) {
+            mHashIndex->flush();
+        }
+    }
+
+    /**
+     * @brief Check the metadata of the hash was fetched (in this run or the previous runs)
+     *
+     * @param hash
+     * @return true
+     */
+    auto isFetched(const InfoHash &hash) const -> bool {
+        if (!mHashIndex) {
+            return false;
+        }
+        auto record = mHashIndex->find(hash);
+        return record && record->state == InfoHashIndex::Fetched;
+    }
+
+    /**
+     * @brief Check the hash was queued before, in this run or the previous ones
+     *
+     * @param hash
+     * @return true On seen (or a rare false positive of the filter)
+     */
+    auto isSeen(const InfoHash &hash) const -> bool {
+        auto bytes = std::as_bytes(std::span(hash.toStringView()));
+        return (mHashFilter && mHashFilter->contains(bytes)) || mHashs.contains(hash);
+    }
+
+    /**
+     * @brief Mark the hash queued to the get peers manager, it is in the filter and Fetching in the index since
+     *
+     * @param hash
+     */
+    auto markQueued(const InfoHash &hash) -> void {
+        auto bytes = std::as_bytes(std::span(hash.toStringView()));
+        if (!mHashFilter || !mHashFilter->insert(bytes)) {
+            mHashs.insert(hash); // The filter is full or not available, fallback to the exact one
+        }
+        if (mHashIndex) {
+            mHashIndex->setState(hash, InfoHashIndex::Fetching);
+        }
     }
 
-    auto onHashFound(const InfoHash &hash) -> int {
-        auto it = mHashs.find(hash);
-        if (it == mHashs.end()) {
-            mHashs.insert(hash);
+    auto onHashFound(const InfoHash &hash, GetPeersManager::Priority priority) -> int {
+        if (mHashIndex) {
+            auto source = priority == GetPeersManager::Announce ? InfoHashIndex::Announce : InfoHashIndex::Sample;
+            mHashIndex->touch(hash, source);
+        }
+        if (isSeen(hash) || isFetched(hash)) {
+            return 0;
+        }
+#if 1
+        // Add it to the get peers manager, the dropped one (the queue is full) is left Pending for the resume
+        if (mGetPeersManager->addHash(hash, priority)) {
+            markQueued(hash);
             QListWidgetItem *item = new QListWidgetItem(QString::fromStdString(hash.toHex()));
             item->setData((int)CopyableDataFlag::Hash, QString::fromStdString(hash.toHex()));
             ui.infoHashWidget->addItem(item);
-
-#if 1
-            // Add it to the get peers manager
-            mGetPeersManager->addHash(hash);
-#endif
-            return 1;
         }
-        return 0;
+#endif
+        return 1;
     }
 
 private:
     QIoContext                     mIo;
     Ui::MainWindow                 ui;
     UdpClient                      mUdp;
+    std::unique_ptr<DatagramTransport> mTransport;
+    UdpClient                      mUdp6; // The socket of the other family, if dual-stack
+    std::unique_ptr<DatagramTransport> mTransport6;
     std::optional<UtpContext>      mUtp;
     std::optional<SampleManager>   mSampleManager;
     std::optional<GetPeersManager> mGetPeersManager;
     TaskScope                      mScope;
     std::optional<DhtSession>      mSession;
 
-    std::set<InfoHash> mHashs;
+    InfoHashStore      mHashs {128 * 1024 * 1024, std::chrono::hours(24)}; // The hashs we already seen recently
+    MappedFile         mHashFilterFile;
+    std::optional<CuckooFilter<>> mHashFilter; // The persistent filter of the all hashs we seen, in mHashFilterFile
+    std::optional<InfoHashIndex>  mHashIndex;  // The persistent records of the hashs, in hashs.index
     FetchManager       mFetchManager;
 };
 
@@ -0,0 +1,66 @@
+#include "adaptivelimit.hpp"
+#include <algorithm>
+
+inline constexpr double ADAPTIVE_LIMIT_ALPHA = 0.05; // The weight of the new result in the moving averages
+
+AdaptiveLimit::AdaptiveLimit() : AdaptiveLimit(Config {}) {
+
+}
+
+AdaptiveLimit::AdaptiveLimit(const Config &config) {
+    setConfig(config);
+    mLimit = std::clamp<double>(config.initialLimit, mConfig.minLimit, mConfig.maxLimit);
+}
+
+AdaptiveLimit::~AdaptiveLimit() {
+
+}
+
+auto AdaptiveLimit::onSuccess(std::chrono::milliseconds rtt) -> void {
+    mRtt = mRtt == 0 ? double(rtt.count()) : mRtt * (1 - ADAPTIVE_LIMIT_ALPHA) + double(rtt.count()) * ADAPTIVE_LIMIT_ALPHA;
+    onResult(true);
+    if (mSuccessRate >= mConfig.minSuccessRate && mRtt <= double(mConfig.maxRtt.count())) {
+        mLimit = std::min(mLimit + 1.0 / mLimit, double(mConfig.maxLimit)); // About +1 per window
+    }
+}
+
+auto AdaptiveLimit::onLoss(bool replied) -> void {
+    if (!replied) { // The population, not the congestion
+        return;
+    }
+    onResult(false);
+    if (mSuccessRate < mConfig.minSuccessRate && mSinceShrink >= size_t(mLimit)) {
+        mLimit       = std::max(mLimit * mConfig.decrease, double(mConfig.minLimit));
+        mSinceShrink = 0;
+    }
+}
+
+auto AdaptiveLimit::limit() const -> size_t {
+    return size_t(mLimit);
+}
+
+auto AdaptiveLimit::successRate() const -> float {
+    return float(mSuccessRate);
+}
+
+auto AdaptiveLimit::averageRtt() const -> std::chrono::milliseconds {
+    return std::chrono::milliseconds(int64_t(mRtt));
+}
+
+auto AdaptiveLimit::setConfig(const Config &config) -> void {
+    mConfig          = config;
+    mConfig.minLimit = std::max<size_t>(mConfig.minLimit, 1);
+    mConfig.maxLimit = std::max(mConfig.maxLimit, mConfig.minLimit);
+    mLimit           = std::clamp<double>(mLimit, mConfig.minLimit, mConfig.maxLimit);
+}
+
+auto AdaptiveLimit::config() const -> const Config & {
+    return mConfig;
+}
+
+auto AdaptiveLimit::onResult(bool success) -> void {
+    mSuccessRate = mSuccessRate * (1 - ADAPTIVE_LIMIT_ALPHA) + (success ? ADAPTIVE_LIMIT_ALPHA : 0);
+    if (mSinceShrink != SIZE_MAX) {
+        mSinceShrink += 1;
+    }
+}
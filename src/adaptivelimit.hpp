@@ -0,0 +1,84 @@
+/**
+ * @file adaptivelimit.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The AIMD limit of the concurrent queries, following the capacity of the network
+ * @version 0.1
+ * @date 2025-06-06
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+
+/**
+ * @brief The concurrency limit, additive increase on the good replies, multiplicative decrease on the losses
+ *
+ * Many nodes in the dht are just gone or behind a NAT, so a timeout of a node never replied says nothing about our
+ * link, it isn't counted at all. The success rate is of the nodes replied before. The limit grows by about one per
+ * window (limit results) while the moving success rate and rtt are good, and shrinks only when the success rate drops
+ * below the threshold, at most once per window, so a burst of the losses from one congestion is counted once
+ *
+ */
+class AdaptiveLimit {
+public:
+    struct Config {
+        size_t minLimit       = 4;
+        size_t maxLimit       = 128;
+        size_t initialLimit   = 30;
+        float  minSuccessRate = 0.5f; // Grow above it, shrink on the losses below it
+        float  decrease       = 0.7f; // The limit is multiplied by it on shrinking
+        std::chrono::milliseconds maxRtt = std::chrono::seconds(2); // Grow only when the average rtt is below it
+    };
+
+    AdaptiveLimit();
+    AdaptiveLimit(const Config &config);
+    ~AdaptiveLimit();
+
+    /**
+     * @brief Record a reply
+     *
+     * @param rtt The time from the query sent to the reply got
+     */
+    auto onSuccess(std::chrono::milliseconds rtt) -> void;
+
+    /**
+     * @brief Record a query without the reply (timeout or unreachable)
+     *
+     * @param replied The node replied before, the loss of a node never replied is ignored (likely a dead one)
+     */
+    auto onLoss(bool replied = true) -> void;
+
+    /**
+     * @brief Get the current limit, in [minLimit, maxLimit]
+     *
+     * @return size_t
+     */
+    auto limit() const -> size_t;
+
+    /**
+     * @brief Get the moving average of the success rate / rtt
+     *
+     */
+    auto successRate() const -> float;
+    auto averageRtt() const -> std::chrono::milliseconds;
+
+    /**
+     * @brief Set the config, the current limit is clamped to the new range
+     *
+     * @param config
+     */
+    auto setConfig(const Config &config) -> void;
+    auto config() const -> const Config &;
+private:
+    auto onResult(bool success) -> void;
+
+    Config mConfig;
+    double mLimit       = 0;
+    double mSuccessRate = 1;
+    double mRtt         = 0;    // In ms, 0 on no sample yet
+    size_t mSinceShrink = SIZE_MAX; // The results since the last shrink
+};
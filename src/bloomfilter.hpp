@@ -2,194 +2,217 @@
 
 #include <vector>
 #include <bitset>
-#include <sstream>
-#include <iomanip> // For std::setw, std::setfill, std::hex, std::fixed, std::setprecision
+#include <string>
+#include <array>
+#include <algorithm>
+#include <stdexcept>
+#include <optional>
+#include <limits>
+#include <cstdint>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <span>
+#include <bit>
 
 #include <ilias/net/address.hpp>
 
 #include "sha1.h"
 
+/**
+ * @brief The bloom filter of the BEP33 scrape, the bits are stored in the 64 bits words
+ *
+ * The bit i is the bit (i % 8) of the byte (i / 8) on the wire, so on the little endian machine the words are the
+ * wire bytes, the conversion is a memcpy. The indexes of an item are from the SHA1 of it (required by BEP33 for the
+ * interop), hash() computes them once, then insertHash() / testHash() can be used without hashing again
+ *
+ * @tparam K The number of the hash functions
+ * @tparam M The number of the bits
+ */
 template <std::size_t K = 2, std::size_t M = 8 * 256>
 class BEP33BloomFilter {
     static_assert(M > 0, "Bitset size M must be greater than 0");
     static_assert(M % 8 == 0, "Bitset size M must be a multiple of 8 for byte-wise hex conversion.");
     static_assert(M >= K * 2, "Bloom filter size M must be at least twice the number of hash functions K.");
     static_assert(K > 0, "Bloom filter hash function count K must be greater than 0");
+    static_assert(K <= 10, "The SHA1 digest only has 10 indexes of 16 bits");
 
+    static constexpr std::size_t Words = (M + 63) / 64;
+    static constexpr std::size_t Bytes = M / 8;
 public:
+    /**
+     * @brief The bit indexes of an item
+     *
+     */
+    using Hash = std::array<uint16_t, K>;
+
     BEP33BloomFilter() = default;
     BEP33BloomFilter(const std::bitset<M> &bloomfilter);
-    BEP33BloomFilter(std::bitset<M> &&bloomfilter);
     BEP33BloomFilter(const std::string &str);
-    BEP33BloomFilter(std::span<std::byte> bytes);
+    BEP33BloomFilter(std::span<const std::byte> bytes);
 
     static auto fromHexString(const std::string &hex) -> BEP33BloomFilter<K, M>;
     static auto fromBinaryString(const std::string &binary) -> BEP33BloomFilter<K, M>;
 
+    /**
+     * @brief Compute the indexes of the data, SHA1 once
+     *
+     * @param data
+     * @return Hash
+     */
+    static auto hash(std::span<const std::byte> data) -> Hash;
+
     void insertIP(const ilias::IPAddress &ip);
     void insert(std::span<const std::byte> data);
+    void insertHash(const Hash &hash);
     auto calculateEstimatedSize() const -> double;
     auto testIP(const ilias::IPAddress &ip) const -> bool;
     auto test(std::span<const std::byte> data) const -> bool;
+    auto testHash(const Hash &hash) const -> bool;
+
+    /**
+     * @brief Merge the filter in the wire format (the BFsd / BFpe of the reply) into this one
+     *
+     * @param bytes
+     * @return true On merged
+     * @return false On the size is wrong
+     */
+    auto merge(std::span<const std::byte> bytes) -> bool;
 
     auto toHexString(int bytes_per_space_group = 0) const -> std::string;
     auto toString() const -> std::string;
     auto toBytes() const -> std::vector<std::byte>;
-
-    auto count() const -> std::size_t { return mBloom.count(); }
-    auto size() const -> std::size_t { return mBloom.size(); }
-    auto any() const -> bool { return mBloom.any(); }
-    auto all() const -> bool { return mBloom.all(); }
-    auto none() const -> bool { return mBloom.none(); }
-    auto flip() -> void { mBloom.flip(); }
-    auto flip(std::size_t index) -> void { mBloom.flip(index); }
-    auto set() -> void { mBloom.set(); }
-    auto set(std::size_t index) -> void { mBloom.set(index); }
-    auto reset() -> void { mBloom.reset(); }
-    auto reset(std::size_t index) -> void { mBloom.reset(index); }
-
-    auto  operator[](std::size_t index) const { return mBloom[index]; }
-    auto &operator[](std::size_t index) { return mBloom[index]; }
-    auto  operator=(const BEP33BloomFilter<K, M> &other) -> BEP33BloomFilter<K, M>  &{
-        mBloom = other.mBloom;
-        return *this;
-    }
-    auto operator=(BEP33BloomFilter<K, M> &&other) -> BEP33BloomFilter<K, M> & {
-        mBloom = std::move(other.mBloom);
-        return *this;
-    }
-    auto operator==(const BEP33BloomFilter<K, M> &other) const -> bool { return mBloom == other.mBloom; }
-    auto operator!=(const BEP33BloomFilter<K, M> &other) const -> bool { return mBloom != other.mBloom; }
+    auto toBytes(std::span<std::byte, Bytes> out) const -> void;
+
+    auto count() const -> std::size_t;
+    auto size() const -> std::size_t { return M; }
+    auto any() const -> bool { return count() != 0; }
+    auto all() const -> bool { return count() == M; }
+    auto none() const -> bool { return count() == 0; }
+    auto flip() -> void { for (auto &word : mWords) word = ~word; trim(); }
+    auto flip(std::size_t index) -> void { mWords[index / 64] ^= bit(index); }
+    auto set() -> void { mWords.fill(~uint64_t(0)); trim(); }
+    auto set(std::size_t index) -> void { mWords[index / 64] |= bit(index); }
+    auto reset() -> void { mWords.fill(0); }
+    auto reset(std::size_t index) -> void { mWords[index / 64] &= ~bit(index); }
+
+    auto operator[](std::size_t index) const -> bool { return (mWords[index / 64] & bit(index)) != 0; }
+    auto operator==(const BEP33BloomFilter<K, M> &other) const -> bool = default;
     auto operator&(const BEP33BloomFilter<K, M> &other) const -> BEP33BloomFilter<K, M> {
-        BEP33BloomFilter<K, M> result;
-        result.mBloom = mBloom & other.mBloom;
-        return result;
+        auto result = *this;
+        return result &= other;
     }
-    auto operator&=(const BEP33BloomFilter<K, M> &other) const -> BEP33BloomFilter<K, M> {
-        mBloom &= other.mBloom;
+    auto operator&=(const BEP33BloomFilter<K, M> &other) -> BEP33BloomFilter<K, M> & {
+        for (std::size_t i = 0; i < Words; ++i) mWords[i] &= other.mWords[i];
         return *this;
     }
     auto operator|(const BEP33BloomFilter<K, M> &other) const -> BEP33BloomFilter<K, M> {
-        BEP33BloomFilter<K, M> result;
-        result.mBloom = mBloom | other.mBloom;
-        return result;
+        auto result = *this;
+        return result |= other;
     }
-    auto operator|=(const BEP33BloomFilter<K, M> &other) const -> BEP33BloomFilter<K, M> {
-        mBloom |= other.mBloom;
+    auto operator|=(const BEP33BloomFilter<K, M> &other) -> BEP33BloomFilter<K, M> & {
+        for (std::size_t i = 0; i < Words; ++i) mWords[i] |= other.mWords[i];
         return *this;
     }
     auto operator~() const -> BEP33BloomFilter<K, M> {
-        BEP33BloomFilter<K, M> result;
-        result.mBloom = ~mBloom;
+        auto result = *this;
+        result.flip();
         return result;
     }
     auto operator^(const BEP33BloomFilter<K, M> &other) const -> BEP33BloomFilter<K, M> {
-        BEP33BloomFilter<K, M> result;
-        result.mBloom = mBloom ^ other.mBloom;
-        return result;
+        auto result = *this;
+        return result ^= other;
     }
-    auto operator^=(const BEP33BloomFilter<K, M> &other) const -> BEP33BloomFilter<K, M> {
-        mBloom ^= other.mBloom;
+    auto operator^=(const BEP33BloomFilter<K, M> &other) -> BEP33BloomFilter<K, M> & {
+        for (std::size_t i = 0; i < Words; ++i) mWords[i] ^= other.mWords[i];
         return *this;
     }
     auto operator<<(std::size_t shift) const -> BEP33BloomFilter<K, M> {
-        BEP33BloomFilter<K, M> result;
-        result.mBloom = mBloom << shift;
-        return result;
-    }
-    auto operator<<=(std::size_t shift) const -> BEP33BloomFilter<K, M> {
-        mBloom <<= shift;
-        return *this;
+        auto result = *this;
+        return result <<= shift;
     }
+    auto operator<<=(std::size_t shift) -> BEP33BloomFilter<K, M> &;
     auto operator>>(std::size_t shift) const -> BEP33BloomFilter<K, M> {
-        BEP33BloomFilter<K, M> result;
-        result.mBloom = mBloom >> shift;
-        return result;
-    }
-    auto operator>>=(std::size_t shift) const -> BEP33BloomFilter<K, M> {
-        mBloom >>= shift;
-        return *this;
+        auto result = *this;
+        return result >>= shift;
     }
+    auto operator>>=(std::size_t shift) -> BEP33BloomFilter<K, M> &;
 
 private:
-    std::bitset<M> mBloom;
+    static constexpr auto bit(std::size_t index) -> uint64_t { return uint64_t(1) << (index % 64); }
+    auto trim() -> void { // Clear the bits after M in the last word
+        if constexpr (M % 64 != 0) {
+            mWords[Words - 1] &= (uint64_t(1) << (M % 64)) - 1;
+        }
+    }
+
+    std::array<uint64_t, Words> mWords {};
 };
 
+namespace bloom_utils {
+    inline constexpr char HexDigits[] = "0123456789ABCDEF";
+
+    // The value of the hex char, -1 on not a hex char
+    inline constexpr auto HexValues = []() {
+        std::array<int8_t, 256> table {};
+        table.fill(-1);
+        for (int i = 0; i < 10; ++i) table['0' + i] = int8_t(i);
+        for (int i = 0; i < 6; ++i) table['a' + i] = table['A' + i] = int8_t(10 + i);
+        return table;
+    }();
+}
+
 template <std::size_t K, std::size_t M>
-BEP33BloomFilter<K, M>::BEP33BloomFilter(std::span<std::byte> bytes) {
-    if (bytes.size() != M / 8) {
-        throw std::invalid_argument("Invalid byte size for the bitset size. Expected " + std::to_string(M / 8) +
+BEP33BloomFilter<K, M>::BEP33BloomFilter(std::span<const std::byte> bytes) {
+    if (!merge(bytes)) {
+        throw std::invalid_argument("Invalid byte size for the bitset size. Expected " + std::to_string(Bytes) +
                                     " bytes, got " + std::to_string(bytes.size()));
     }
-    for (std::size_t i = 0; i < M / 8; ++i) {
-        mBloom[i * 8 + 7] = (std::bit_cast<uint8_t>(bytes[i]) & 0x80) != 0;
-        mBloom[i * 8 + 6] = (std::bit_cast<uint8_t>(bytes[i]) & 0x40) != 0;
-        mBloom[i * 8 + 5] = (std::bit_cast<uint8_t>(bytes[i]) & 0x20) != 0;
-        mBloom[i * 8 + 4] = (std::bit_cast<uint8_t>(bytes[i]) & 0x10) != 0;
-        mBloom[i * 8 + 3] = (std::bit_cast<uint8_t>(bytes[i]) & 0x08) != 0;
-        mBloom[i * 8 + 2] = (std::bit_cast<uint8_t>(bytes[i]) & 0x04) != 0;
-        mBloom[i * 8 + 1] = (std::bit_cast<uint8_t>(bytes[i]) & 0x02) != 0;
-        mBloom[i * 8 + 0] = (std::bit_cast<uint8_t>(bytes[i]) & 0x01) != 0;
-    }
 }
 
 template <std::size_t K, std::size_t M>
-BEP33BloomFilter<K, M>::BEP33BloomFilter(const std::bitset<M> &mBloom) : mBloom(mBloom) {
-}
-template <std::size_t K, std::size_t M>
-BEP33BloomFilter<K, M>::BEP33BloomFilter(std::bitset<M> &&mBloom) : mBloom(mBloom) {
+BEP33BloomFilter<K, M>::BEP33BloomFilter(const std::bitset<M> &bloomfilter) {
+    for (std::size_t i = 0; i < M; ++i) {
+        if (bloomfilter[i]) {
+            set(i);
+        }
+    }
 }
 
 template <std::size_t K, std::size_t M>
-BEP33BloomFilter<K, M>::BEP33BloomFilter(const std::string &str) : mBloom(str) {
+BEP33BloomFilter<K, M>::BEP33BloomFilter(const std::string &str) : BEP33BloomFilter(std::bitset<M>(str)) {
 }
 
 template <std::size_t K, std::size_t M>
 auto BEP33BloomFilter<K, M>::fromHexString(const std::string &hex) -> BEP33BloomFilter<K, M> {
-    std::string clean_hex = hex;
-    // 1. 移除所有空格
-    clean_hex.erase(std::remove_if(clean_hex.begin(), clean_hex.end(), [](unsigned char c) { return std::isspace(c); }),
-                    clean_hex.end());
-
-    // 2. 验证长度
-    // 每个字节需要2个十六进制字符。M / 8 是字节数。
-    if (clean_hex.length() != (M / 8) * 2) {
-        throw std::invalid_argument("Hex string length is invalid for the bitset size. Expected " +
-                                    std::to_string((M / 8) * 2) + " hex characters (excluding spaces), got " +
-                                    std::to_string(clean_hex.length()));
-    }
-
-    BEP33BloomFilter<K, M> bloomfilter;
-
-    for (std::size_t byte_idx = 0; byte_idx < M / 8; ++byte_idx) {
-        // 从清理后的字符串中提取代表一个字节的两个十六进制字符
-        std::string   byte_hex_str = clean_hex.substr(byte_idx * 2, 2);
-        unsigned char current_byte_value;
-        try {
-            // 使用 stringstream 将两个十六进制字符转换为一个字节值
-            std::stringstream ss_byte;
-            ss_byte << std::hex << byte_hex_str;
-            int byte_val_int;
-            ss_byte >> byte_val_int;
-            if (ss_byte.fail() || byte_val_int < 0 || byte_val_int > 255) {
-                throw std::runtime_error("Invalid hex characters in string: " + byte_hex_str);
-            }
-            current_byte_value = static_cast<unsigned char>(byte_val_int);
-        } catch (const std::exception &e) { // Catches std::invalid_argument from stoul or custom error
-            throw std::runtime_error("Failed to parse hex byte '" + byte_hex_str + "': " + e.what());
+    std::array<std::byte, Bytes> bytes;
+    std::size_t                  nibbles = 0;
+    for (unsigned char c : hex) {
+        if (std::isspace(c)) {
+            continue;
         }
-
-        // 将这个字节的位设置到 bitset 中
-        // `std::bitset` 的索引 `i` 对应第 `i` 位。
-        // 我们需要将 `current_byte_value` 的 LSB 设置到 `mBloom[byte_idx * 8 + 0]`，
-        // MSB 设置到 `mBloom[byte_idx * 8 + 7]`。
-        for (int bit_in_byte_idx = 0; bit_in_byte_idx < 8; ++bit_in_byte_idx) {
-            if ((current_byte_value >> bit_in_byte_idx) & 0x01) {
-                bloomfilter.mBloom[byte_idx * 8 + bit_in_byte_idx] = 1;
-            }
+        auto value = bloom_utils::HexValues[c];
+        if (value < 0) {
+            throw std::invalid_argument(std::string("Invalid hex character in string: ") + char(c));
+        }
+        if (nibbles >= Bytes * 2) {
+            break; // Too long, reported below
+        }
+        if (nibbles % 2 == 0) {
+            bytes[nibbles / 2] = std::byte(value << 4);
+        }
+        else {
+            bytes[nibbles / 2] |= std::byte(value);
         }
+        ++nibbles;
     }
-    return bloomfilter;
+    auto total = std::count_if(hex.begin(), hex.end(), [](unsigned char c) { return !std::isspace(c); });
+    if (std::size_t(total) != Bytes * 2) {
+        throw std::invalid_argument("Hex string length is invalid for the bitset size. Expected " +
+                                    std::to_string(Bytes * 2) + " hex characters (excluding spaces), got " +
+                                    std::to_string(total));
+    }
+    return BEP33BloomFilter<K, M>(bytes);
 }
 
 template <std::size_t K, std::size_t M>
@@ -197,6 +220,17 @@ auto BEP33BloomFilter<K, M>::fromBinaryString(const std::string &binary) -> BEP3
     return BEP33BloomFilter<K, M>(binary);
 }
 
+template <std::size_t K, std::size_t M>
+auto BEP33BloomFilter<K, M>::hash(std::span<const std::byte> data) -> Hash {
+    unsigned char digest[20] = {0};
+    ::SHA1(digest, reinterpret_cast<const unsigned char *>(data.data()), data.size());
+    Hash hash;
+    for (std::size_t i = 0; i < K; ++i) {
+        hash[i] = uint16_t((digest[i * 2] | digest[i * 2 + 1] << 8) % M);
+    }
+    return hash;
+}
+
 template <std::size_t K, std::size_t M>
 void BEP33BloomFilter<K, M>::insertIP(const ilias::IPAddress &ip) {
     insert(ip.span());
@@ -204,12 +238,13 @@ void BEP33BloomFilter<K, M>::insertIP(const ilias::IPAddress &ip) {
 
 template <std::size_t K, std::size_t M>
 void BEP33BloomFilter<K, M>::insert(std::span<const std::byte> data) {
-    unsigned char hash[20] = {0};
-    ::SHA1(hash, reinterpret_cast<const unsigned char *>(data.data()), data.size());
-    for (std::size_t i = 0; i < K * 2; i += 2) {
-        auto index    = hash[i] | hash[i + 1] << 8;
-        index         = index % M;
-        mBloom[index] = 1;
+    insertHash(hash(data));
+}
+
+template <std::size_t K, std::size_t M>
+void BEP33BloomFilter<K, M>::insertHash(const Hash &hash) {
+    for (auto index : hash) {
+        set(index);
     }
 }
 
@@ -220,29 +255,60 @@ auto BEP33BloomFilter<K, M>::testIP(const ilias::IPAddress &ip) const -> bool {
 
 template <std::size_t K, std::size_t M>
 auto BEP33BloomFilter<K, M>::test(std::span<const std::byte> data) const -> bool {
-    unsigned char hash[20] = {0};
-    ::SHA1(hash, reinterpret_cast<const unsigned char *>(data.data()), data.size());
-    for (std::size_t i = 0; i < K * 2; i += 2) {
-        auto index = hash[i] | hash[i + 1] << 8;
-        index      = index % M;
-        if (mBloom[index] == 0) {
+    return testHash(hash(data));
+}
+
+template <std::size_t K, std::size_t M>
+auto BEP33BloomFilter<K, M>::testHash(const Hash &hash) const -> bool {
+    for (auto index : hash) {
+        if (!(*this)[index]) {
             return false;
         }
     }
     return true;
 }
 
+template <std::size_t K, std::size_t M>
+auto BEP33BloomFilter<K, M>::merge(std::span<const std::byte> bytes) -> bool {
+    if (bytes.size() != Bytes) {
+        return false;
+    }
+    for (std::size_t i = 0; i < Words; ++i) {
+        uint64_t word = 0;
+        auto     n    = std::min<std::size_t>(8, Bytes - i * 8);
+        if constexpr (std::endian::native == std::endian::little) {
+            ::memcpy(&word, bytes.data() + i * 8, n);
+        }
+        else {
+            for (std::size_t j = 0; j < n; ++j) {
+                word |= uint64_t(bytes[i * 8 + j]) << (j * 8);
+            }
+        }
+        mWords[i] |= word;
+    }
+    return true;
+}
+
+template <std::size_t K, std::size_t M>
+auto BEP33BloomFilter<K, M>::count() const -> std::size_t {
+    std::size_t n = 0;
+    for (auto word : mWords) {
+        n += std::popcount(word);
+    }
+    return n;
+}
+
 template <std::size_t K, std::size_t M>
 double BEP33BloomFilter<K, M>::calculateEstimatedSize() const { // 注意 const 和返回类型
+    auto   bits     = count();
     double M_double = static_cast<double>(M);
     double K_double = static_cast<double>(K);
-    double c_double = static_cast<double>(
-        std::min(static_cast<std::size_t>(M - 1), M - mBloom.count())); // mBloom.size() - mBloom.count() 是 0 的数量
+    double c_double = static_cast<double>(std::min(static_cast<std::size_t>(M - 1), M - bits)); // 0 的数量
 
     if (c_double < 1.0) { // 如果mbloom中所有位都是1，则c_double = 0，log(0)未定义，且结果没有意义。
         return std::numeric_limits<double>::infinity(); // 或者其他表示饱和的值
     }
-    if (mBloom.count() == 0) { // 如果过滤器为空
+    if (bits == 0) { // 如果过滤器为空
         return 0;
     }
 
@@ -260,42 +326,519 @@ double BEP33BloomFilter<K, M>::calculateEstimatedSize() const { // 注意 const
 
 template <std::size_t K, std::size_t M>
 std::string BEP33BloomFilter<K, M>::toHexString(int bytes_per_space_group) const {
-    std::stringstream ss;
-    ss << std::hex << std::uppercase << std::setfill('0');
-
-    for (std::size_t byte_idx = 0; byte_idx < M / 8; ++byte_idx) {
-        unsigned char current_byte = 0;
-        for (int bit_in_byte_idx = 0; bit_in_byte_idx < 8; ++bit_in_byte_idx) {
-            // mBloom[byte_idx * 8 + bit_in_byte_idx] 是当前字节的第 bit_in_byte_idx 位 (LSB 0-indexed)
-            if (mBloom[byte_idx * 8 + bit_in_byte_idx]) {
-                current_byte |= (1 << bit_in_byte_idx);
-            }
-        }
-        ss << std::setw(2) << static_cast<int>(current_byte);
-
-        if (bytes_per_space_group > 0 && ((byte_idx + 1) % bytes_per_space_group == 0) && (byte_idx + 1 < M / 8)) {
-            ss << " ";
+    std::array<std::byte, Bytes> bytes;
+    toBytes(bytes);
+
+    std::string str;
+    str.reserve(Bytes * 3);
+    for (std::size_t byte_idx = 0; byte_idx < Bytes; ++byte_idx) {
+        auto value = uint8_t(bytes[byte_idx]);
+        str.push_back(bloom_utils::HexDigits[value >> 4]);
+        str.push_back(bloom_utils::HexDigits[value & 0x0F]);
+        if (bytes_per_space_group > 0 && ((byte_idx + 1) % bytes_per_space_group == 0) && (byte_idx + 1 < Bytes)) {
+            str.push_back(' ');
         }
     }
-    return ss.str();
+    return str;
 }
 
 template <std::size_t K, std::size_t M>
 auto BEP33BloomFilter<K, M>::toString() const -> std::string {
-    return mBloom.to_string();
+    // As std::bitset::to_string, the highest bit first
+    std::string str(M, '0');
+    for (std::size_t i = 0; i < M; ++i) {
+        if ((*this)[i]) {
+            str[M - 1 - i] = '1';
+        }
+    }
+    return str;
 }
 
 template <std::size_t K, std::size_t M>
 auto BEP33BloomFilter<K, M>::toBytes() const -> std::vector<std::byte> {
-    std::vector<std::byte> ret;
-    for (std::size_t byte_idx = 0; byte_idx < M / 8; ++byte_idx) {
-        unsigned char current_byte_value = 0;
-        for (int bit_in_byte_idx = 0; bit_in_byte_idx < 8; ++bit_in_byte_idx) {
-            if (mBloom[byte_idx * 8 + bit_in_byte_idx]) {
-                current_byte_value |= (1 << bit_in_byte_idx);
+    std::vector<std::byte> ret(Bytes);
+    toBytes(std::span<std::byte, Bytes>(ret.data(), Bytes));
+    return ret;
+}
+
+template <std::size_t K, std::size_t M>
+auto BEP33BloomFilter<K, M>::toBytes(std::span<std::byte, Bytes> out) const -> void {
+    for (std::size_t i = 0; i < Words; ++i) {
+        auto n = std::min<std::size_t>(8, Bytes - i * 8);
+        if constexpr (std::endian::native == std::endian::little) {
+            ::memcpy(out.data() + i * 8, &mWords[i], n);
+        }
+        else {
+            for (std::size_t j = 0; j < n; ++j) {
+                out[i * 8 + j] = std::byte(mWords[i] >> (j * 8));
             }
         }
-        ret.push_back(static_cast<std::byte>(current_byte_value));
     }
-    return ret;
-}
\ No newline at end of file
+}
+
+template <std::size_t K, std::size_t M>
+auto BEP33BloomFilter<K, M>::operator<<=(std::size_t shift) -> BEP33BloomFilter<K, M> & {
+    if (shift >= M) {
+        reset();
+        return *this;
+    }
+    auto words = shift / 64;
+    auto bits  = shift % 64;
+    for (std::size_t i = Words; i-- > 0;) {
+        uint64_t word = 0;
+        if (i >= words) {
+            word = mWords[i - words] << bits;
+            if (bits != 0 && i > words) {
+                word |= mWords[i - words - 1] >> (64 - bits);
+            }
+        }
+        mWords[i] = word;
+    }
+    trim();
+    return *this;
+}
+
+template <std::size_t K, std::size_t M>
+auto BEP33BloomFilter<K, M>::operator>>=(std::size_t shift) -> BEP33BloomFilter<K, M> & {
+    if (shift >= M) {
+        reset();
+        return *this;
+    }
+    auto words = shift / 64;
+    auto bits  = shift % 64;
+    for (std::size_t i = 0; i < Words; ++i) {
+        uint64_t word = 0;
+        if (i + words < Words) {
+            word = mWords[i + words] >> bits;
+            if (bits != 0 && i + words + 1 < Words) {
+                word |= mWords[i + words + 1] << (64 - bits);
+            }
+        }
+        mWords[i] = word;
+    }
+    return *this;
+}
+
+/**
+ * @brief The cuckoo filter, the approximate membership filter supports deletion
+ *
+ * The header and the table are in one contiguous memory block, so it can be saved by toBytes() and restored by
+ * fromBytes(), or work directly on a memory mapped file by attach(). The false positive rate is about 2 * B / 2^bits
+ * of the Fingerprint (uint8_t ~3%, uint16_t ~0.012%, uint32_t ~2e-9)
+ *
+ * @tparam Fingerprint The unsigned integer type of the fingerprint
+ * @tparam B The number of the slots in each bucket
+ */
+template <typename Fingerprint = uint16_t, std::size_t B = 4>
+class CuckooFilter {
+    static_assert(std::is_unsigned_v<Fingerprint>, "Fingerprint must be a unsigned integer");
+    static_assert(B > 0, "Bucket size B must be greater than 0");
+
+public:
+    struct Header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t fingerprintBits;
+        uint32_t bucketSize;
+        uint32_t victimUsed;  // The victim is the last evicted fingerprint when the table is full
+        uint64_t buckets;     // The number of the buckets, power of 2
+        uint64_t count;       // The number of the items
+        uint64_t victimIndex;
+        uint64_t victimFingerprint;
+        uint8_t  reserved[8];
+    };
+    static_assert(sizeof(Header) == 64);
+
+    static constexpr std::size_t MaxKicks = 500;
+
+    CuckooFilter() = default;
+    CuckooFilter(const CuckooFilter &) = delete;
+    CuckooFilter(CuckooFilter &&) = default;
+
+    /**
+     * @brief Construct a new Cuckoo Filter object in memory
+     *
+     * @param capacity The expected number of the items
+     */
+    explicit CuckooFilter(std::size_t capacity);
+
+    /**
+     * @brief Get the bytes needed by the filter with the capacity (header included)
+     *
+     * @param capacity
+     * @return std::size_t
+     */
+    static auto requiredBytes(std::size_t capacity) -> std::size_t;
+
+    /**
+     * @brief Restore the filter by copying the bytes from toBytes()
+     *
+     * @param bytes
+     * @return std::optional<CuckooFilter> nullopt on invalid bytes
+     */
+    static auto fromBytes(std::span<const std::byte> bytes) -> std::optional<CuckooFilter>;
+
+    /**
+     * @brief Use the external memory (such as memory mapped file) as the storage, the memory must outlive the filter
+     *
+     * @param memory The memory, if it is all zero, it will be formatted to a empty filter with the capacity
+     * @param capacity The capacity used when formatting
+     * @return std::optional<CuckooFilter> nullopt on invalid or too small memory
+     */
+    static auto attach(std::span<std::byte> memory, std::size_t capacity) -> std::optional<CuckooFilter>;
+
+    auto insert(std::span<const std::byte> data) -> bool { return insertHash(hash64(data)); }
+    auto contains(std::span<const std::byte> data) const -> bool { return containsHash(hash64(data)); }
+    auto erase(std::span<const std::byte> data) -> bool { return eraseHash(hash64(data)); }
+
+    /**
+     * @brief Insert the item by a precomputed 64 bits hash
+     *
+     * @param hash
+     * @return true On inserted
+     * @return false On the filter is full
+     */
+    auto insertHash(uint64_t hash) -> bool;
+    auto containsHash(uint64_t hash) const -> bool;
+
+    /**
+     * @brief Remove the item, only remove the item that was inserted, otherwise may remove another item
+     *
+     * @param hash
+     * @return true On found and removed
+     */
+    auto eraseHash(uint64_t hash) -> bool;
+
+    /**
+     * @brief Merge all the items in the other filter, must have the same number of the buckets
+     *
+     * @param other
+     * @return true On all the items are merged
+     */
+    auto merge(const CuckooFilter &other) -> bool;
+
+    auto clear() -> void;
+    auto toBytes() const -> std::vector<std::byte>;
+
+    auto size() const -> std::size_t { return mHeader ? mHeader->count : 0; }
+    auto capacity() const -> std::size_t { return mHeader ? mHeader->buckets * B : 0; }
+    auto loadFactor() const -> double { return capacity() ? double(size()) / double(capacity()) : 0.0; }
+    auto memoryUsage() const -> std::size_t { return mHeader ? sizeof(Header) + capacity() * sizeof(Fingerprint) : 0; }
+    auto isValid() const -> bool { return mHeader != nullptr; }
+
+    auto operator=(const CuckooFilter &) -> CuckooFilter & = delete;
+    auto operator=(CuckooFilter &&) -> CuckooFilter & = default;
+
+    /**
+     * @brief The default hash for the bytes (FNV-1a with murmur3 finalizer)
+     *
+     * @param data
+     * @return uint64_t
+     */
+    static auto hash64(std::span<const std::byte> data) -> uint64_t;
+
+private:
+    static constexpr char Magic[8] = {'C', 'U', 'C', 'K', 'O', 'O', 'F', '1'};
+
+    static auto mix64(uint64_t v) -> uint64_t;
+    static auto bucketsFor(std::size_t capacity) -> std::size_t;
+    static auto format(std::span<std::byte> memory, std::size_t buckets) -> void;
+    static auto validate(std::span<const std::byte> memory) -> bool;
+
+    auto bind(std::byte *memory) -> void;
+    auto fingerprintOf(uint64_t hash) const -> Fingerprint;
+    auto indexOf(uint64_t hash) const -> std::size_t;
+    auto altIndexOf(std::size_t index, Fingerprint fp) const -> std::size_t;
+    auto insertToBucket(std::size_t index, Fingerprint fp) -> bool;
+    auto bucketContains(std::size_t index, Fingerprint fp) const -> bool;
+    auto removeFromBucket(std::size_t index, Fingerprint fp) -> bool;
+    auto insertFingerprint(std::size_t index, Fingerprint fp) -> bool;
+
+    std::vector<std::byte> mOwned;             // The storage if we own it
+    Header                *mHeader = nullptr;
+    Fingerprint           *mTable  = nullptr;  // buckets * B fingerprints, zero is empty slot
+    uint64_t               mRandom = 0x9E3779B97F4A7C15ULL;
+};
+
+template <typename Fingerprint, std::size_t B>
+CuckooFilter<Fingerprint, B>::CuckooFilter(std::size_t capacity) {
+    auto buckets = bucketsFor(capacity);
+    mOwned.resize(sizeof(Header) + buckets * B * sizeof(Fingerprint));
+    format(mOwned, buckets);
+    bind(mOwned.data());
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::requiredBytes(std::size_t capacity) -> std::size_t {
+    return sizeof(Header) + bucketsFor(capacity) * B * sizeof(Fingerprint);
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::fromBytes(std::span<const std::byte> bytes) -> std::optional<CuckooFilter> {
+    if (!validate(bytes)) {
+        return std::nullopt;
+    }
+    CuckooFilter filter;
+    filter.mOwned.assign(bytes.begin(), bytes.end());
+    filter.bind(filter.mOwned.data());
+    return filter;
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::attach(std::span<std::byte> memory, std::size_t capacity)
+    -> std::optional<CuckooFilter> {
+    if (memory.size() < sizeof(Header) || reinterpret_cast<uintptr_t>(memory.data()) % alignof(Header) != 0) {
+        return std::nullopt;
+    }
+    Header header;
+    ::memcpy(&header, memory.data(), sizeof(Header));
+    if (header.magic[0] == 0) { // Fresh memory, format it
+        auto buckets = bucketsFor(capacity);
+        if (memory.size() < sizeof(Header) + buckets * B * sizeof(Fingerprint)) {
+            return std::nullopt;
+        }
+        format(memory, buckets);
+    }
+    if (!validate(memory)) {
+        return std::nullopt;
+    }
+    CuckooFilter filter;
+    filter.bind(memory.data());
+    return filter;
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::insertHash(uint64_t hash) -> bool {
+    if (!mHeader || mHeader->victimUsed) { // Already full
+        return false;
+    }
+    insertFingerprint(indexOf(hash), fingerprintOf(hash));
+    mHeader->count += 1;
+    return true;
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::containsHash(uint64_t hash) const -> bool {
+    if (!mHeader) {
+        return false;
+    }
+    auto fp = fingerprintOf(hash);
+    auto i1 = indexOf(hash);
+    auto i2 = altIndexOf(i1, fp);
+    if (bucketContains(i1, fp) || bucketContains(i2, fp)) {
+        return true;
+    }
+    return mHeader->victimUsed && mHeader->victimFingerprint == fp &&
+           (mHeader->victimIndex == i1 || mHeader->victimIndex == i2);
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::eraseHash(uint64_t hash) -> bool {
+    if (!mHeader) {
+        return false;
+    }
+    auto fp = fingerprintOf(hash);
+    auto i1 = indexOf(hash);
+    auto i2 = altIndexOf(i1, fp);
+    if (removeFromBucket(i1, fp) || removeFromBucket(i2, fp)) {
+        mHeader->count -= 1;
+        if (mHeader->victimUsed) { // Now we have room for the victim, put it back
+            mHeader->victimUsed = 0;
+            insertFingerprint(mHeader->victimIndex, Fingerprint(mHeader->victimFingerprint));
+        }
+        return true;
+    }
+    if (mHeader->victimUsed && mHeader->victimFingerprint == fp &&
+        (mHeader->victimIndex == i1 || mHeader->victimIndex == i2)) {
+        mHeader->victimUsed = 0;
+        mHeader->count -= 1;
+        return true;
+    }
+    return false;
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::merge(const CuckooFilter &other) -> bool {
+    if (!mHeader || !other.mHeader || mHeader->buckets != other.mHeader->buckets) {
+        return false;
+    }
+    // The position of the fingerprint only depends on the number of the buckets, so just insert it at the same bucket
+    for (std::size_t i = 0; i < other.mHeader->buckets; ++i) {
+        for (std::size_t n = 0; n < B; ++n) {
+            auto fp = other.mTable[i * B + n];
+            if (fp == 0) {
+                continue;
+            }
+            if (mHeader->victimUsed) {
+                return false;
+            }
+            insertFingerprint(i, fp);
+            mHeader->count += 1;
+        }
+    }
+    if (other.mHeader->victimUsed) {
+        if (mHeader->victimUsed) {
+            return false;
+        }
+        insertFingerprint(other.mHeader->victimIndex, Fingerprint(other.mHeader->victimFingerprint));
+        mHeader->count += 1;
+    }
+    return true;
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::clear() -> void {
+    if (!mHeader) {
+        return;
+    }
+    ::memset(mTable, 0, mHeader->buckets * B * sizeof(Fingerprint));
+    mHeader->count      = 0;
+    mHeader->victimUsed = 0;
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::toBytes() const -> std::vector<std::byte> {
+    if (!mHeader) {
+        return {};
+    }
+    auto begin = reinterpret_cast<const std::byte *>(mHeader);
+    return std::vector<std::byte>(begin, begin + memoryUsage());
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::hash64(std::span<const std::byte> data) -> uint64_t {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (auto byte : data) {
+        hash ^= std::to_integer<uint64_t>(byte);
+        hash *= 0x100000001B3ULL;
+    }
+    return mix64(hash);
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::mix64(uint64_t v) -> uint64_t {
+    v ^= v >> 33;
+    v *= 0xFF51AFD7ED558CCDULL;
+    v ^= v >> 33;
+    v *= 0xC4CEB9FE1A85EC53ULL;
+    v ^= v >> 33;
+    return v;
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::bucketsFor(std::size_t capacity) -> std::size_t {
+    // Keep the load factor under 0.95
+    auto buckets = std::max<std::size_t>((capacity * 100 / 95 + B - 1) / B, 1);
+    return std::bit_ceil(buckets);
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::format(std::span<std::byte> memory, std::size_t buckets) -> void {
+    Header header {};
+    ::memcpy(header.magic, Magic, sizeof(Magic));
+    header.version         = 1;
+    header.fingerprintBits = sizeof(Fingerprint) * 8;
+    header.bucketSize      = B;
+    header.buckets         = buckets;
+    ::memset(memory.data(), 0, sizeof(Header) + buckets * B * sizeof(Fingerprint));
+    ::memcpy(memory.data(), &header, sizeof(Header));
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::validate(std::span<const std::byte> memory) -> bool {
+    if (memory.size() < sizeof(Header)) {
+        return false;
+    }
+    Header header;
+    ::memcpy(&header, memory.data(), sizeof(Header));
+    if (::memcmp(header.magic, Magic, sizeof(Magic)) != 0 || header.version != 1 ||
+        header.fingerprintBits != sizeof(Fingerprint) * 8 || header.bucketSize != B ||
+        !std::has_single_bit(header.buckets)) {
+        return false;
+    }
+    return memory.size() >= sizeof(Header) + header.buckets * B * sizeof(Fingerprint);
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::bind(std::byte *memory) -> void {
+    mHeader = reinterpret_cast<Header *>(memory);
+    mTable  = reinterpret_cast<Fingerprint *>(memory + sizeof(Header));
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::fingerprintOf(uint64_t hash) const -> Fingerprint {
+    // Use the high bits, the low bits are used for the index
+    auto fp = Fingerprint(hash >> (64 - sizeof(Fingerprint) * 8));
+    return fp == 0 ? 1 : fp; // Zero means empty slot
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::indexOf(uint64_t hash) const -> std::size_t {
+    return std::size_t(hash) & (mHeader->buckets - 1);
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::altIndexOf(std::size_t index, Fingerprint fp) const -> std::size_t {
+    return (index ^ std::size_t(mix64(fp))) & (mHeader->buckets - 1);
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::insertToBucket(std::size_t index, Fingerprint fp) -> bool {
+    auto bucket = mTable + index * B;
+    for (std::size_t n = 0; n < B; ++n) {
+        if (bucket[n] == 0) {
+            bucket[n] = fp;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::bucketContains(std::size_t index, Fingerprint fp) const -> bool {
+    auto bucket = mTable + index * B;
+    for (std::size_t n = 0; n < B; ++n) {
+        if (bucket[n] == fp) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::removeFromBucket(std::size_t index, Fingerprint fp) -> bool {
+    auto bucket = mTable + index * B;
+    for (std::size_t n = 0; n < B; ++n) {
+        if (bucket[n] == fp) {
+            bucket[n] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Fingerprint, std::size_t B>
+auto CuckooFilter<Fingerprint, B>::insertFingerprint(std::size_t index, Fingerprint fp) -> bool {
+    auto alt = altIndexOf(index, fp);
+    if (insertToBucket(index, fp) || insertToBucket(alt, fp)) {
+        return true;
+    }
+    // Both buckets are full, kick out a random one and move it to its alternate bucket
+    index = (mRandom & 1) ? index : alt;
+    for (std::size_t kick = 0; kick < MaxKicks; ++kick) {
+        mRandom ^= mRandom << 13;
+        mRandom ^= mRandom >> 7;
+        mRandom ^= mRandom << 17;
+        auto &slot = mTable[index * B + mRandom % B];
+        std::swap(slot, fp);
+        index = altIndexOf(index, fp);
+        if (insertToBucket(index, fp)) {
+            return true;
+        }
+    }
+    // The table is too full, keep the last one as victim, so no item is lost
+    mHeader->victimUsed        = 1;
+    mHeader->victimIndex       = index;
+    mHeader->victimFingerprint = fp;
+    return false;
+}
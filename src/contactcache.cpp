@@ -0,0 +1,109 @@
+#include "contactcache.hpp"
+#include <algorithm>
+
+inline constexpr size_t CONTACT_CACHE_MAX_PREFIX_BITS = 20;
+inline constexpr size_t CONTACT_CACHE_MAX_SCAN        = 64; // The max buckets scanned per find, bound the cost
+
+ContactCache::ContactCache(size_t prefixBits, size_t bucketSize, std::chrono::seconds ttl) :
+    mPrefixBits(std::min(prefixBits, CONTACT_CACHE_MAX_PREFIX_BITS)), mBucketSize(std::max<size_t>(bucketSize, 1)),
+    mTtl(uint32_t(std::max<int64_t>(ttl.count(), 1))) {
+    mContacts.resize((size_t(1) << mPrefixBits) * mBucketSize);
+}
+
+ContactCache::~ContactCache() {
+
+}
+
+auto ContactCache::add(const NodeEndpoint &node) -> void {
+    if (node.id == NodeId {}) {
+        return;
+    }
+    auto  current = now();
+    auto  bucket  = bucketOf(prefixOf(node.id));
+    auto *victim  = &bucket.front();
+    for (auto &contact : bucket) {
+        if (contact.node == node) { // Refresh it
+            contact.seen = current;
+            return;
+        }
+        // Prefer the empty slot, then the oldest one
+        if (victim->node.id != NodeId {} && (contact.node.id == NodeId {} || contact.seen < victim->seen)) {
+            victim = &contact;
+        }
+    }
+    if (victim->node.id == NodeId {}) {
+        mSize += 1;
+    }
+    victim->node = node;
+    victim->seen = current;
+}
+
+auto ContactCache::remove(const NodeEndpoint &node) -> void {
+    for (auto &contact : bucketOf(prefixOf(node.id))) {
+        if (contact.node == node) {
+            contact = Contact {};
+            mSize  -= 1;
+            return;
+        }
+    }
+}
+
+auto ContactCache::findClosestNodes(const NodeId &target, size_t max) const -> std::vector<NodeEndpoint> {
+    std::vector<NodeEndpoint> nodes;
+    if (mSize == 0 || max == 0) {
+        return nodes;
+    }
+    auto current = now();
+    auto prefix  = prefixOf(target);
+    auto buckets = std::min(size_t(1) << mPrefixBits, CONTACT_CACHE_MAX_SCAN);
+    // The xor of the prefixes is the prefix of the distance, so the buckets are visited from the closest. After a
+    // bucket is done, the contacts in the rest buckets are all farther, stop if we have enough
+    for (size_t i = 0; i < buckets && nodes.size() < max; ++i) {
+        for (auto &contact : bucketOf(prefix ^ i)) {
+            if (contact.node.id != NodeId {} && contact.seen + mTtl > current) {
+                nodes.push_back(contact.node);
+            }
+        }
+    }
+    std::sort(nodes.begin(), nodes.end(), [&target](const NodeEndpoint &a, const NodeEndpoint &b) {
+        return a.id.distance(target) < b.id.distance(target);
+    });
+    if (nodes.size() > max) {
+        nodes.resize(max);
+    }
+    return nodes;
+}
+
+auto ContactCache::clear() -> void {
+    std::fill(mContacts.begin(), mContacts.end(), Contact {});
+    mSize = 0;
+}
+
+auto ContactCache::setClock(std::function<Clock::time_point ()> clock) -> void {
+    mClock      = std::move(clock);
+    mCreateTime = mClock();
+    clear(); // The seen times are of the old clock
+}
+
+auto ContactCache::size() const -> size_t {
+    return mSize;
+}
+
+auto ContactCache::prefixOf(const NodeId &id) const -> size_t {
+    auto     bytes = id.toStringView();
+    uint32_t value = (uint32_t(uint8_t(bytes[0])) << 24) | (uint32_t(uint8_t(bytes[1])) << 16) |
+                     (uint32_t(uint8_t(bytes[2])) << 8) | uint32_t(uint8_t(bytes[3]));
+    return mPrefixBits == 0 ? 0 : value >> (32 - mPrefixBits);
+}
+
+auto ContactCache::bucketOf(size_t prefix) -> std::span<Contact> {
+    return std::span(mContacts).subspan(prefix * mBucketSize, mBucketSize);
+}
+
+auto ContactCache::bucketOf(size_t prefix) const -> std::span<const Contact> {
+    return std::span(mContacts).subspan(prefix * mBucketSize, mBucketSize);
+}
+
+auto ContactCache::now() const -> uint32_t {
+    return uint32_t(std::chrono::duration_cast<std::chrono::seconds>(mClock() - mCreateTime).count());
+}
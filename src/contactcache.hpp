@@ -0,0 +1,105 @@
+/**
+ * @file contactcache.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The short-lived cache of the contacts met in the recent lookups
+ * @version 0.1
+ * @date 2025-06-06
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "nodeid.hpp"
+#include <functional>
+#include <chrono>
+#include <vector>
+#include <span>
+
+/**
+ * @brief The nodes that replied in the recent lookups, indexed by the top bits of the id (the keyspace prefix)
+ *
+ * The routing table is dense near us and sparse far away, so a lookup of a far target starts several hops away. The
+ * lookups of the random diffusion and the get_peers often hit the regions we just walked, the contacts cached here
+ * let them start next to the target instead. It is a flat array of the buckets, one bucket per prefix, the oldest
+ * contact in the bucket is replaced when full. The contacts expire after the ttl, the cache is never persisted
+ *
+ */
+class ContactCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Construct a new Contact Cache object
+     *
+     * @param prefixBits The bits of the prefix, there are 2 ^ prefixBits buckets
+     * @param bucketSize The max contacts per bucket
+     * @param ttl The time a contact is kept after it last replied
+     */
+    ContactCache(size_t prefixBits = 10, size_t bucketSize = 8, std::chrono::seconds ttl = std::chrono::minutes(5));
+    ContactCache(const ContactCache &) = delete;
+    ~ContactCache();
+
+    /**
+     * @brief Add or refresh the contact, call it when the node replied
+     *
+     * @param node
+     */
+    auto add(const NodeEndpoint &node) -> void;
+
+    /**
+     * @brief Remove the contact, call it when the node failed to reply
+     *
+     * @param node
+     */
+    auto remove(const NodeEndpoint &node) -> void;
+
+    /**
+     * @brief Find the closest contacts to the target, it only scans the buckets of the nearby prefixes
+     *
+     * @param target
+     * @param max
+     * @return std::vector<NodeEndpoint> (Sorted by distance)
+     */
+    auto findClosestNodes(const NodeId &target, size_t max) const -> std::vector<NodeEndpoint>;
+
+    /**
+     * @brief Remove all the contacts
+     *
+     */
+    auto clear() -> void;
+
+    /**
+     * @brief Get the number of the contacts, including the expired ones not replaced yet
+     *
+     * @return size_t
+     */
+    auto size() const -> size_t;
+
+    /**
+     * @brief Set the time source of the ttl, the contacts of the old clock are dropped, e.g. the virtual clock of a simulation, the steady clock by default
+     *
+     * @param clock
+     */
+    auto setClock(std::function<Clock::time_point ()> clock) -> void;
+
+    auto operator =(const ContactCache &) -> ContactCache & = delete;
+private:
+    struct Contact {
+        NodeEndpoint node; // The zero id means empty slot
+        uint32_t     seen; // The seconds since the cache created
+    };
+
+    auto prefixOf(const NodeId &id) const -> size_t;
+    auto bucketOf(size_t prefix) -> std::span<Contact>;
+    auto bucketOf(size_t prefix) const -> std::span<const Contact>;
+    auto now() const -> uint32_t;
+
+    std::vector<Contact> mContacts; // The buckets, bucket i is [i * bucketSize, (i + 1) * bucketSize)
+    std::function<Clock::time_point ()> mClock = Clock::now;
+    Clock::time_point    mCreateTime = Clock::now();
+    size_t               mPrefixBits;
+    size_t               mBucketSize;
+    uint32_t             mTtl;
+    size_t               mSize = 0;
+};
@@ -0,0 +1,91 @@
+#include "coverage.hpp"
+#include <algorithm>
+#include <array>
+
+inline constexpr size_t COVERAGE_MAX_PREFIX_BITS = 16;
+
+KeyspaceCoverage::KeyspaceCoverage(size_t prefixBits) : mPrefixBits(std::min(prefixBits, COVERAGE_MAX_PREFIX_BITS)) {
+    mRegions.resize(size_t(1) << mPrefixBits);
+}
+
+KeyspaceCoverage::~KeyspaceCoverage() {
+
+}
+
+auto KeyspaceCoverage::add(const NodeId &id, Kind kind) -> void {
+    auto &region = mRegions[prefixOf(id)];
+    if (kind == Sampled) {
+        if (region.sampled++ == 0) {
+            mCovered += 1;
+        }
+    }
+    else {
+        region.known += 1;
+    }
+}
+
+auto KeyspaceCoverage::remove(const NodeId &id, Kind kind) -> void {
+    auto &region = mRegions[prefixOf(id)];
+    if (kind == Sampled) {
+        if (region.sampled > 0 && --region.sampled == 0) {
+            mCovered -= 1;
+        }
+    }
+    else if (region.known > 0) {
+        region.known -= 1;
+    }
+}
+
+auto KeyspaceCoverage::randomTarget(std::mt19937 &random) const -> NodeId {
+    // Reservoir sampling over the regions of the min score, so the ties are picked uniformly in one pass
+    size_t prefix = 0;
+    size_t best   = SIZE_MAX;
+    size_t ties   = 0;
+    for (size_t i = 0; i < mRegions.size(); ++i) {
+        auto value = score(i);
+        if (value < best) {
+            best   = value;
+            prefix = i;
+            ties   = 1;
+        }
+        else if (value == best && std::uniform_int_distribution<size_t>(0, ties++)(random) == 0) {
+            prefix = i;
+        }
+    }
+
+    // Replace the top bits of a random id with the prefix
+    std::array<uint8_t, 20> bytes;
+    for (auto &byte : bytes) {
+        byte = uint8_t(random());
+    }
+    for (size_t bit = 0; bit < mPrefixBits; ++bit) {
+        auto mask  = uint8_t(0x80 >> (bit % 8));
+        auto value = (prefix >> (mPrefixBits - 1 - bit)) & 1;
+        bytes[bit / 8] = value ? (bytes[bit / 8] | mask) : (bytes[bit / 8] & ~mask);
+    }
+    return NodeId::from(bytes.data(), bytes.size());
+}
+
+auto KeyspaceCoverage::score(size_t prefix) const -> size_t {
+    return mRegions[prefix].known + mRegions[prefix].sampled * 2;
+}
+
+auto KeyspaceCoverage::coveredRegions() const -> size_t {
+    return mCovered;
+}
+
+auto KeyspaceCoverage::regions() const -> size_t {
+    return mRegions.size();
+}
+
+auto KeyspaceCoverage::prefixOf(const NodeId &id) const -> size_t {
+    auto     bytes = id.toStringView();
+    uint32_t value = (uint32_t(uint8_t(bytes[0])) << 24) | (uint32_t(uint8_t(bytes[1])) << 16) |
+                     (uint32_t(uint8_t(bytes[2])) << 8) | uint32_t(uint8_t(bytes[3]));
+    return mPrefixBits == 0 ? 0 : value >> (32 - mPrefixBits);
+}
+
+auto KeyspaceCoverage::clear() -> void {
+    std::fill(mRegions.begin(), mRegions.end(), Region {});
+    mCovered = 0;
+}
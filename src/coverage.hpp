@@ -0,0 +1,92 @@
+/**
+ * @file coverage.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The map of the keyspace covered by the BEP51 nodes we know and sampled
+ * @version 0.1
+ * @date 2025-06-06
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "nodeid.hpp"
+#include <cstdint>
+#include <random>
+#include <vector>
+
+/**
+ * @brief Count the nodes per keyspace prefix (the top bits of the id), to find the regions we know little about
+ *
+ * The nodes only sample the hashes close to their id, so the nodes in the same region return the same hashes. The
+ * random diffusion targets the least covered prefix instead of a uniform random one, then the new nodes are spread
+ * over the keyspace and each sample query returns more unseen hashes. A sampled node counts more than a known one
+ *
+ */
+class KeyspaceCoverage {
+public:
+    enum Kind {
+        Known   = 0, // The node is in the sample list, but not sampled yet
+        Sampled = 1, // The node replied the sample_infohashes
+    };
+
+    /**
+     * @brief Construct a new Keyspace Coverage object
+     *
+     * @param prefixBits The bits of the prefix, there are 2 ^ prefixBits regions
+     */
+    KeyspaceCoverage(size_t prefixBits = 8);
+    ~KeyspaceCoverage();
+
+    /**
+     * @brief Count the node in the region of the id
+     *
+     * @param id
+     * @param kind
+     */
+    auto add(const NodeId &id, Kind kind) -> void;
+
+    /**
+     * @brief Uncount the node, the id and kind must be the added ones
+     *
+     * @param id
+     * @param kind
+     */
+    auto remove(const NodeId &id, Kind kind) -> void;
+
+    /**
+     * @brief Pick a random target in one of the least covered regions
+     *
+     * @param random
+     * @return NodeId
+     */
+    auto randomTarget(std::mt19937 &random) const -> NodeId;
+
+    /**
+     * @brief Get the score of the region, the sampled nodes count twice
+     *
+     * @param prefix
+     * @return size_t
+     */
+    auto score(size_t prefix) const -> size_t;
+
+    /**
+     * @brief Get the number of the regions that have at least one sampled node
+     *
+     * @return size_t
+     */
+    auto coveredRegions() const -> size_t;
+
+    auto regions() const -> size_t;
+    auto prefixOf(const NodeId &id) const -> size_t;
+    auto clear() -> void;
+private:
+    struct Region {
+        uint32_t known   = 0;
+        uint32_t sampled = 0;
+    };
+
+    std::vector<Region> mRegions;
+    size_t              mPrefixBits;
+    size_t              mCovered = 0;
+};
@@ -0,0 +1,169 @@
+/**
+ * @file endpoint.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The compact endpoint, the packed form of the ip and port used in the dht (BEP5)
+ * @version 0.1
+ * @date 2025-06-06
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "net.hpp"
+#include <string_view>
+#include <algorithm>
+#include <optional>
+#include <compare>
+#include <cstring>
+#include <cstdint>
+#include <format>
+#include <string>
+#include <array>
+#include <span>
+
+/**
+ * @brief The ip and port packed as the compact endpoint (6 bytes for v4, 18 bytes for v6, the port in big endian)
+ *
+ * It is what the node info and the peer info on the wire look like, so the decoding of the replies is a memcpy. It is
+ * used in the node tables and the sets instead of the IPEndpoint (a sockaddr), and converted back by toEndpoint() when
+ * the packet is sent. The unused bytes are always zero, so the comparison and the hash just look at the bytes
+ *
+ */
+class CompactEndpoint {
+public:
+    CompactEndpoint() = default;
+    CompactEndpoint(const CompactEndpoint &) = default;
+
+    /**
+     * @brief Pack the endpoint, the invalid (neither v4 nor v6) one becomes the empty one
+     *
+     * @param endpoint
+     */
+    CompactEndpoint(const IPEndpoint &endpoint) {
+        auto family = endpoint.family();
+        if (family != AF_INET && family != AF_INET6) {
+            return;
+        }
+        auto address = endpoint.address();
+        auto bytes   = address.span();
+        auto port    = endpoint.port();
+        ::memcpy(mData.data(), bytes.data(), bytes.size());
+        mData[bytes.size()]     = std::byte(port >> 8);
+        mData[bytes.size() + 1] = std::byte(port & 0xFF);
+        mLen = uint8_t(bytes.size() + 2);
+    }
+
+    /**
+     * @brief Make it from the wire bytes
+     *
+     * @param bytes
+     * @return std::optional<CompactEndpoint> nullopt on the size is neither 6 nor 18
+     */
+    static auto fromBytes(std::span<const std::byte> bytes) -> std::optional<CompactEndpoint> {
+        if (bytes.size() != 6 && bytes.size() != 18) {
+            return std::nullopt;
+        }
+        CompactEndpoint endpoint;
+        ::memcpy(endpoint.mData.data(), bytes.data(), bytes.size());
+        endpoint.mLen = uint8_t(bytes.size());
+        return endpoint;
+    }
+
+    static auto fromBytes(std::string_view bytes) -> std::optional<CompactEndpoint> {
+        return fromBytes(std::as_bytes(std::span(bytes)));
+    }
+
+    /**
+     * @brief Unpack to the endpoint, for the socket
+     *
+     * @return IPEndpoint The default one if empty
+     */
+    auto toEndpoint() const -> IPEndpoint {
+        if (mLen == 0) {
+            return IPEndpoint {};
+        }
+        return IPEndpoint(address(), port());
+    }
+
+    /**
+     * @brief Get the address part
+     *
+     * @return IPAddress The default (invalid) one if empty
+     */
+    auto address() const -> IPAddress {
+        if (mLen == 0) {
+            return IPAddress {};
+        }
+        return IPAddress::fromRaw(mData.data(), mLen - 2).value();
+    }
+
+    auto family() const -> int {
+        return mLen == 18 ? AF_INET6 : (mLen == 6 ? AF_INET : AF_UNSPEC);
+    }
+
+    auto port() const -> uint16_t {
+        return mLen == 0 ? 0 : uint16_t((uint16_t(mData[mLen - 2]) << 8) | uint16_t(mData[mLen - 1]));
+    }
+
+    /**
+     * @brief Get the wire bytes
+     *
+     * @return std::span<const std::byte> 6 or 18 bytes, empty if empty
+     */
+    auto bytes() const -> std::span<const std::byte> {
+        return std::span(mData).first(mLen);
+    }
+
+    auto toStringView() const -> std::string_view {
+        return std::string_view(reinterpret_cast<const char *>(mData.data()), mLen);
+    }
+
+    auto toString() const -> std::string {
+        return toEndpoint().toString();
+    }
+
+    auto isValid() const -> bool {
+        return mLen != 0;
+    }
+
+    /**
+     * @brief Hash the bytes by 8 bytes words
+     *
+     * @return size_t
+     */
+    auto hash() const -> size_t {
+        uint64_t h = mLen;
+        for (size_t i = 0; i < mLen; i += 8) {
+            uint64_t word = 0;
+            ::memcpy(&word, mData.data() + i, std::min<size_t>(8, mLen - i));
+            h  = (h ^ word) * 0x9E3779B97F4A7C15ULL;
+            h ^= h >> 32;
+        }
+        return size_t(h);
+    }
+
+    auto operator =(const CompactEndpoint &) -> CompactEndpoint & = default;
+    auto operator <=>(const CompactEndpoint &) const noexcept = default;
+private:
+    std::array<std::byte, 18> mData {};
+    uint8_t                   mLen = 0; // 0, 6 or 18
+};
+
+template <>
+struct std::hash<CompactEndpoint> {
+    auto operator()(const CompactEndpoint &endpoint) const noexcept -> size_t {
+        return endpoint.hash();
+    }
+};
+
+template <>
+struct std::formatter<CompactEndpoint> {
+    constexpr auto parse(std::format_parse_context &ctxt) const {
+        return ctxt.begin();
+    }
+
+    auto format(const CompactEndpoint &endpoint, std::format_context &ctxt) const {
+        return std::format_to(ctxt.out(), "{}", endpoint.toEndpoint());
+    }
+};
@@ -13,7 +13,17 @@ auto FetchManager::addHash(const InfoHash& hash, const IPEndpoint& endpoint)
     if (mFetched.contains(hash)) {
         return;
     }
-    mPending[hash].insert(endpoint);
+    auto it = mPending.find(hash);
+    if (it == mPending.end()) {
+        if (mPending.size() >= mMaxPending) { // Too many hashs waiting, drop it
+            BT_LOG("Too many pending hashs, drop the hash {}", hash);
+            return;
+        }
+        it = mPending.try_emplace(hash).first;
+    }
+    if (it->second.size() < mMaxPendingEndpoints) {
+        it->second.insert(endpoint);
+    }
     // Add the fetching task into it
     if (mScope.runningTasks() < mMaxCocurrent && mPending.size() > 0 && !mWorkers.contains(hash)) {
         // Spawn a new worker to fetch the first hash
@@ -44,8 +54,8 @@ auto FetchManager::doFetch(InfoHash hash) -> Task<void> {
     auto self = co_await currentTask();
     while (!mPending[hash].empty()) {
         // Got the pending hash we try to fetch
-        auto endpoint = *mPending[hash].begin();
-        mPending[hash].erase(endpoint);
+        auto endpoint = mPending[hash].begin()->toEndpoint();
+        mPending[hash].erase(mPending[hash].begin());
 
         BT_LOG("Worker connect to {}", endpoint);
         DynStreamClient client;
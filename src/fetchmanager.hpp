@@ -12,6 +12,7 @@
 #include <ilias/sync.hpp>
 #include <functional>
 #include "nodeid.hpp"
+#include "hashstore.hpp"
 #include "net.hpp"
 #include "utp.hpp"
 #include <map>
@@ -45,14 +46,16 @@ private:
 
     std::map<
         InfoHash,
-        std::set<IPEndpoint>
-    > mPending; //< The pending hashs we are fetching
+        std::set<CompactEndpoint>
+    > mPending; //< The pending hashs we are fetching, and the peers of them
 
-    std::set<InfoHash> mFetched; //< The hashs we have fetched
+    InfoHashStore mFetched {64 * 1024 * 1024}; //< The hashs we have fetched
     std::set<InfoHash> mWorkers; // < The hashs we are working on
     TaskScope   mScope;
     UtpContext *mUtp = nullptr; // < The utp session we are using
 
     size_t mMaxCocurrent = 5;
+    size_t mMaxPending = 10000; //< The max number of the hashs waiting to be fetched
+    size_t mMaxPendingEndpoints = 32; //< The max number of the endpoints of a hash waiting to be connected
     std::function<void (InfoHash hash, std::vector<std::byte> data)> mOnFetched;
 };
\ No newline at end of file
@@ -1,12 +1,10 @@
 #include "getpeersmanager.hpp"
+#include "bloomfilter.hpp"
 #include <ilias/task/when_all.hpp>
+#include <unordered_set>
 
 GetPeersManager::GetPeersManager(DhtSession &session) : mSession(session) {
-    // auto [sender, receiver] = mpmc::channel<InfoHash>();
-    // mSender = sender;
-    // for (size_t i = 0; i < mMaxCoCurrent; i++) {
-    //     mScope.spawn(getPeersWorker(receiver));
-    // }
+    spawnWorkers();
 }
 
 GetPeersManager::~GetPeersManager() {
@@ -14,14 +12,51 @@ GetPeersManager::~GetPeersManager() {
     mScope.wait();
 }
 
-auto GetPeersManager::addHash(const InfoHash &hash) -> void {
+auto GetPeersManager::addHash(const InfoHash &hash, Priority priority) -> bool {
     if (mFinished.contains(hash)) {
-        return;
+        return false;
     }
-    auto [it, emplace] = mHashes.emplace(hash);
-    if (emplace) {
-        mScope.spawn(getPeersWorker(hash));
+    if (auto it = mHashes.find(hash); it != mHashes.end()) {
+        if (!it->second.running && priority < it->second.priority) { // Promote it, the old item becomes stale
+            it->second.priority = priority;
+            enqueue(hash, it->second);
+        }
+        return true; // Queued or running already
+    }
+    if (queueSize() >= mMaxQueueSize) {
+        // Make room for the higher priority one by dropping the oldest sampled hash, skip the stale items
+        auto &low = mQueues[Sample];
+        while (!low.empty() && !isLive(low.front())) {
+            low.pop_front();
+        }
+        if (priority == Sample || low.empty()) {
+            GET_PEERS_LOG("Queue is full, drop the hash {}", hash);
+            return false;
+        }
+        GET_PEERS_LOG("Queue is full, drop the hash {}", low.front().hash);
+        mHashes.erase(low.front().hash);
+        low.pop_front();
+        mQueued -= 1;
     }
+    auto &state = mHashes.try_emplace(hash, HashState {.priority = priority}).first->second;
+    mQueued += 1;
+    enqueue(hash, state);
+    return true;
+}
+
+auto GetPeersManager::enqueue(const InfoHash &hash, HashState &state) -> void {
+    state.generation = ++mGeneration;
+    mQueues[state.priority].push_back({hash, state.generation, std::chrono::steady_clock::now()});
+    mQueueEvent.set();
+}
+
+auto GetPeersManager::isLive(const QueueItem &item) const -> bool {
+    auto it = mHashes.find(item.hash);
+    return it != mHashes.end() && !it->second.running && it->second.generation == item.generation;
+}
+
+auto GetPeersManager::markFinished(const InfoHash &hash) -> void {
+    mFinished.insert(hash);
 }
 
 auto GetPeersManager::setOnPeerGot(std::function<void(const InfoHash &hash, const IPEndpoint &peer)> fn) -> void {
@@ -32,93 +67,191 @@ auto GetPeersManager::getPeers(const InfoHash &target) -> Task<void> {
     // Prepare 8 nodes for init finding
     constexpr size_t MAX_ITERATION = 10;
     constexpr size_t MAX_ITERATION_WITHOUT_CLOSEST = 3;
+    constexpr size_t MAX_PEERS = 8;
     constexpr size_t BATCH_SIZE = 8;
-    std::vector<NodeEndpoint> nodes = mSession.routingTable().findClosestNodes(target, KBUCKET_SIZE);
-    std::set<NodeEndpoint> visisted;
-    std::vector<IPEndpoint> peers;
+    std::vector<NodeEndpoint> nodes = mSession.findStartNodes(target, KBUCKET_SIZE);
+    NodeSet visisted;
+    std::unordered_set<CompactEndpoint> peers; // The peers we already notified
     std::optional<NodeEndpoint> closest;
     size_t iterationCount = 0;
     size_t iterationWithoutClosest = 0; // The iteration count without new node replace the current closest node
+    bool canceled = false;
+
+    auto finished = [&]() {
+        return canceled || peers.size() >= MAX_PEERS || mFinished.contains(target);
+    };
 
-    while (!nodes.empty() && iterationCount < MAX_ITERATION && iterationWithoutClosest < MAX_ITERATION_WITHOUT_CLOSEST && peers.size() < 8) {
+    while (!nodes.empty() && iterationCount < MAX_ITERATION && iterationWithoutClosest < MAX_ITERATION_WITHOUT_CLOSEST && !finished()) {
         bool closestChanged = false; // Did the closest node changed ?
         ++iterationCount;
 
         // Prepare query from the closest node
         std::vector<NodeEndpoint> batch;
-        std::vector<IoTask<GetPeersReply> > tasks;
         while (batch.size() < BATCH_SIZE && !nodes.empty()) {
             batch.push_back(nodes.front());
             nodes.erase(nodes.begin());
         }
+
+        // Handle each reply as soon as it arrived, so the peers can be delivered without waiting the whole batch
+        auto scope = co_await TaskScope::make();
         for (auto &endpoint : batch) {
             GET_PEERS_LOG("iteration[{}] Try get peer {} to {}", iterationCount, target, endpoint);
-            tasks.push_back(mSession.getPeers(endpoint.ip, endpoint.id));
             visisted.insert(endpoint);
-        }
-        for (auto &reply : co_await whenAll(std::move(tasks))) {
-            if (!reply) {
-                if (reply.error() == Error::Canceled) {
+            scope.spawn([&, this]() -> Task<void> {
+                auto reply = co_await mSession.getPeers(endpoint.ip.toEndpoint(), target, false, endpoint.id);
+                if (!reply) {
+                    if (reply.error() == Error::Canceled) {
+                        canceled = true;
+                        scope.cancel();
+                    }
                     co_return;
                 }
-                continue;
-            }
-            auto &values = reply->values;
-            auto &rnodes = reply->nodes;
-            // Insert the peers we got
-            peers.insert(peers.end(), values.begin(), values.end());
-
-            // Collect the node
-            for (auto &node : rnodes) {
-                if (!closest || closest->id.distance(target) > node.id.distance(target)) {
-                    closest = node;
-                    // Set it
-                    closestChanged = true;
-                    iterationWithoutClosest = 0;
+                // Notify the new peers we got
+                for (auto &peer : reply->values) {
+                    if (!peers.insert(peer).second) {
+                        continue;
+                    }
+                    if (mOnPeerGot) {
+                        mOnPeerGot(target, peer);
+                    }
                 }
-                if (!visisted.contains(node)) {
-                    nodes.push_back(node);
+
+                // Collect the node
+                for (auto &node : reply->nodes) {
+                    if (!closest || closest->id.distance(target) > node.id.distance(target)) {
+                        closest = node;
+                        // Set it
+                        closestChanged = true;
+                        iterationWithoutClosest = 0;
+                    }
+                    if (!visisted.contains(node)) {
+                        nodes.push_back(node);
+                    }
+                }
+                if (finished()) { // Got enough peers or the hash was fetched by others
+                    scope.cancel();
                 }
-            }
-            // Sort it
-            std::sort(nodes.begin(), nodes.end(), [&target](const NodeEndpoint &a, const NodeEndpoint &b) {
-                return a.id.distance(target) < b.id.distance(target);
             });
-            nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
         }
+        co_await scope; // Join all the queries of this batch
+
+        // Sort it
+        std::sort(nodes.begin(), nodes.end(), [&target](const NodeEndpoint &a, const NodeEndpoint &b) {
+            return a.id.distance(target) < b.id.distance(target);
+        });
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
         if (!closestChanged) {
             ++iterationWithoutClosest;
         }
     }
-    GET_PEERS_LOG("Done, {} peers found, iteration {}, iterationWithoutClosest {}", peers.size(), iterationCount, iterationWithoutClosest);
-    // Notify the peers
-    if (mOnPeerGot && !peers.empty()) {
-        for (auto &peer : peers) {
-            mOnPeerGot(target, peer);
-        }
-    }
+    GET_PEERS_LOG("Done, {} peers found, iteration {}, iterationWithoutClosest {}, finished {}", peers.size(), iterationCount, iterationWithoutClosest, mFinished.contains(target));
     co_return;
 }
 
-// TODO: Replace the Event to Sem
-auto GetPeersManager::getPeersWorker(InfoHash hash) -> Task<void> {
-    while (mCoCurrent >= mMaxCoCurrent) {
-        if (auto val = co_await mEvent; !val) { // Wait the event or cancel requests
-            co_return;
+auto GetPeersManager::estimateSwarm(const InfoHash &target) -> Task<SwarmEstimate> {
+    // The peers announce to the ~8 closest nodes, so walk to them and merge the filters on the way
+    constexpr size_t MAX_ITERATION = 4;
+    constexpr size_t BATCH_SIZE = 8;
+    std::vector<NodeEndpoint> nodes = mSession.findStartNodes(target, KBUCKET_SIZE);
+    NodeSet visisted;
+    BEP33BloomFilter<> seeds;
+    BEP33BloomFilter<> peers;
+    SwarmEstimate estimate;
+    bool canceled = false;
+
+    for (size_t iterationCount = 0; !nodes.empty() && iterationCount < MAX_ITERATION && !canceled; ++iterationCount) {
+        std::vector<NodeEndpoint> batch;
+        while (batch.size() < BATCH_SIZE && !nodes.empty()) {
+            batch.push_back(nodes.front());
+            nodes.erase(nodes.begin());
         }
+
+        auto scope = co_await TaskScope::make();
+        for (auto &endpoint : batch) {
+            visisted.insert(endpoint);
+            scope.spawn([&, this]() -> Task<void> {
+                auto reply = co_await mSession.getPeers(endpoint.ip.toEndpoint(), target, true, endpoint.id);
+                if (!reply) {
+                    if (reply.error() == Error::Canceled) {
+                        canceled = true;
+                        scope.cancel();
+                    }
+                    co_return;
+                }
+                // Merge the filters, the union of the filters is the filter of the union
+                if (seeds.merge(std::as_bytes(std::span(reply->bfsd))) &&
+                    peers.merge(std::as_bytes(std::span(reply->bfpe)))) {
+                    estimate.responses += 1;
+                }
+                for (auto &node : reply->nodes) {
+                    if (!visisted.contains(node)) {
+                        nodes.push_back(node);
+                    }
+                }
+            });
+        }
+        co_await scope;
+
+        std::sort(nodes.begin(), nodes.end(), [&target](const NodeEndpoint &a, const NodeEndpoint &b) {
+            return a.id.distance(target) < b.id.distance(target);
+        });
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
     }
-    // Got one 
-    mCoCurrent += 1;
-    if (mCoCurrent >= mMaxCoCurrent) {
-        mEvent.clear();
+    estimate.seeds = seeds.calculateEstimatedSize();
+    estimate.peers = peers.calculateEstimatedSize();
+    GET_PEERS_LOG("Estimate swarm of {}, seeds {}, peers {}, responses {}", target, estimate.seeds, estimate.peers, estimate.responses);
+    co_return estimate;
+}
+
+auto GetPeersManager::setMaxConcurrent(size_t n) -> void {
+    mMaxCoCurrent = std::max<size_t>(n, 1);
+    spawnWorkers(); // The extra workers will quit by themselves when shrinking
+    mQueueEvent.set();
+}
+
+auto GetPeersManager::setMaxQueueSize(size_t n) -> void {
+    mMaxQueueSize = n;
+}
+
+auto GetPeersManager::queueSize() const -> size_t {
+    return mQueued;
+}
+
+auto GetPeersManager::averageWaitTime() const -> std::chrono::milliseconds {
+    return std::chrono::milliseconds(int64_t(mAverageWait));
+}
+
+auto GetPeersManager::spawnWorkers() -> void {
+    while (mWorkers < mMaxCoCurrent) {
+        mWorkers += 1;
+        mScope.spawn(getPeersWorker());
     }
-    GET_PEERS_LOG("Worker of {} start get peers", hash);
-    co_await getPeers(hash);
-
-    // Cleanup ....
-    mHashes.erase(hash);
-    mCoCurrent -= 1;
-    if (mCoCurrent < mMaxCoCurrent) {
-        mEvent.set();
+}
+
+auto GetPeersManager::getPeersWorker() -> Task<void> {
+    while (mWorkers <= mMaxCoCurrent) {
+        // Take the first item of the highest priority queue
+        auto queue = std::find_if(mQueues.begin(), mQueues.end(), [](auto &q) { return !q.empty(); });
+        if (queue == mQueues.end()) {
+            mQueueEvent.clear();
+            if (auto val = co_await mQueueEvent; !val) { // Wait the new hash or cancel requests
+                co_return;
+            }
+            continue;
+        }
+        auto item = queue->front();
+        queue->pop_front();
+        if (!isLive(item)) {
+            continue; // Dropped, promoted to the higher priority queue or running
+        }
+        mHashes[item.hash].running = true; // Keep it until done, so adding it again won't start another lookup
+        mQueued -= 1;
+
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - item.enqueueTime);
+        mAverageWait = mAverageWait * 0.9 + double(wait.count()) * 0.1;
+        GET_PEERS_LOG("Worker of {} start get peers, waited {}, {} left in queue", item.hash, wait, queueSize());
+        co_await getPeers(item.hash);
+        mHashes.erase(item.hash);
     }
-}
\ No newline at end of file
+    mWorkers -= 1; // Shrinking, quit this worker
+}
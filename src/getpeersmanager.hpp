@@ -11,30 +11,129 @@
 #pragma once
 
 #include "session.hpp"
+#include "hashstore.hpp"
 #include "nodeid.hpp"
 #include "krpc.hpp"
+#include <chrono>
+#include <array>
 #include <deque>
 #include <map>
 
 class GetPeersManager {
 public:
+    /**
+     * @brief The priority of the hash, by where it comes from, smaller is handled first
+     * 
+     */
+    enum Priority : size_t {
+        Announce = 0, // Someone announced it to us, it is alive
+        Sample   = 1, // Got from the sample_infohashes
+    };
+
+    /**
+     * @brief The estimated size of the swarm, by the BEP33 scrape
+     * 
+     */
+    struct SwarmEstimate {
+        double seeds     = 0;
+        double peers     = 0; // The downloaders
+        size_t responses = 0; // The number of the nodes replied the bloom filters
+    };
+
     GetPeersManager(DhtSession &session);
     ~GetPeersManager();
 
-    auto addHash(const InfoHash &hash) -> void;
+    /**
+     * @brief Queue the hash to get peers, if the queue is full, the hash may be dropped
+     * 
+     * @param hash 
+     * @param priority 
+     * @return true On the hash is queued (or already queued / running)
+     * @return false On it is dropped, the queue is full or the hash is finished
+     */
+    auto addHash(const InfoHash &hash, Priority priority = Sample) -> bool;
+
+    /**
+     * @brief Mark the hash as finished, the running lookup of it will stop as soon as possible
+     * 
+     * @param hash 
+     */
+    auto markFinished(const InfoHash &hash) -> void;
+
+    /**
+     * @brief Set the callback when got a peer, it is called as soon as the reply arrived, each peer only once per hash
+     * 
+     * @param fn 
+     */
     auto setOnPeerGot(std::function<void(const InfoHash &hash, const IPEndpoint &peer)> fn) -> void;
+
+    /**
+     * @brief Set the max number of the lookups running at the same time (the size of the worker pool)
+     * 
+     * @param n 
+     */
+    auto setMaxConcurrent(size_t n) -> void;
+
+    /**
+     * @brief Set the max number of the hashes waiting in the queue
+     * 
+     * @param n 
+     */
+    auto setMaxQueueSize(size_t n) -> void;
+
+    /**
+     * @brief Get the number of the hashes waiting in the queue
+     * 
+     * @return size_t 
+     */
+    auto queueSize() const -> size_t;
+
+    /**
+     * @brief Get the average time the hashes waited in the queue before a worker picked it (moving average)
+     * 
+     * @return std::chrono::milliseconds 
+     */
+    auto averageWaitTime() const -> std::chrono::milliseconds;
+
+    /**
+     * @brief Estimate the size of the swarm by scraping the nodes close to the hash, the peer lists are not collected
+     * 
+     * @param hash 
+     * @return Task<SwarmEstimate> 
+     */
+    auto estimateSwarm(const InfoHash &hash) -> Task<SwarmEstimate>;
 private:
+    struct QueueItem {
+        InfoHash hash;
+        uint64_t generation; // The item is stale if the generation of the hash changed
+        std::chrono::steady_clock::time_point enqueueTime;
+    };
+
+    struct HashState {
+        Priority priority;
+        uint64_t generation;      // The generation of the live item in the queue
+        bool     running = false; // A worker is looking up it, so no item of it is live
+    };
+
     auto getPeers(const InfoHash &target) -> Task<void>;
-    auto getPeersWorker(InfoHash hash) -> Task<void>;
+    auto getPeersWorker() -> Task<void>;
+    auto spawnWorkers() -> void;
+    auto enqueue(const InfoHash &hash, HashState &state) -> void;
+    auto isLive(const QueueItem &item) const -> bool;
 
     DhtSession &mSession;
 
-    std::set<InfoHash> mFinished;
-    std::set<InfoHash> mHashes; // The hash we are waiting or doing the get peers
+    InfoHashStore mFinished {16 * 1024 * 1024}; // The hashes we don't need to get peers anymore
+    std::map<InfoHash, HashState> mHashes; // The hash queued or running, until its lookup finished
+    std::array<std::deque<QueueItem>, 2> mQueues; // The queue of each priority, may contain the stale items
+    uint64_t mGeneration = 0;
+    size_t mQueued = 0; // The number of the live items in the queues
     TaskScope mScope;
     size_t mMaxCoCurrent = 5;
-    size_t mCoCurrent = 0; // The current cocurrent tasks
-    Event  mEvent; // The event of the 
+    size_t mMaxQueueSize = 10000;
+    size_t mWorkers = 0; // The number of the workers in the pool
+    Event  mQueueEvent; // The event of the queue is not empty
+    double mAverageWait = 0; // The moving average of the wait time (in ms)
 
     std::function<void(const InfoHash &hash, const IPEndpoint &peer)> mOnPeerGot;
-};
\ No newline at end of file
+};
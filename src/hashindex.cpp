@@ -0,0 +1,265 @@
+#include "hashindex.hpp"
+#include "log.hpp"
+#include <filesystem>
+#include <chrono>
+#include <cstring>
+
+inline constexpr char     INDEX_MAGIC[8]     = {'H', 'A', 'S', 'H', 'I', 'D', 'X', '1'};
+inline constexpr uint32_t INDEX_VERSION      = 1;
+inline constexpr uint32_t INDEX_INIT_BITS    = 16; // 65536 slots, 2MB
+inline constexpr uint32_t INDEX_MAX_BITS     = 40;
+
+static auto unixNow() -> uint32_t {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return uint32_t(std::chrono::duration_cast<std::chrono::seconds>(now).count());
+}
+
+static auto tableBytes(uint32_t slotBits) -> size_t {
+    return (size_t(1) << slotBits) * sizeof(InfoHashIndex::Record);
+}
+
+InfoHashIndex::~InfoHashIndex() {
+    flush();
+}
+
+auto InfoHashIndex::open(const char *path) -> std::optional<InfoHashIndex> {
+    auto file = MappedFile::open(path, sizeof(Header));
+    if (!file) {
+        return std::nullopt;
+    }
+    Header header;
+    ::memcpy(&header, file->data(), sizeof(Header));
+    if (header.magic[0] == 0) { // New file
+        if (!format(*file, INDEX_INIT_BITS)) {
+            return std::nullopt;
+        }
+    }
+    else if (::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header.version != INDEX_VERSION ||
+             header.slotBits > INDEX_MAX_BITS || file->size() < sizeof(Header) + tableBytes(header.slotBits)) {
+        DO_LOG("[HashIndex]", "Invalid index file {}", path);
+        return std::nullopt;
+    }
+    InfoHashIndex index;
+    index.mFile = std::move(*file);
+    return index;
+}
+
+auto InfoHashIndex::touch(const InfoHash &hash, Source source) -> const Record * {
+    auto record = upsert(hash);
+    if (!record) {
+        return nullptr;
+    }
+    auto now = unixNow();
+    if (record->firstSeen == 0) {
+        record->firstSeen = now;
+        record->source    = source;
+    }
+    record->lastSeen = now;
+    if (record->seenCount != UINT16_MAX) {
+        record->seenCount += 1;
+    }
+    return record;
+}
+
+auto InfoHashIndex::setState(const InfoHash &hash, State state) -> void {
+    if (auto record = upsert(hash); record) {
+        if (record->firstSeen == 0) {
+            record->firstSeen = record->lastSeen = unixNow();
+        }
+        if (state == Fetching) { // The time of the attempt, so it isn't retried too soon
+            record->lastSeen = unixNow();
+        }
+        record->state = state;
+    }
+}
+
+auto InfoHashIndex::find(const InfoHash &hash) const -> std::optional<Record> {
+    if (!mFile || hash == InfoHash {}) {
+        return std::nullopt;
+    }
+    auto slot = findSlot(hash);
+    if (!slot || slot->hash != hash) {
+        return std::nullopt;
+    }
+    return *slot;
+}
+
+auto InfoHashIndex::scan(const InfoHash &prefix, size_t bits, const std::function<bool (const Record &)> &fn) const
+    -> void {
+    if (!mFile) {
+        return;
+    }
+    auto slotBits = header()->slotBits;
+    auto mask     = (size_t(1) << slotBits) - 1;
+    auto table    = slots();
+    bits          = std::min<size_t>(bits, 160);
+
+    // Check the record has the prefix
+    auto raw      = reinterpret_cast<const uint8_t *>(prefix.toStringView().data());
+    auto match    = [&](const InfoHash &hash) {
+        auto data = reinterpret_cast<const uint8_t *>(hash.toStringView().data());
+        auto full = bits / 8;
+        if (::memcmp(data, raw, full) != 0) {
+            return false;
+        }
+        if (auto rest = bits % 8; rest != 0) {
+            uint8_t m = uint8_t(0xFF << (8 - rest));
+            return (data[full] & m) == (raw[full] & m);
+        }
+        return true;
+    };
+
+    // All the records with the prefix have home slots in [begin, begin + span), and they can only be moved forward
+    auto begin = homeOf(prefix, slotBits);
+    auto span  = size_t(1);
+    if (bits < slotBits) {
+        begin = (begin >> (slotBits - bits)) << (slotBits - bits);
+        span  = size_t(1) << (slotBits - bits);
+    }
+    for (size_t n = 0; n <= mask; ++n) {
+        auto &record = table[(begin + n) & mask];
+        if (record.hash == InfoHash {}) {
+            if (n >= span) { // Out of the range and the cluster ended
+                break;
+            }
+            continue;
+        }
+        if (match(record.hash) && !fn(record)) {
+            break;
+        }
+    }
+}
+
+auto InfoHashIndex::scanFrom(size_t begin, const std::function<bool (const Record &)> &fn) const -> size_t {
+    if (!mFile) {
+        return 0;
+    }
+    auto table = slots();
+    for (auto n = begin; n < capacity(); ++n) {
+        if (table[n].hash != InfoHash {} && !fn(table[n])) {
+            return n;
+        }
+    }
+    return capacity();
+}
+
+auto InfoHashIndex::flush() -> void {
+    mFile.flush();
+}
+
+auto InfoHashIndex::size() const -> size_t {
+    return mFile ? header()->count : 0;
+}
+
+auto InfoHashIndex::capacity() const -> size_t {
+    return mFile ? (size_t(1) << header()->slotBits) : 0;
+}
+
+auto InfoHashIndex::homeOf(const InfoHash &hash, uint32_t slotBits) -> size_t {
+    // Use the top bits as home, keep the order of the keys
+    auto     data  = reinterpret_cast<const uint8_t *>(hash.toStringView().data());
+    uint64_t value = 0;
+    for (size_t i = 0; i < 8; ++i) {
+        value = (value << 8) | data[i];
+    }
+    return size_t(value >> (64 - slotBits));
+}
+
+auto InfoHashIndex::format(MappedFile &file, uint32_t slotBits) -> bool {
+    if (!file.resize(sizeof(Header) + tableBytes(slotBits))) {
+        return false;
+    }
+    Header header {};
+    ::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version  = INDEX_VERSION;
+    header.slotBits = slotBits;
+    ::memset(file.data(), 0, file.size());
+    ::memcpy(file.data(), &header, sizeof(Header));
+    return true;
+}
+
+auto InfoHashIndex::header() const -> Header * {
+    return reinterpret_cast<Header *>(mFile.data());
+}
+
+auto InfoHashIndex::slots() const -> Record * {
+    return reinterpret_cast<Record *>(mFile.data() + sizeof(Header));
+}
+
+auto InfoHashIndex::findSlot(const InfoHash &hash) const -> Record * {
+    auto slotBits = header()->slotBits;
+    auto mask     = (size_t(1) << slotBits) - 1;
+    auto table    = slots();
+    auto idx      = homeOf(hash, slotBits);
+    for (size_t n = 0; n <= mask; ++n, idx = (idx + 1) & mask) {
+        if (table[idx].hash == InfoHash {} || table[idx].hash == hash) {
+            return &table[idx];
+        }
+    }
+    return nullptr; // Full, only on a broken file (the load factor is kept under 0.75)
+}
+
+auto InfoHashIndex::upsert(const InfoHash &hash) -> Record * {
+    if (!mFile || hash == InfoHash {}) {
+        return nullptr;
+    }
+    auto slot = findSlot(hash);
+    if (slot && slot->hash == hash) {
+        return slot;
+    }
+    if (!slot || (header()->count + 1) * 4 > capacity() * 3) { // Load factor over 0.75
+        if (!grow()) {
+            return nullptr;
+        }
+        slot = findSlot(hash);
+    }
+    if (!slot) {
+        return nullptr;
+    }
+    *slot      = Record {};
+    slot->hash = hash;
+    header()->count += 1;
+    return slot;
+}
+
+auto InfoHashIndex::grow() -> bool {
+    auto path     = mFile.path();
+    auto tmpPath  = path + ".tmp";
+    auto slotBits = header()->slotBits + 1;
+    if (slotBits > INDEX_MAX_BITS) {
+        return false;
+    }
+    {
+        auto tmp = MappedFile::open(tmpPath.c_str(), sizeof(Header));
+        if (!tmp || !format(*tmp, slotBits)) {
+            return false;
+        }
+        InfoHashIndex index;
+        index.mFile = std::move(*tmp);
+        auto table  = slots();
+        for (size_t i = 0; i < capacity(); ++i) {
+            if (table[i].hash != InfoHash {}) {
+                *index.findSlot(table[i].hash) = table[i]; // Never full, the new table is at most half loaded
+                index.header()->count += 1;
+            }
+        }
+    } // Flushed and closed here
+    mFile.close();
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    auto replaced = !ec;
+    if (!replaced) {
+        DO_LOG("[HashIndex]", "Failed to replace {} => {}", path, ec.message());
+        std::filesystem::remove(tmpPath, ec);
+    }
+    auto file = MappedFile::open(path.c_str()); // Reopen the new one, or the old one if the replace failed
+    if (!file) {
+        return false;
+    }
+    mFile = std::move(*file);
+    if (!replaced) {
+        return false;
+    }
+    DO_LOG("[HashIndex]", "Grow the index to {} slots, {} records", capacity(), size());
+    return true;
+}
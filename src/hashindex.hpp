@@ -0,0 +1,139 @@
+/**
+ * @file hashindex.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The persistent index of the info hashes we learned
+ * @version 0.1
+ * @date 2025-06-03
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "nodeid.hpp"
+#include "mmap.hpp"
+#include <functional>
+#include <optional>
+#include <cstdint>
+
+/**
+ * @brief The on-disk, memory mapped index from info hash to the record of it
+ *
+ * The file is a header and a linear probing table, the home slot of a hash is its top bits, so the records are
+ * roughly sorted by the key, and all the keys with a prefix are in a contiguous range of slots. Opening is O(1),
+ * the table is doubled (rewrite the file) when the load factor reaches 0.75
+ *
+ */
+class InfoHashIndex {
+public:
+    enum Source : uint8_t {
+        Unknown  = 0,
+        Sample   = 1, // From the sample_infohashes
+        Announce = 2, // From the announce_peer
+        Manual   = 3, // Added by user
+    };
+
+    enum State : uint8_t {
+        Pending  = 0, // Not fetched yet
+        Fetching = 1, // Looking up the peers of it, or fetching the metadata
+        Fetched  = 2, // The metadata was fetched
+    };
+
+    struct Record {
+        InfoHash hash;
+        uint32_t firstSeen = 0; // Unix time in seconds
+        uint32_t lastSeen  = 0; // The last time seen, or queued to fetch (Fetching)
+        Source   source    = Unknown;
+        State    state     = Pending;
+        uint16_t seenCount = 0;
+    };
+    static_assert(sizeof(Record) == 32);
+
+    InfoHashIndex() = default;
+    InfoHashIndex(const InfoHashIndex &) = delete;
+    InfoHashIndex(InfoHashIndex &&) = default;
+    ~InfoHashIndex();
+
+    /**
+     * @brief Open or create the index file
+     *
+     * @param path
+     * @return std::optional<InfoHashIndex> nullopt on failed or the file is broken
+     */
+    static auto open(const char *path) -> std::optional<InfoHashIndex>;
+
+    /**
+     * @brief Record that we seen the hash now, insert it if not exists
+     *
+     * @param hash
+     * @param source
+     * @return const Record* The record (valid until the next insert), nullptr on failed
+     */
+    auto touch(const InfoHash &hash, Source source) -> const Record *;
+
+    /**
+     * @brief Set the fetch state of the hash, insert it if not exists, the lastSeen is stamped on Fetching
+     *
+     * @param hash
+     * @param state
+     */
+    auto setState(const InfoHash &hash, State state) -> void;
+
+    /**
+     * @brief Find the record of the hash
+     *
+     * @param hash
+     * @return std::optional<Record>
+     */
+    auto find(const InfoHash &hash) const -> std::optional<Record>;
+
+    /**
+     * @brief Visit all the records whose hash starts with the prefix bits
+     *
+     * @param prefix The prefix (only the first bits are used)
+     * @param bits The number of the prefix bits, 0 on all
+     * @param fn The callback, return false to stop
+     */
+    auto scan(const InfoHash &prefix, size_t bits, const std::function<bool (const Record &)> &fn) const -> void;
+
+    /**
+     * @brief Visit the records in the slot order from the slot begin, to page through the whole index
+     *
+     * @param begin The slot to start from, the one returned by the last call
+     * @param fn The callback, return false to stop before the record, it is visited again by the next call
+     * @return size_t The slot to continue from, capacity() on the end of the table
+     */
+    auto scanFrom(size_t begin, const std::function<bool (const Record &)> &fn) const -> size_t;
+
+    /**
+     * @brief Flush the index to the disk
+     *
+     */
+    auto flush() -> void;
+
+    auto size() const -> size_t;
+    auto capacity() const -> size_t;
+
+    auto operator =(const InfoHashIndex &) -> InfoHashIndex & = delete;
+    auto operator =(InfoHashIndex &&) -> InfoHashIndex & = default;
+private:
+    struct Header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t slotBits; // The table has 2^slotBits slots
+        uint64_t count;
+        uint8_t  reserved[8];
+    };
+    static_assert(sizeof(Header) == 32);
+
+    static auto homeOf(const InfoHash &hash, uint32_t slotBits) -> size_t;
+    static auto format(MappedFile &file, uint32_t slotBits) -> bool;
+
+    auto header() const -> Header *;
+    auto slots() const -> Record *;
+    auto findSlot(const InfoHash &hash) const -> Record *; // The slot with the hash or the empty one, nullptr on full
+    auto upsert(const InfoHash &hash) -> Record *;
+    auto grow() -> bool;
+
+    MappedFile mFile;
+};
@@ -0,0 +1,175 @@
+#include "hashstore.hpp"
+#include <algorithm>
+#include <cstring>
+
+inline constexpr size_t MIN_SLOTS = 1024;
+inline constexpr size_t NPOS      = size_t(-1);
+
+InfoHashStore::InfoHashStore(size_t maxMemory, std::chrono::seconds ttl) : mMaxMemory(maxMemory), mTtl(ttl) {
+
+}
+
+InfoHashStore::~InfoHashStore() {
+
+}
+
+auto InfoHashStore::insert(const InfoHash &hash) -> bool {
+    if (hash == InfoHash {}) {
+        return false;
+    }
+    expireIfNeeded();
+    if (find(mCurrent, hash) != NPOS) {
+        return false;
+    }
+    bool exists = false;
+    if (auto idx = find(mPrevious, hash); idx != NPOS) { // Move it to the current generation, so it lives longer
+        remove(mPrevious, idx);
+        exists = true;
+    }
+    reserveOne();
+    emplace(mCurrent, hash);
+    return !exists;
+}
+
+auto InfoHashStore::contains(const InfoHash &hash) const -> bool {
+    if (mTtl.count() != 0) {
+        auto elapsed = Clock::now() - mCurrent.createTime;
+        if (elapsed >= mTtl * 2) { // Both generations are expired
+            return false;
+        }
+        if (elapsed >= mTtl) { // Only the current generation is alive, the previous one will be dropped
+            return find(mCurrent, hash) != NPOS;
+        }
+    }
+    return find(mCurrent, hash) != NPOS || find(mPrevious, hash) != NPOS;
+}
+
+auto InfoHashStore::erase(const InfoHash &hash) -> void {
+    if (auto idx = find(mCurrent, hash); idx != NPOS) {
+        remove(mCurrent, idx);
+    }
+    if (auto idx = find(mPrevious, hash); idx != NPOS) {
+        remove(mPrevious, idx);
+    }
+}
+
+auto InfoHashStore::clear() -> void {
+    mCurrent  = Table {};
+    mPrevious = Table {};
+}
+
+auto InfoHashStore::size() const -> size_t {
+    return mCurrent.size + mPrevious.size;
+}
+
+auto InfoHashStore::memoryUsage() const -> size_t {
+    return (mCurrent.slots.capacity() + mPrevious.slots.capacity()) * sizeof(InfoHash);
+}
+
+auto InfoHashStore::setMemoryLimit(size_t maxMemory) -> void {
+    mMaxMemory = maxMemory;
+}
+
+auto InfoHashStore::setTtl(std::chrono::seconds ttl) -> void {
+    mTtl = ttl;
+}
+
+auto InfoHashStore::homeOf(const InfoHash &hash, size_t mask) -> size_t {
+    // The hash is already uniform distributed (sha1), so just use the first 8 bytes
+    uint64_t value;
+    ::memcpy(&value, hash.toStringView().data(), sizeof(value));
+    return size_t(value) & mask;
+}
+
+auto InfoHashStore::find(const Table &table, const InfoHash &hash) -> size_t {
+    if (table.size == 0) {
+        return NPOS;
+    }
+    auto mask = table.slots.size() - 1;
+    for (auto idx = homeOf(hash, mask); table.slots[idx] != InfoHash {}; idx = (idx + 1) & mask) {
+        if (table.slots[idx] == hash) {
+            return idx;
+        }
+    }
+    return NPOS;
+}
+
+auto InfoHashStore::emplace(Table &table, const InfoHash &hash) -> void {
+    auto mask = table.slots.size() - 1;
+    auto idx  = homeOf(hash, mask);
+    while (table.slots[idx] != InfoHash {}) {
+        idx = (idx + 1) & mask;
+    }
+    table.slots[idx] = hash;
+    table.size += 1;
+}
+
+auto InfoHashStore::remove(Table &table, size_t idx) -> void {
+    // Backward shift deletion, keep the probe sequence valid without tombstones
+    auto mask = table.slots.size() - 1;
+    auto next = idx;
+    while (true) {
+        next = (next + 1) & mask;
+        if (table.slots[next] == InfoHash {}) {
+            break;
+        }
+        auto home = homeOf(table.slots[next], mask);
+        // Can the item at next be moved to idx ? (idx is in the cyclic range [home, next))
+        bool movable = (idx <= next) ? (home <= idx || home > next) : (home <= idx && home > next);
+        if (movable) {
+            table.slots[idx] = table.slots[next];
+            idx              = next;
+        }
+    }
+    table.slots[idx] = InfoHash {};
+    table.size -= 1;
+}
+
+auto InfoHashStore::maxSlots() const -> size_t {
+    // Each generation can use half of the memory
+    auto slots = std::bit_floor(std::max<size_t>(mMaxMemory / 2 / sizeof(InfoHash), 1));
+    return std::max(slots, MIN_SLOTS);
+}
+
+auto InfoHashStore::expireIfNeeded() -> void {
+    if (mTtl.count() == 0) {
+        return;
+    }
+    auto elapsed = Clock::now() - mCurrent.createTime;
+    if (elapsed >= mTtl * 2) {
+        clear();
+    }
+    else if (elapsed >= mTtl) {
+        rotate();
+    }
+}
+
+auto InfoHashStore::reserveOne() -> void {
+    auto &slots = mCurrent.slots;
+    if ((mCurrent.size + 1) * 4 <= slots.size() * 3) { // Load factor is under 0.75
+        return;
+    }
+    if (slots.size() >= maxSlots()) { // Reach the memory limit, drop the oldest generation
+        rotate();
+        if (!mCurrent.slots.empty()) {
+            return;
+        }
+    }
+    // Grow the current table
+    Table table;
+    table.slots.resize(std::max(slots.size() * 2, MIN_SLOTS));
+    table.createTime = mCurrent.createTime;
+    for (auto &hash : slots) {
+        if (hash != InfoHash {}) {
+            emplace(table, hash);
+        }
+    }
+    mCurrent = std::move(table);
+}
+
+auto InfoHashStore::rotate() -> void {
+    auto slots = std::min(mCurrent.slots.size(), maxSlots()); // Keep the size, so we don't grow it again
+    mPrevious  = std::move(mCurrent);
+    mCurrent   = Table {};
+    mCurrent.slots.resize(slots);
+}
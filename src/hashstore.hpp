@@ -0,0 +1,122 @@
+/**
+ * @file hashstore.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The compact memory of the info hashes we already handled
+ * @version 0.1
+ * @date 2025-06-02
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "nodeid.hpp"
+#include <chrono>
+#include <vector>
+
+/**
+ * @brief The bounded set of the info hashes, the hashes are packed in flat open addressing tables
+ *
+ * It keeps two generations, the new hashes go into the current one, when the current one reach the memory limit
+ * or the ttl, the previous one is dropped and the current one becomes the previous one. So a hash is remembered
+ * at least ttl (if memory is enough) and the memory usage never exceeds the limit
+ *
+ */
+class InfoHashStore {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Construct a new Info Hash Store object
+     *
+     * @param maxMemory The max memory in bytes the store can use
+     * @param ttl The time to remember the hash, zero on forever (until the memory limit reached)
+     */
+    InfoHashStore(size_t maxMemory = 64 * 1024 * 1024, std::chrono::seconds ttl = {});
+    InfoHashStore(const InfoHashStore &) = delete;
+    InfoHashStore(InfoHashStore &&) = default;
+    ~InfoHashStore();
+
+    /**
+     * @brief Insert the hash into the store, refresh it if it is in the previous generation
+     *
+     * @param hash The hash to insert (the zero hash is not allowed)
+     * @return true On the hash is new
+     * @return false On the hash already exists
+     */
+    auto insert(const InfoHash &hash) -> bool;
+
+    /**
+     * @brief Check the hash is in the store
+     *
+     * @param hash
+     * @return true
+     * @return false
+     */
+    auto contains(const InfoHash &hash) const -> bool;
+
+    /**
+     * @brief Remove the hash from the store
+     *
+     * @param hash
+     */
+    auto erase(const InfoHash &hash) -> void;
+
+    /**
+     * @brief Remove all the hashes
+     *
+     */
+    auto clear() -> void;
+
+    /**
+     * @brief Get the number of the hashes in the store
+     *
+     * @return size_t
+     */
+    auto size() const -> size_t;
+
+    /**
+     * @brief Get the memory used by the tables in bytes
+     *
+     * @return size_t
+     */
+    auto memoryUsage() const -> size_t;
+
+    /**
+     * @brief Set the max memory in bytes, it takes effect on the next rotation
+     *
+     * @param maxMemory
+     */
+    auto setMemoryLimit(size_t maxMemory) -> void;
+
+    /**
+     * @brief Set the time to remember the hash, zero on forever
+     *
+     * @param ttl
+     */
+    auto setTtl(std::chrono::seconds ttl) -> void;
+
+    auto operator =(const InfoHashStore &) -> InfoHashStore & = delete;
+    auto operator =(InfoHashStore &&) -> InfoHashStore & = default;
+private:
+    struct Table {
+        std::vector<InfoHash> slots; // The zero hash means empty slot, size is power of 2
+        size_t                size = 0;
+        Clock::time_point     createTime = Clock::now();
+    };
+
+    static auto homeOf(const InfoHash &hash, size_t mask) -> size_t;
+    static auto find(const Table &table, const InfoHash &hash) -> size_t; // Return the slot index, or npos
+    static auto emplace(Table &table, const InfoHash &hash) -> void;
+    static auto remove(Table &table, size_t idx) -> void;
+
+    auto maxSlots() const -> size_t;
+    auto expireIfNeeded() -> void;
+    auto reserveOne() -> void; // Make sure the current table can take one more hash
+    auto rotate() -> void;
+
+    Table                mCurrent;
+    Table                mPrevious;
+    size_t               mMaxMemory;
+    std::chrono::seconds mTtl;
+};
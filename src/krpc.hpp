@@ -76,45 +76,142 @@ inline auto decodeIPEndpoint(std::string_view endpoint) -> IPEndpoint {
     return IPEndpoint(address, ::ntohs(port));
 }
 
-inline auto decodeNodes(std::string_view nodes) -> std::optional<std::vector<NodeEndpoint> > {
-    // Check is V6 or v4
-    if (nodes.size() % 26 == 0) {
-        // IPv4
-        std::vector<NodeEndpoint> ret;
-        for (size_t i = 0; i < nodes.size(); i += 26) {
-            auto data = nodes.substr(i, 26);
-            if (data.size() != 26) {
-                return std::nullopt;
-            }
-            auto id = NodeId::from(data.data(), 20);
-            auto addr = IPAddress::fromRaw(data.data() + 20, 4);
-            if (!addr) return std::nullopt;
-            auto port = *reinterpret_cast<const uint16_t*>(data.data() + 24);
-            port = ::ntohs(port);
-            ret.emplace_back(id, IPEndpoint(addr.value(), port));
-        }
-        return ret;
-    }
-    else if (nodes.size() % 38 == 0) {
-        // IPv6
-        std::vector<NodeEndpoint> ret;
-        for (size_t i = 0; i < nodes.size(); i += 38) {
-            auto data = nodes.substr(i, 38);
-            if (data.size() != 38) {
-                return std::nullopt;
-            }
-            auto id = NodeId::from(data.data(), 20);
-            auto addr = IPAddress::fromRaw(data.data() + 20, 16);
-            if (!addr) return std::nullopt;
-            auto port = *reinterpret_cast<const uint16_t*>(data.data() + 36);
-            port = ::ntohs(port);
-            ret.emplace_back(id, IPEndpoint(addr.value(), port));
+/**
+ * @brief Decode the compact node info, the family is known by the key ("nodes" is v4, "nodes6" is v6)
+ * 
+ * @param nodes 
+ * @param family AF_INET (26 bytes per node) or AF_INET6 (38 bytes per node)
+ * @return std::optional<std::vector<NodeEndpoint> > nullopt on the length mismatch
+ */
+inline auto decodeNodes(std::string_view nodes, int family) -> std::optional<std::vector<NodeEndpoint> > {
+    const size_t addrLen = (family == AF_INET6) ? 16 : 4;
+    const size_t nodeLen = 20 + addrLen + 2;
+    if (nodes.size() % nodeLen != 0) {
+        return std::nullopt;
+    }
+    std::vector<NodeEndpoint> ret;
+    ret.reserve(nodes.size() / nodeLen);
+    for (size_t i = 0; i < nodes.size(); i += nodeLen) {
+        auto data = nodes.substr(i, nodeLen);
+        auto id = NodeId::from(data.data(), 20);
+        auto endpoint = CompactEndpoint::fromBytes(data.substr(20)); // Already the compact form, just copy it
+        if (!endpoint) return std::nullopt;
+        ret.emplace_back(id, *endpoint);
+    }
+    return ret;
+}
+
+/**
+ * @brief Encode the nodes of the family to the compact node info, the nodes of the other family are skipped
+ * 
+ * @param nodes 
+ * @param family 
+ * @return std::string 
+ */
+inline auto encodeNodes(const std::vector<NodeEndpoint> &nodes, int family) -> std::string {
+    std::string ret;
+    for (auto &node : nodes) {
+        if (node.ip.family() != family) {
+            continue;
         }
-        return ret;
+        ret += node.id.toStringView();
+        ret += node.ip.toStringView();
     }
-    else {
-        return std::nullopt;
+    return ret;
+}
+
+/**
+ * @brief Put the nodes to the reply dict, the v4 ones to "nodes", the v6 ones to "nodes6" (BEP32)
+ * 
+ * @param dict The "r" dict of the reply
+ * @param nodes 
+ */
+inline auto fillMessageNodes(BenObject &dict, const std::vector<NodeEndpoint> &nodes) -> void {
+    if (auto nodes4 = encodeNodes(nodes, AF_INET); !nodes4.empty()) {
+        dict["nodes"] = nodes4;
+    }
+    if (auto nodes6 = encodeNodes(nodes, AF_INET6); !nodes6.empty()) {
+        dict["nodes6"] = nodes6;
+    }
+}
+
+/**
+ * @brief Get the nodes of both "nodes" and "nodes6" from the reply dict
+ * 
+ * @param dict The "r" dict of the reply
+ * @param out The nodes are appended to it
+ * @return true On the present keys are valid
+ * @return false On the length of one is invalid
+ */
+inline auto getMessageNodes(const BenObject &dict, std::vector<NodeEndpoint> &out) -> bool {
+    for (auto [key, family] : {std::pair {"nodes", AF_INET}, std::pair {"nodes6", AF_INET6}}) {
+        auto &object = dict[key];
+        if (!object.isString()) {
+            continue;
+        }
+        auto nodes = decodeNodes(object.toString(), family);
+        if (!nodes) {
+            return false;
+        }
+        out.insert(out.end(), nodes->begin(), nodes->end());
+    }
+    return true;
+}
+
+/**
+ * @brief The node families a query wants in the reply (BEP32), none means the family of the requester
+ * 
+ */
+enum Want : uint8_t {
+    WantDefault = 0,
+    WantNodes4  = 1 << 0, // "n4"
+    WantNodes6  = 1 << 1, // "n6"
+};
+
+/**
+ * @brief Put the "want" list to the query args dict, nothing if it is WantDefault
+ * 
+ * @param dict The "a" dict of the query
+ * @param want 
+ */
+inline auto fillMessageWant(BenObject &dict, uint8_t want) -> void {
+    if (want == WantDefault) {
+        return;
+    }
+    auto list = BenObject::makeList();
+    if (want & WantNodes4) {
+        list.append("n4");
+    }
+    if (want & WantNodes6) {
+        list.append("n6");
+    }
+    dict["want"] = list;
+}
+
+/**
+ * @brief Get the "want" of the query args dict, the unknown items are ignored
+ * 
+ * @param dict The "a" dict of the query
+ * @return uint8_t The flags of Want
+ */
+inline auto getMessageWant(const BenObject &dict) -> uint8_t {
+    auto &object = dict["want"];
+    if (!object.isList()) {
+        return WantDefault;
     }
+    uint8_t want = WantDefault;
+    for (auto &item : object.toList()) {
+        if (!item.isString()) {
+            continue;
+        }
+        if (item.toString() == "n4") {
+            want |= WantNodes4;
+        }
+        else if (item.toString() == "n6") {
+            want |= WantNodes6;
+        }
+    }
+    return want;
 }
 
 /**
@@ -161,6 +258,30 @@ inline auto fillMessageTransactionId(BenObject &msg, std::string_view idStr) ->
     msg["t"] = idStr;
 }
 
+/**
+ * @brief Get the BEP42 "ip" of the reply, the endpoint of us seen by the remote
+ * 
+ * @param msg 
+ * @return std::optional<IPEndpoint> 
+ */
+inline auto getMessageExternalEndpoint(const BenObject &msg) -> std::optional<IPEndpoint> {
+    auto &ip = msg["ip"];
+    if (!ip.isString() || (ip.toString().size() != 6 && ip.toString().size() != 18)) {
+        return std::nullopt;
+    }
+    return decodeIPEndpoint(ip.toString());
+}
+
+/**
+ * @brief Put the BEP42 "ip" into the reply, the endpoint of the requester we saw
+ * 
+ * @param msg 
+ * @param endpoint 
+ */
+inline auto fillMessageExternalEndpoint(BenObject &msg, const IPEndpoint &endpoint) -> void {
+    msg["ip"] = encodeIPEndpoint(endpoint);
+}
+
 /**
  * @brief For ping query
  * 
@@ -251,6 +372,7 @@ struct FindNodeQuery {
     std::string transId;
     NodeId   id; //< witch node send this query
     NodeId   targetId; //< Target NodeId
+    uint8_t  want = WantDefault; //< BEP32, the node families wanted in the reply
 
     auto operator <=>(const FindNodeQuery &) const = default;
     auto toMessage() const -> BenObject {
@@ -262,6 +384,7 @@ struct FindNodeQuery {
         msg["a"] = BenObject::makeDict();
         msg["a"]["id"] = id.toStringView();
         msg["a"]["target"] = targetId.toStringView();
+        fillMessageWant(msg["a"], want);
         return msg;
     };
     static auto fromMessage(const BenObject &msg) -> std::optional<FindNodeQuery> {
@@ -282,7 +405,8 @@ struct FindNodeQuery {
             return FindNodeQuery {
                 .transId = getMessageTransactionId(msg),
                 .id = nId,
-                .targetId = nTargetId
+                .targetId = nTargetId,
+                .want = getMessageWant(msg["a"])
             };
         }
         catch (const std::exception &e) {
@@ -305,22 +429,7 @@ struct FindNodeReply {
         msg["y"] = "r";
         msg["r"] = BenObject::makeDict();
         msg["r"]["id"] = id.toStringView();
-
-        std::string nodesStr;
-        bool v6 = false;
-        for (auto &node : nodes) {
-            nodesStr += node.id.toStringView();
-            nodesStr += encodeIPEndpoint(node.ip);
-            v6 = v6 || node.ip.family() == AF_INET6;
-        }
-        if (!nodesStr.empty()) {
-            if (v6) {
-                msg["r"]["nodes6"] = nodesStr;
-            }
-            else {
-                msg["r"]["nodes"] = nodesStr;
-            }
-        }
+        fillMessageNodes(msg["r"], nodes);
         return msg;
     }
     static auto fromMessage(const BenObject &msg) -> std::optional<FindNodeReply> {
@@ -336,19 +445,8 @@ struct FindNodeReply {
             }
             reply.id = NodeId::from(id.data(), id.size());
 
-            if (auto &nodesObject = msg["r"]["nodes"]; nodesObject.isString()) {
-                auto nodes = decodeNodes(nodesObject.toString());
-                if (!nodes) {
-                    return std::nullopt;
-                }
-                reply.nodes = std::move(*nodes);
-            }
-            else if (auto &nodesObject = msg["r"]["nodes6"]; nodesObject.isString()) {
-                auto nodes = decodeNodes(nodesObject.toString());
-                if (!nodes) {
-                    return std::nullopt;
-                }
-                reply.nodes = std::move(*nodes);
+            if (!getMessageNodes(msg["r"], reply.nodes)) {
+                return std::nullopt;
             }
             return reply;
         }
@@ -363,6 +461,9 @@ struct GetPeersQuery {
     std::string transId;
     NodeId   id; //< which node give this query
     InfoHash infoHash; //< target hash
+    bool scrape = false; //< BEP33, ask for the BFsd / BFpe bloom filters of the swarm
+    bool noseed = false; //< BEP33, don't return the seeds in values
+    uint8_t want = WantDefault; //< BEP32, the node families wanted in the reply
 
     auto operator <=>(const GetPeersQuery &) const = default;
 
@@ -375,6 +476,13 @@ struct GetPeersQuery {
         msg["a"] = BenObject::makeDict();
         msg["a"]["id"] = id.toStringView();
         msg["a"]["info_hash"] = infoHash.toStringView();
+        if (scrape) {
+            msg["a"]["scrape"] = 1;
+        }
+        if (noseed) {
+            msg["a"]["noseed"] = 1;
+        }
+        fillMessageWant(msg["a"], want);
         return msg;
     }
     static auto fromMessage(const BenObject &msg) -> std::optional<GetPeersQuery> {
@@ -391,6 +499,13 @@ struct GetPeersQuery {
             }
             query.id = NodeId::from(id.data(), id.size());
             query.infoHash = NodeId::from(infoHash.data(), 20);
+            if (auto &scrape = msg["a"]["scrape"]; scrape.isInt()) {
+                query.scrape = (scrape.toInt() != 0);
+            }
+            if (auto &noseed = msg["a"]["noseed"]; noseed.isInt()) {
+                query.noseed = (noseed.toInt() != 0);
+            }
+            query.want = getMessageWant(msg["a"]);
             return query;
         }
         catch (const std::exception &e) {
@@ -406,6 +521,8 @@ struct GetPeersReply {
     std::string token;
     std::vector<NodeEndpoint> nodes; //< Id: IP: Port
     std::vector<IPEndpoint> values; //< Peers ip:port
+    std::string bfsd; //< BEP33, the bloom filter (256 bytes) of the seeds, empty if not present
+    std::string bfpe; //< BEP33, the bloom filter (256 bytes) of the downloaders, empty if not present
 
     auto operator <=>(const GetPeersReply &) const = default;
     auto toMessage() const -> BenObject {
@@ -415,22 +532,7 @@ struct GetPeersReply {
         msg["r"] = BenObject::makeDict();
         msg["r"]["id"] = id.toStringView();
         msg["r"]["token"] = token;
-
-        std::string nodesStr;
-        bool v6 = false;
-        for (auto &node : nodes) {
-            nodesStr += node.id.toStringView();
-            nodesStr += encodeIPEndpoint(node.ip);
-            v6 = v6 || node.ip.family() == AF_INET6;
-        }
-        if (!nodesStr.empty()) {
-            if (v6) {
-                msg["r"]["nodes6"] = nodesStr;
-            }
-            else {
-                msg["r"]["nodes"] = nodesStr;                
-            }
-        }
+        fillMessageNodes(msg["r"], nodes);
         if (!values.empty()) {
             auto list = BenObject::makeList();
             for (auto &value : values) {
@@ -438,6 +540,12 @@ struct GetPeersReply {
             }
             msg["r"]["values"] = list;
         }
+        if (!bfsd.empty()) {
+            msg["r"]["BFsd"] = bfsd;
+        }
+        if (!bfpe.empty()) {
+            msg["r"]["BFpe"] = bfpe;
+        }
         return msg;
     }
     static auto fromMessage(const BenObject &msg) -> std::optional<GetPeersReply> {
@@ -453,24 +561,21 @@ struct GetPeersReply {
             }
             reply.id = NodeId::from(id.data(), id.size());
             reply.token = msg["r"]["token"].toString();
-            if (auto &nodes = msg["r"]["nodes"]; nodes.isString()) {
-                auto res = decodeNodes(nodes.toString());
-                if (!res) return std::nullopt;
-                reply.nodes = std::move(*res);
-            }
-            else if (auto &nodes = msg["r"]["nodes6"]; nodes.isString()) {
-                auto res = decodeNodes(nodes.toString());
-                if (!res) return std::nullopt;
-                reply.nodes = std::move(*res);
-            }
-            else {
-                // WTF?
+            if (!getMessageNodes(msg["r"], reply.nodes)) {
+                return std::nullopt;
             }
             if (auto &values = msg["r"]["values"]; values.isList()) {
                 for (auto &value : values.toList()) {
                     reply.values.push_back(decodeIPEndpoint(value.toString()));
                 }
             }
+            // The bloom filters of the scrape, ignore the malformed ones
+            if (auto &bfsd = msg["r"]["BFsd"]; bfsd.isString() && bfsd.toString().size() == 256) {
+                reply.bfsd = bfsd.toString();
+            }
+            if (auto &bfpe = msg["r"]["BFpe"]; bfpe.isString() && bfpe.toString().size() == 256) {
+                reply.bfpe = bfpe.toString();
+            }
             return reply;
         }
         catch (const std::exception &e) {
@@ -521,6 +626,7 @@ struct AnnouncePeerQuery {
     std::string token;
     uint16_t port = 0;
     bool impliedPort = true;
+    bool seed = false; //< BEP33, the peer is a seed
 
     auto toMessage() const -> BenObject {
         BenObject msg = BenObject::makeDict();
@@ -533,6 +639,9 @@ struct AnnouncePeerQuery {
         msg["a"]["token"] = token;
         msg["a"]["port"] = port;
         msg["a"]["implied_port"] = int(impliedPort);
+        if (seed) {
+            msg["a"]["seed"] = 1;
+        }
         return msg;
     }
 
@@ -555,6 +664,9 @@ struct AnnouncePeerQuery {
             if (auto &impliedPort = msg["a"]["implied_port"]; impliedPort.isInt()) {
                 query.impliedPort = (impliedPort.toInt() != 0);
             }
+            if (auto &seed = msg["a"]["seed"]; seed.isInt()) {
+                query.seed = (seed.toInt() != 0);
+            }
             return query;
         }
         catch (const std::exception &e) {
@@ -601,6 +713,7 @@ struct SampleInfoHashesQuery {
     std::string transId;
     NodeId id;
     NodeId target; // For forward compatibility (see BEP-0051) if the client node doesn support this, it should treat it as a find_node query, it has same meaning on find_node
+    uint8_t want = WantDefault; // BEP32, the node families wanted in the reply
 
     auto toMessage() const -> BenObject {
         BenObject msg = BenObject::makeDict();
@@ -610,6 +723,7 @@ struct SampleInfoHashesQuery {
         msg["a"] = BenObject::makeDict();
         msg["a"]["id"] = id.toStringView();
         msg["a"]["target"] = target.toStringView();
+        fillMessageWant(msg["a"], want);
         return msg;
     }
 
@@ -627,6 +741,7 @@ struct SampleInfoHashesQuery {
             }
             query.id = NodeId::from(id.data(), id.size());
             query.target = NodeId::from(target.data(), target.size());
+            query.want = getMessageWant(msg["a"]);
             return query;
         }
         catch (const std::exception &e) {
@@ -651,22 +766,7 @@ struct SampleInfoHashesReply {
         msg["r"] = BenObject::makeDict();
         msg["r"]["id"] = id.toStringView();
         msg["r"]["interval"] = interval;
-        
-        std::string nodesStr;
-        bool v6 = false;
-        for (auto &node : nodes) {
-            nodesStr += node.id.toStringView();
-            nodesStr += encodeIPEndpoint(node.ip);
-            v6 = v6 || node.ip.family() == AF_INET6;
-        }
-        if (!nodesStr.empty()) {
-            if (v6) {
-                msg["r"]["nodes6"] = nodesStr;
-            }
-            else {
-                msg["r"]["nodes"] = nodesStr;
-            }
-        }
+        fillMessageNodes(msg["r"], nodes);
 
         std::string samplesStr;
         for (auto &hash : samples) {
@@ -691,14 +791,8 @@ struct SampleInfoHashesReply {
                 return std::nullopt;
             }
             reply.id = NodeId::from(id.data(), id.size());
-            if (auto &nodes = msg["r"]["nodes"]; nodes.isString()) {
-                reply.nodes = decodeNodes(nodes.toString()).value();                
-            }
-            else if (auto &nodes = msg["r"]["nodes6"]; nodes.isString()) {
-                reply.nodes = decodeNodes(nodes.toString()).value();
-            }
-            else {
-                // WTF?
+            if (!getMessageNodes(msg["r"], reply.nodes)) {
+                return std::nullopt;
             }
 
             if (auto &interval = msg["r"]["interval"]; interval.isInt()) { // The peer understand this extension
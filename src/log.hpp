@@ -34,4 +34,7 @@
 
 #ifndef SAMPLE_LOG
 #define SAMPLE_LOG(fmt, ...) DO_LOG("[SampleManager]", fmt, ##__VA_ARGS__)
-#endif
\ No newline at end of file
+#endif
+#ifndef URING_LOG
+#define URING_LOG(fmt, ...) DO_LOG("[Uring]", fmt, ##__VA_ARGS__)
+#endif
@@ -0,0 +1,166 @@
+#include "mmap.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <utility>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+MappedFile::MappedFile(MappedFile &&other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+auto MappedFile::operator =(MappedFile &&other) noexcept -> MappedFile & {
+    if (this == &other) {
+        return *this;
+    }
+    close();
+    mPath = std::move(other.mPath);
+    mData = std::exchange(other.mData, nullptr);
+    mSize = std::exchange(other.mSize, 0);
+#if defined(_WIN32)
+    mFile    = std::exchange(other.mFile, nullptr);
+    mMapping = std::exchange(other.mMapping, nullptr);
+#else
+    mFd = std::exchange(other.mFd, -1);
+#endif
+    return *this;
+}
+
+auto MappedFile::open(const char *path, size_t minSize) -> std::optional<MappedFile> {
+    MappedFile file;
+    file.mPath = path;
+    size_t size = 0;
+#if defined(_WIN32)
+    auto handle = ::CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        DO_LOG("[MMAP]", "Failed to open {}, error {}", path, ::GetLastError());
+        return std::nullopt;
+    }
+    file.mFile = handle;
+    LARGE_INTEGER fileSize;
+    if (!::GetFileSizeEx(handle, &fileSize)) {
+        return std::nullopt;
+    }
+    size = size_t(fileSize.QuadPart);
+#else
+    auto fd = ::open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        DO_LOG("[MMAP]", "Failed to open {}, error {}", path, ::strerror(errno));
+        return std::nullopt;
+    }
+    file.mFd = fd;
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        return std::nullopt;
+    }
+    size = size_t(st.st_size);
+#endif
+    if (!file.map(std::max(size, minSize))) {
+        return std::nullopt;
+    }
+    return file;
+}
+
+auto MappedFile::resize(size_t size) -> bool {
+    if (!isOpen() && mPath.empty()) {
+        return false;
+    }
+    unmap();
+    return map(size);
+}
+
+auto MappedFile::flush() -> void {
+    if (!mData) {
+        return;
+    }
+#if defined(_WIN32)
+    ::FlushViewOfFile(mData, mSize);
+    ::FlushFileBuffers(mFile);
+#else
+    ::msync(mData, mSize, MS_SYNC);
+#endif
+}
+
+auto MappedFile::close() -> void {
+    unmap();
+#if defined(_WIN32)
+    if (mFile) {
+        ::CloseHandle(mFile);
+        mFile = nullptr;
+    }
+#else
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+#endif
+}
+
+auto MappedFile::map(size_t size) -> bool {
+    if (size == 0) { // Can not map the empty file
+        return false;
+    }
+#if defined(_WIN32)
+    LARGE_INTEGER fileSize;
+    fileSize.QuadPart = LONGLONG(size);
+    if (!::SetFilePointerEx(mFile, fileSize, nullptr, FILE_BEGIN) || !::SetEndOfFile(mFile)) {
+        DO_LOG("[MMAP]", "Failed to resize {} to {}, error {}", mPath, size, ::GetLastError());
+        return false;
+    }
+    mMapping = ::CreateFileMappingA(mFile, nullptr, PAGE_READWRITE, 0, 0, nullptr);
+    if (!mMapping) {
+        DO_LOG("[MMAP]", "Failed to map {}, error {}", mPath, ::GetLastError());
+        return false;
+    }
+    auto ptr = ::MapViewOfFile(mMapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (!ptr) {
+        DO_LOG("[MMAP]", "Failed to map {}, error {}", mPath, ::GetLastError());
+        ::CloseHandle(mMapping);
+        mMapping = nullptr;
+        return false;
+    }
+#else
+    if (::ftruncate(mFd, off_t(size)) != 0) {
+        DO_LOG("[MMAP]", "Failed to resize {} to {}, error {}", mPath, size, ::strerror(errno));
+        return false;
+    }
+    auto ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+    if (ptr == MAP_FAILED) {
+        DO_LOG("[MMAP]", "Failed to map {}, error {}", mPath, ::strerror(errno));
+        return false;
+    }
+#endif
+    mData = static_cast<std::byte *>(ptr);
+    mSize = size;
+    return true;
+}
+
+auto MappedFile::unmap() -> void {
+    if (!mData) {
+        return;
+    }
+#if defined(_WIN32)
+    ::UnmapViewOfFile(mData);
+    ::CloseHandle(mMapping);
+    mMapping = nullptr;
+#else
+    ::munmap(mData, mSize);
+#endif
+    mData = nullptr;
+    mSize = 0;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file mmap.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The memory mapped file, used by the persistent data structures
+ * @version 0.1
+ * @date 2025-06-02
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include <optional>
+#include <cstddef>
+#include <string>
+#include <span>
+
+/**
+ * @brief The read-write shared memory mapping of a whole file
+ *
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    ~MappedFile();
+
+    /**
+     * @brief Open or create the file and map it, the new space of the file is zero filled
+     *
+     * @param path The path of the file
+     * @param minSize Grow the file to this size if it is smaller
+     * @return std::optional<MappedFile> nullopt on failed
+     */
+    static auto open(const char *path, size_t minSize = 0) -> std::optional<MappedFile>;
+
+    /**
+     * @brief Change the size of the file and remap it, the data pointer will be changed
+     *
+     * @param size
+     * @return true
+     * @return false
+     */
+    auto resize(size_t size) -> bool;
+
+    /**
+     * @brief Flush the dirty pages to the disk
+     *
+     */
+    auto flush() -> void;
+
+    /**
+     * @brief Unmap and close the file
+     *
+     */
+    auto close() -> void;
+
+    auto data() const -> std::byte * { return mData; }
+    auto size() const -> size_t { return mSize; }
+    auto span() const -> std::span<std::byte> { return {mData, mSize}; }
+    auto path() const -> const std::string & { return mPath; }
+    auto isOpen() const -> bool { return mData != nullptr; }
+
+    auto operator =(const MappedFile &) -> MappedFile & = delete;
+    auto operator =(MappedFile &&other) noexcept -> MappedFile &;
+    explicit operator bool() const { return isOpen(); }
+private:
+    auto map(size_t size) -> bool;
+    auto unmap() -> void;
+
+    std::string mPath;
+    std::byte  *mData = nullptr;
+    size_t      mSize = 0;
+#if defined(_WIN32)
+    void       *mFile    = nullptr; // HANDLE
+    void       *mMapping = nullptr; // HANDLE
+#else
+    int         mFd = -1;
+#endif
+};
@@ -9,6 +9,7 @@
 #include <bit>
 #include "sha1.h"
 #include "net.hpp"
+#include "endpoint.hpp"
 
 // NOTE: in (self ^ node).clz() is bigger, the node is more closer to the self
 
@@ -142,7 +143,7 @@ private:
 
 struct NodeEndpoint {
     NodeId id;
-    IPEndpoint ip;
+    CompactEndpoint ip;
 
     auto operator <=>(const NodeEndpoint &) const noexcept = default;
 };
@@ -0,0 +1,70 @@
+#include "nodeset.hpp"
+#include <algorithm>
+#include <cstring>
+
+inline constexpr size_t NODE_SET_MIN_SLOTS = 64; // Enough for a typical lookup without rehash
+
+auto NodeSet::insert(const NodeEndpoint &node) -> std::pair<uint32_t, bool> {
+    if ((mNodes.size() + 1) * 2 > mSlots.size()) { // Keep the load factor under 0.5
+        rehash(std::max(mSlots.size() * 2, NODE_SET_MIN_SLOTS));
+    }
+    auto idx = find(node, hashOf(node));
+    if (mSlots[idx] != 0) {
+        return {mSlots[idx] - 1, false};
+    }
+    mNodes.push_back(node);
+    mSlots[idx] = uint32_t(mNodes.size());
+    return {uint32_t(mNodes.size() - 1), true};
+}
+
+auto NodeSet::contains(const NodeEndpoint &node) const -> bool {
+    if (mSlots.empty()) {
+        return false;
+    }
+    return mSlots[find(node, hashOf(node))] != 0;
+}
+
+auto NodeSet::nodes() const -> std::span<const NodeEndpoint> {
+    return mNodes;
+}
+
+auto NodeSet::size() const -> size_t {
+    return mNodes.size();
+}
+
+auto NodeSet::clear() -> void {
+    mNodes.clear();
+    std::fill(mSlots.begin(), mSlots.end(), 0);
+}
+
+auto NodeSet::operator [](uint32_t idx) const -> const NodeEndpoint & {
+    return mNodes[idx];
+}
+
+auto NodeSet::hashOf(const NodeEndpoint &node) -> size_t {
+    // The id is already uniform distributed (sha1 or random), but the start node of a lookup has the zero id
+    uint64_t value;
+    ::memcpy(&value, node.id.toStringView().data(), sizeof(value));
+    return size_t(value ^ (node.ip.hash() * 0x9E3779B97F4A7C15ULL));
+}
+
+auto NodeSet::find(const NodeEndpoint &node, size_t hash) const -> size_t {
+    auto mask = mSlots.size() - 1;
+    auto idx  = hash & mask;
+    while (mSlots[idx] != 0 && mNodes[mSlots[idx] - 1] != node) {
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+auto NodeSet::rehash(size_t slots) -> void {
+    mSlots.assign(slots, 0);
+    auto mask = slots - 1;
+    for (size_t i = 0; i < mNodes.size(); ++i) {
+        auto idx = hashOf(mNodes[i]) & mask;
+        while (mSlots[idx] != 0) {
+            idx = (idx + 1) & mask;
+        }
+        mSlots[idx] = uint32_t(i + 1);
+    }
+}
@@ -0,0 +1,72 @@
+/**
+ * @file nodeset.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The flat set of the nodes visited in a lookup
+ * @version 0.1
+ * @date 2025-06-06
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "nodeid.hpp"
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <span>
+
+/**
+ * @brief The set of the (NodeId, CompactEndpoint), the nodes are kept in a contiguous array in the insertion order
+ *
+ * The open addressing table only stores the index + 1 of the node in the array (0 means empty slot), so the lookup
+ * allocates only when the array or the table grows, and the index of a node never changes, it can be held by the
+ * candidate queue instead of a pointer. There is no erase, a set lives as long as a lookup
+ *
+ */
+class NodeSet {
+public:
+    NodeSet() = default;
+    NodeSet(const NodeSet &) = delete;
+    NodeSet(NodeSet &&) = default;
+    ~NodeSet() = default;
+
+    /**
+     * @brief Insert the node
+     *
+     * @param node
+     * @return std::pair<uint32_t, bool> The index of the node, and true on it is newly inserted
+     */
+    auto insert(const NodeEndpoint &node) -> std::pair<uint32_t, bool>;
+
+    /**
+     * @brief Check the node is in the set
+     *
+     * @param node
+     * @return true
+     * @return false
+     */
+    auto contains(const NodeEndpoint &node) const -> bool;
+
+    /**
+     * @brief Get all the nodes, in the insertion order
+     *
+     * @return std::span<const NodeEndpoint>
+     */
+    auto nodes() const -> std::span<const NodeEndpoint>;
+
+    auto size() const -> size_t;
+    auto clear() -> void;
+
+    auto operator [](uint32_t idx) const -> const NodeEndpoint &;
+    auto operator =(const NodeSet &) -> NodeSet & = delete;
+    auto operator =(NodeSet &&) -> NodeSet & = default;
+private:
+    static auto hashOf(const NodeEndpoint &node) -> size_t;
+
+    auto find(const NodeEndpoint &node, size_t hash) const -> size_t; // Return the slot index of it or the empty one
+    auto rehash(size_t slots) -> void;
+
+    std::vector<NodeEndpoint> mNodes; // The candidates
+    std::vector<uint32_t>     mSlots; // The index + 1 in mNodes, 0 on empty, size is power of 2
+};
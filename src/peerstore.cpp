@@ -0,0 +1,195 @@
+#include "peerstore.hpp"
+#include <algorithm>
+
+inline constexpr uint32_t PEER_STORE_SLOTS = 32; // The ttl is split into slots, the granularity of the expiry
+
+PeerStore::PeerStore(std::chrono::seconds ttl, size_t maxPeersPerHash, size_t maxPeers) :
+    mTtl(uint32_t(std::max<int64_t>(ttl.count(), 1))), mMaxPeersPerHash(std::max<size_t>(maxPeersPerHash, 1)),
+    mMaxPeers(maxPeers) {
+    mSlotSize = std::max<uint32_t>(mTtl / PEER_STORE_SLOTS, 1);
+}
+
+PeerStore::~PeerStore() {
+
+}
+
+auto PeerStore::announce(const InfoHash &hash, const IPEndpoint &endpoint, bool seed) -> bool {
+    Peer peer;
+    peer.endpoint = endpoint;
+    if (!peer.endpoint.isValid()) {
+        return false;
+    }
+    auto current  = now();
+    peer.seed     = seed;
+    peer.expire   = current + mTtl;
+
+    auto it = mSwarms.find(hash);
+    if (it == mSwarms.end()) {
+        if (mSize >= mMaxPeers) {
+            return false;
+        }
+        it = mSwarms.emplace(hash, Swarm {}).first;
+    }
+    auto &swarm = it->second;
+    auto  pos   = std::find_if(swarm.peers.begin(), swarm.peers.end(), [&](const Peer &p) {
+        return p.endpoint == peer.endpoint;
+    });
+    if (pos != swarm.peers.end()) { // Refresh it
+        if (pos->seed != peer.seed) { // Became a seed, the bit in the old filter can't be removed
+            swarm.filters.reset();
+        }
+        pos->expire = peer.expire;
+        pos->seed   = peer.seed;
+    }
+    else if (swarm.peers.size() >= mMaxPeersPerHash) { // Replace the oldest one
+        peer.hash   = hashOf(peer);
+        auto oldest = std::min_element(swarm.peers.begin(), swarm.peers.end(), [](const Peer &a, const Peer &b) {
+            return a.expire < b.expire;
+        });
+        *oldest = peer;
+        swarm.filters.reset();
+    }
+    else if (mSize < mMaxPeers) {
+        peer.hash = hashOf(peer);
+        swarm.peers.push_back(peer);
+        mSize += 1;
+        if (swarm.filters) {
+            addToFilters(*swarm.filters, peer);
+        }
+    }
+    else {
+        if (swarm.peers.empty()) {
+            mSwarms.erase(it);
+        }
+        return false;
+    }
+
+    // Record the hash in the bucket of now, so expire() will check it after the ttl
+    auto slot = current / mSlotSize;
+    if (swarm.lastSlot != slot) {
+        if (mBuckets.empty() || mBuckets.back().slot != slot) {
+            mBuckets.push_back(Bucket {.slot = slot, .hashes = {}});
+        }
+        mBuckets.back().hashes.push_back(hash);
+        swarm.lastSlot = slot;
+    }
+    return true;
+}
+
+auto PeerStore::pick(const InfoHash &hash, size_t max, std::mt19937 &random, std::vector<IPEndpoint> &out,
+                     bool noseed) -> size_t {
+    auto it = mSwarms.find(hash);
+    if (it == mSwarms.end()) {
+        return 0;
+    }
+    auto  &peers   = it->second.peers;
+    auto   current = now();
+    size_t count   = 0;
+    // Partial Fisher-Yates, the order of the peers does not matter, so shuffle in place until got enough
+    for (size_t i = 0; i < peers.size() && count < max; ++i) {
+        auto j = std::uniform_int_distribution<size_t>(i, peers.size() - 1)(random);
+        std::swap(peers[i], peers[j]);
+        if (peers[i].expire <= current || (noseed && peers[i].seed)) { // The expired one is not dropped yet
+            continue;
+        }
+        out.push_back(peers[i].endpoint.toEndpoint());
+        count += 1;
+    }
+    return count;
+}
+
+auto PeerStore::scrape(const InfoHash &hash, ScrapeFilter &seeds, ScrapeFilter &peers) -> bool {
+    auto it = mSwarms.find(hash);
+    if (it == mSwarms.end()) {
+        return false;
+    }
+    auto &swarm = it->second;
+    if (!swarm.filters) {
+        swarm.filters = std::make_unique<Filters>();
+        for (auto &peer : swarm.peers) {
+            addToFilters(*swarm.filters, peer);
+        }
+    }
+    seeds = swarm.filters->seeds;
+    peers = swarm.filters->peers;
+    return true;
+}
+
+auto PeerStore::count(const InfoHash &hash) const -> size_t {
+    auto it = mSwarms.find(hash);
+    return it == mSwarms.end() ? 0 : it->second.peers.size();
+}
+
+auto PeerStore::expire() -> size_t {
+    auto   current = now();
+    size_t dropped = 0;
+    // All the peers in the bucket were announced before (slot + 1) * slotSize, so they expire before that + ttl
+    while (!mBuckets.empty() && (mBuckets.front().slot + 1) * mSlotSize + mTtl <= current) {
+        for (auto &hash : mBuckets.front().hashes) {
+            auto it = mSwarms.find(hash);
+            if (it == mSwarms.end()) {
+                continue;
+            }
+            auto &peers = it->second.peers;
+            auto  end   = std::remove_if(peers.begin(), peers.end(), [&](const Peer &p) { return p.expire <= current; });
+            if (end != peers.end()) {
+                it->second.filters.reset();
+            }
+            dropped    += peers.end() - end;
+            peers.erase(end, peers.end());
+            if (peers.empty()) {
+                mSwarms.erase(it);
+            }
+        }
+        mBuckets.pop_front();
+    }
+    mSize -= dropped;
+    return dropped;
+}
+
+auto PeerStore::forEach(const std::function<void (const InfoHash &hash, const IPEndpoint &peer)> &fn) const -> void {
+    for (auto &[hash, swarm] : mSwarms) {
+        for (auto &peer : swarm.peers) {
+            fn(hash, peer.endpoint.toEndpoint());
+        }
+    }
+}
+
+auto PeerStore::clear() -> void {
+    mSwarms.clear();
+    mBuckets.clear();
+    mSize = 0;
+}
+
+auto PeerStore::setClock(std::function<Clock::time_point ()> clock) -> void {
+    mClock      = std::move(clock);
+    mCreateTime = mClock();
+    clear(); // The expiry times are of the old clock
+}
+
+auto PeerStore::size() const -> size_t {
+    return mSize;
+}
+
+auto PeerStore::hashes() const -> size_t {
+    return mSwarms.size();
+}
+
+auto PeerStore::hashOf(const Peer &peer) -> ScrapeFilter::Hash {
+    // BEP33 hashes the address only, the port is ignored
+    auto bytes = peer.endpoint.bytes();
+    return ScrapeFilter::hash(bytes.first(bytes.size() - 2));
+}
+
+auto PeerStore::addToFilters(Filters &filters, const Peer &peer) -> void {
+    if (peer.seed) {
+        filters.seeds.insertHash(peer.hash);
+    }
+    else {
+        filters.peers.insertHash(peer.hash);
+    }
+}
+
+auto PeerStore::now() const -> uint32_t {
+    return uint32_t(std::chrono::duration_cast<std::chrono::seconds>(mClock() - mCreateTime).count());
+}
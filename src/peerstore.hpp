@@ -0,0 +1,166 @@
+/**
+ * @file peerstore.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The store of the announced peers, with per-peer expiry
+ * @version 0.1
+ * @date 2025-06-05
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "bloomfilter.hpp"
+#include "nodeid.hpp"
+#include "net.hpp"
+#include "endpoint.hpp"
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <deque>
+#include <array>
+#include <map>
+
+/**
+ * @brief The peers announced to us, each peer expires ttl after its last announce
+ *
+ * The peers are stored as the CompactEndpoint (6 or 18 bytes). The expiry is incremental, the announced hashes are
+ * recorded in the time buckets, only the hashes in the buckets older than the ttl are checked. The number of the
+ * peers per hash and in total is limited. The BEP33 scrape filters of a hash are built on its first scrape, then
+ * kept up to date by the announces, and rebuilt only after some peers of it are dropped
+ *
+ */
+class PeerStore {
+public:
+    using Clock        = std::chrono::steady_clock;
+    using ScrapeFilter = BEP33BloomFilter<>;
+
+    /**
+     * @brief Construct a new Peer Store object
+     *
+     * @param ttl The time a peer is kept after its last announce
+     * @param maxPeersPerHash The max peers of a hash, the oldest one is replaced when full
+     * @param maxPeers The max peers in total, the new peers are rejected when full
+     */
+    PeerStore(std::chrono::seconds ttl = std::chrono::minutes(30), size_t maxPeersPerHash = 256,
+              size_t maxPeers = 1024 * 1024);
+    PeerStore(const PeerStore &) = delete;
+    ~PeerStore();
+
+    /**
+     * @brief Add or refresh the peer of the hash
+     *
+     * @param hash
+     * @param peer
+     * @param seed Is the peer a seed (BEP33)
+     * @return true On the peer is stored
+     * @return false On the store is full
+     */
+    auto announce(const InfoHash &hash, const IPEndpoint &peer, bool seed = false) -> bool;
+
+    /**
+     * @brief Pick at most max random peers of the hash, without copying all the peers
+     *
+     * @param hash
+     * @param max
+     * @param random
+     * @param out The picked peers are appended to it
+     * @param noseed Skip the seeds (BEP33)
+     * @return size_t The number of the picked peers
+     */
+    auto pick(const InfoHash &hash, size_t max, std::mt19937 &random, std::vector<IPEndpoint> &out,
+              bool noseed = false) -> size_t;
+
+    /**
+     * @brief Get the BEP33 bloom filters of the seeds and the downloaders of the hash
+     *
+     * @param hash
+     * @param seeds
+     * @param peers
+     * @return true On the hash has peers
+     * @return false On nothing known about the hash
+     */
+    auto scrape(const InfoHash &hash, ScrapeFilter &seeds, ScrapeFilter &peers) -> bool;
+
+    /**
+     * @brief Get the number of the peers of the hash
+     *
+     * @param hash
+     * @return size_t
+     */
+    auto count(const InfoHash &hash) const -> size_t;
+
+    /**
+     * @brief Drop the expired peers, it only checks the hashes announced about ttl ago
+     *
+     * @return size_t The number of the dropped peers
+     */
+    auto expire() -> size_t;
+
+    /**
+     * @brief Visit all the peers
+     *
+     * @param fn
+     */
+    auto forEach(const std::function<void (const InfoHash &hash, const IPEndpoint &peer)> &fn) const -> void;
+
+    /**
+     * @brief Remove all the peers
+     *
+     */
+    auto clear() -> void;
+
+    /**
+     * @brief Set the time source of the expiry, the peers of the old clock are dropped, e.g. the virtual clock of a simulation, the steady clock by default
+     *
+     * @param clock
+     */
+    auto setClock(std::function<Clock::time_point ()> clock) -> void;
+
+    /**
+     * @brief Get the number of the peers / hashes in the store
+     *
+     */
+    auto size() const -> size_t;
+    auto hashes() const -> size_t;
+private:
+    struct Peer {
+        CompactEndpoint    endpoint;
+        bool               seed;
+        uint32_t           expire; // The seconds since the store created
+        ScrapeFilter::Hash hash;   // The bloom filter indexes of the address, so the rebuild needs no SHA1
+    };
+
+    struct Filters {
+        ScrapeFilter seeds;
+        ScrapeFilter peers;
+    };
+
+    struct Swarm {
+        std::vector<Peer>        peers;
+        std::unique_ptr<Filters> filters; // The scrape filters, nullptr if not scraped yet or stale
+        uint32_t                 lastSlot = UINT32_MAX; // The last time bucket the hash recorded in
+    };
+
+    struct Bucket {
+        uint32_t              slot;
+        std::vector<InfoHash> hashes; // The hashes announced in this slot
+    };
+
+    static auto hashOf(const Peer &peer) -> ScrapeFilter::Hash;
+    static auto addToFilters(Filters &filters, const Peer &peer) -> void;
+
+    auto now() const -> uint32_t;
+
+    std::map<InfoHash, Swarm> mSwarms;
+    std::deque<Bucket>        mBuckets; // The ring of the time buckets, the oldest first
+    std::function<Clock::time_point ()> mClock = Clock::now;
+    Clock::time_point         mCreateTime = Clock::now();
+    uint32_t                  mTtl;
+    uint32_t                  mSlotSize;
+    size_t                    mMaxPeersPerHash;
+    size_t                    mMaxPeers;
+    size_t                    mSize = 0;
+};
@@ -0,0 +1,217 @@
+#include "ratelimit.hpp"
+#include <algorithm>
+#include <cstring>
+
+auto SourceKey::from(const IPAddress &ip, uint8_t prefix) -> SourceKey {
+    auto      bytes = ip.span();
+    SourceKey key;
+    key.len    = uint8_t(std::min<size_t>(bytes.size(), key.data.size()));
+    key.prefix = std::min<uint8_t>(prefix, key.len * 8);
+    auto full  = key.prefix / 8;
+    ::memcpy(key.data.data(), bytes.data(), full);
+    if (auto rest = key.prefix % 8; rest != 0) {
+        key.data[full] = bytes[full] & std::byte(0xFF << (8 - rest));
+    }
+    return key;
+}
+
+auto std::hash<SourceKey>::operator()(const SourceKey &key) const noexcept -> size_t {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < key.len; ++i) {
+        hash = (hash ^ uint64_t(key.data[i])) * 0x100000001b3ULL;
+    }
+    hash = (hash ^ key.prefix) * 0x100000001b3ULL;
+    return size_t(hash);
+}
+
+// Blocklist
+Blocklist::Blocklist(size_t maxEntries) : mMaxEntries(maxEntries) {
+
+}
+
+Blocklist::~Blocklist() {
+
+}
+
+auto Blocklist::block(const SourceKey &key, std::chrono::seconds duration) -> void {
+    auto until = mClock() + duration;
+    if (auto it = mEntries.find(key); it != mEntries.end()) {
+        it->second = std::max(it->second, until);
+        return;
+    }
+    if (mEntries.size() >= mMaxEntries && expire() == 0) { // Full of the alive entries, the limiter still works
+        return;
+    }
+    mEntries.emplace(key, until);
+}
+
+auto Blocklist::block(const IPAddress &ip, std::chrono::seconds duration) -> void {
+    block(SourceKey::from(ip), duration);
+}
+
+auto Blocklist::contains(const IPAddress &ip) const -> bool {
+    if (mEntries.empty()) {
+        return false;
+    }
+    auto now = mClock();
+    auto key = SourceKey::from(ip);
+    return find(key, now) || find(SourceKey::from(ip, key.len == 4 ? 24 : 64), now);
+}
+
+auto Blocklist::find(const SourceKey &key, Clock::time_point now) const -> bool {
+    auto it = mEntries.find(key);
+    return it != mEntries.end() && it->second > now;
+}
+
+auto Blocklist::expire() -> size_t {
+    auto now = mClock();
+    return std::erase_if(mEntries, [&](const auto &item) { return item.second <= now; });
+}
+
+auto Blocklist::setClock(std::function<Clock::time_point ()> clock) -> void {
+    mClock = std::move(clock);
+    mEntries.clear(); // The unblock times are of the old clock
+}
+
+auto Blocklist::size() const -> size_t {
+    return mEntries.size();
+}
+
+auto Blocklist::clear() -> void {
+    mEntries.clear();
+}
+
+// RateLimiter
+RateLimiter::RateLimiter(Blocklist &blocklist) : RateLimiter(blocklist, Config {}) {
+
+}
+
+RateLimiter::RateLimiter(Blocklist &blocklist, const Config &config) : mBlocklist(blocklist), mConfig(config) {
+    mConfig.maxSources = std::clamp<size_t>(mConfig.maxSources, 2, NPOS - 1);
+    mBuckets.reserve(mConfig.maxSources);
+    mIndex.reserve(mConfig.maxSources);
+}
+
+RateLimiter::~RateLimiter() {
+
+}
+
+auto RateLimiter::allow(const IPAddress &ip) -> bool {
+    if (mBlocklist.contains(ip)) {
+        mDenied += 1;
+        return false;
+    }
+    auto now    = uint32_t(std::chrono::duration_cast<std::chrono::milliseconds>(mClock() - mCreateTime).count());
+    auto key    = SourceKey::from(ip);
+    auto subnet = SourceKey::from(ip, key.len == 4 ? 24 : 64);
+    if (!take(key, mConfig.ipRate, mConfig.ipBurst, now)) {
+        mDenied += 1;
+        return false;
+    }
+    if (!take(subnet, mConfig.subnetRate, mConfig.subnetBurst, now)) { // Denied by the subnet, the address pays nothing
+        refund(key, mConfig.ipBurst);
+        mDenied += 1;
+        return false;
+    }
+    return true;
+}
+
+auto RateLimiter::setClock(std::function<Clock::time_point ()> clock) -> void {
+    mClock      = std::move(clock);
+    mCreateTime = mClock();
+    mBuckets.clear(); // The refill times are of the old clock
+    mIndex.clear();
+    mHead = NPOS;
+    mTail = NPOS;
+}
+
+auto RateLimiter::denied() const -> size_t {
+    return mDenied;
+}
+
+auto RateLimiter::sources() const -> size_t {
+    return mIndex.size();
+}
+
+auto RateLimiter::take(const SourceKey &key, float rate, float burst, uint32_t now) -> bool {
+    auto &bucket = acquire(key, burst, now);
+    bucket.tokens     = std::min(burst, bucket.tokens + float(now - bucket.lastRefill) * rate / 1000.0f);
+    bucket.lastRefill = now;
+    if (bucket.tokens >= burst) { // Behaved for a while, forgive it
+        bucket.strikes = 0;
+    }
+    if (bucket.tokens >= 1.0f) {
+        bucket.tokens -= 1.0f;
+        return true;
+    }
+    if (++bucket.strikes >= mConfig.blockAfter) {
+        mBlocklist.block(key, mConfig.blockTime);
+        bucket.strikes = 0;
+    }
+    return false;
+}
+
+auto RateLimiter::refund(const SourceKey &key, float burst) -> void {
+    if (auto it = mIndex.find(key); it != mIndex.end()) { // Maybe evicted by the subnet one
+        auto &bucket  = mBuckets[it->second];
+        bucket.tokens = std::min(burst, bucket.tokens + 1.0f);
+    }
+}
+
+auto RateLimiter::acquire(const SourceKey &key, float burst, uint32_t now) -> Bucket & {
+    if (auto it = mIndex.find(key); it != mIndex.end()) {
+        if (it->second != mHead) { // Move it to the front
+            unlink(it->second);
+            pushFront(it->second);
+        }
+        return mBuckets[it->second];
+    }
+    uint32_t idx = 0;
+    if (mBuckets.size() < mConfig.maxSources) {
+        idx = uint32_t(mBuckets.size());
+        mBuckets.emplace_back();
+    }
+    else { // Evict the least recently used one
+        idx = mTail;
+        unlink(idx);
+        mIndex.erase(mBuckets[idx].key);
+    }
+    auto &bucket      = mBuckets[idx];
+    bucket.key        = key;
+    bucket.tokens     = burst;
+    bucket.lastRefill = now;
+    bucket.strikes    = 0;
+    mIndex.emplace(key, idx);
+    pushFront(idx);
+    return bucket;
+}
+
+auto RateLimiter::unlink(uint32_t idx) -> void {
+    auto &bucket = mBuckets[idx];
+    if (bucket.prev != NPOS) {
+        mBuckets[bucket.prev].next = bucket.next;
+    }
+    else {
+        mHead = bucket.next;
+    }
+    if (bucket.next != NPOS) {
+        mBuckets[bucket.next].prev = bucket.prev;
+    }
+    else {
+        mTail = bucket.prev;
+    }
+}
+
+auto RateLimiter::pushFront(uint32_t idx) -> void {
+    auto &bucket = mBuckets[idx];
+    bucket.prev  = NPOS;
+    bucket.next  = mHead;
+    if (mHead != NPOS) {
+        mBuckets[mHead].prev = idx;
+    }
+    mHead = idx;
+    if (mTail == NPOS) {
+        mTail = idx;
+    }
+}
@@ -0,0 +1,178 @@
+/**
+ * @file ratelimit.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The per source rate limiter of the inbound datagrams and the blocklist of the abusive sources
+ * @version 0.1
+ * @date 2025-06-06
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "net.hpp"
+#include <unordered_map>
+#include <functional>
+#include <chrono>
+#include <vector>
+#include <array>
+
+/**
+ * @brief The address or the prefix of it (the /24 of ipv4, the /64 of ipv6), the key of the limiter and the blocklist
+ *
+ */
+struct SourceKey {
+    std::array<std::byte, 16> data {};
+    uint8_t                   len    = 0; // 4 or 16
+    uint8_t                   prefix = 0; // The prefix bits kept, the rest is zero
+
+    /**
+     * @brief Make the key of the address, keep the first prefix bits (clamped to the address size)
+     *
+     * @param ip
+     * @param prefix
+     * @return SourceKey
+     */
+    static auto from(const IPAddress &ip, uint8_t prefix = 128) -> SourceKey;
+
+    auto operator ==(const SourceKey &) const -> bool = default;
+};
+
+template <>
+struct std::hash<SourceKey> {
+    auto operator()(const SourceKey &key) const noexcept -> size_t;
+};
+
+/**
+ * @brief The addresses and the subnets we drop everything from, each entry expires by itself
+ *
+ */
+class Blocklist {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    Blocklist(size_t maxEntries = 64 * 1024);
+    Blocklist(const Blocklist &) = delete;
+    ~Blocklist();
+
+    /**
+     * @brief Block the address (or the subnet by the key) for the duration, extend it if already blocked
+     *
+     * @param key
+     * @param duration
+     */
+    auto block(const SourceKey &key, std::chrono::seconds duration) -> void;
+    auto block(const IPAddress &ip, std::chrono::seconds duration) -> void;
+
+    /**
+     * @brief Check the address or its subnet is blocked
+     *
+     * @param ip
+     * @return true
+     * @return false
+     */
+    auto contains(const IPAddress &ip) const -> bool;
+
+    /**
+     * @brief Drop the expired entries
+     *
+     * @return size_t The number of the dropped entries
+     */
+    auto expire() -> size_t;
+
+    auto size() const -> size_t;
+    auto clear() -> void;
+
+    /**
+     * @brief Set the time source of the expiry, the entries of the old clock are dropped, e.g. the virtual clock of a simulation, the steady clock by default
+     *
+     * @param clock
+     */
+    auto setClock(std::function<Clock::time_point ()> clock) -> void;
+private:
+    auto find(const SourceKey &key, Clock::time_point now) const -> bool;
+
+    std::unordered_map<SourceKey, Clock::time_point> mEntries; // The key and when it is unblocked
+    std::function<Clock::time_point ()>              mClock = Clock::now;
+    size_t mMaxEntries;
+};
+
+/**
+ * @brief The token bucket rate limiter per address and per subnet
+ *
+ * The buckets are kept in a fixed size LRU (a flat array with the index links), the least recently seen source is
+ * evicted when full, so a flood of the spoofed addresses can't grow the memory. A source denied too many times in a
+ * row is put into the blocklist
+ *
+ */
+class RateLimiter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        float    ipRate       = 20;   // The tokens refilled per second of an address
+        float    ipBurst      = 50;
+        float    subnetRate   = 100;  // The tokens refilled per second of a /24 or /64
+        float    subnetBurst  = 200;
+        size_t   maxSources   = 16 * 1024; // The capacity of the LRU
+        uint32_t blockAfter   = 200;  // Block the source after this number of the denied datagrams
+        std::chrono::seconds blockTime = std::chrono::minutes(30);
+    };
+
+    RateLimiter(Blocklist &blocklist);
+    RateLimiter(Blocklist &blocklist, const Config &config);
+    RateLimiter(const RateLimiter &) = delete;
+    ~RateLimiter();
+
+    /**
+     * @brief Take a token of the address and its subnet
+     *
+     * @param ip
+     * @return true On the datagram can be handled
+     * @return false On the source is blocked or runs out of tokens, drop it
+     */
+    auto allow(const IPAddress &ip) -> bool;
+
+    /**
+     * @brief Set the time source of the buckets refill, e.g. the virtual clock of a simulation, the steady clock by
+     * default
+     *
+     * @param clock
+     */
+    auto setClock(std::function<Clock::time_point ()> clock) -> void;
+
+    /**
+     * @brief Get the number of the datagrams denied
+     *
+     * @return size_t
+     */
+    auto denied() const -> size_t;
+    auto sources() const -> size_t;
+private:
+    static constexpr uint32_t NPOS = UINT32_MAX;
+
+    struct Bucket {
+        SourceKey key;
+        float     tokens;
+        uint32_t  lastRefill; // The milliseconds since the limiter created
+        uint32_t  strikes;    // The denied datagrams since the bucket was full
+        uint32_t  prev;       // The links of the LRU, the head is the most recently used
+        uint32_t  next;
+    };
+
+    auto take(const SourceKey &key, float rate, float burst, uint32_t now) -> bool;
+    auto refund(const SourceKey &key, float burst) -> void; // Give back the token taken by the take()
+    auto acquire(const SourceKey &key, float burst, uint32_t now) -> Bucket &;
+    auto unlink(uint32_t idx) -> void;
+    auto pushFront(uint32_t idx) -> void;
+
+    Blocklist                             &mBlocklist;
+    Config                                 mConfig;
+    std::vector<Bucket>                    mBuckets;
+    std::unordered_map<SourceKey, uint32_t> mIndex;
+    uint32_t                               mHead = NPOS;
+    uint32_t                               mTail = NPOS;
+    std::function<Clock::time_point ()>    mClock = Clock::now;
+    Clock::time_point                      mCreateTime = Clock::now();
+    size_t                                 mDenied = 0;
+};
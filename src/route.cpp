@@ -1,4 +1,7 @@
 #include "route.hpp"
+#include "secureid.hpp"
+
+inline constexpr uint8_t NODE_MAX_FAILURES = 2; // Drop the node after this number of the failed queries in a row
 
 RoutingTable::RoutingTable(const NodeId &id) : mId(id) {
 }
@@ -13,15 +16,30 @@ auto RoutingTable::findBucketIndex(const NodeId &id) const -> size_t {
 
 auto RoutingTable::updateNode(const NodeEndpoint &endpoint) -> Status {
     Node node {
-        .lastSeen = std::chrono::steady_clock::now(),
+        .lastSeen = mClock(),
         .endpoint = endpoint,
         .state    = Node::Good,
     };
+    bool secure = isSecure(endpoint);
+    if (!secure && mSecureIdPolicy == Require) {
+        return Status::Rejected;
+    }
     size_t idx     = findBucketIndex(endpoint.id);
     auto  &bucket  = mBuckets[idx];
     auto  &pending = bucket.pending;
     auto  &nodes   = bucket.nodes;
     auto   it      = std::find_if(nodes.begin(), nodes.end(), [&](const Node &n) { return n.endpoint == endpoint; });
+    if (it == nodes.end() && nodes.size() >= KBUCKET_SIZE && secure && mSecureIdPolicy == Prefer) {
+        // Give the place of a insecure node to it, the forged ids close to the targets can't hold the bucket
+        auto insecure = std::find_if(nodes.begin(), nodes.end(), [&](const Node &n) { return !isSecure(n.endpoint); });
+        if (insecure != nodes.end()) {
+            DHT_LOG("Replaced insecure node {} with secure node {}", insecure->endpoint.id, endpoint.id);
+            bucket.lastUpdate = node.lastSeen;
+            *insecure = std::move(node);
+            notifyChanged();
+            return Status::Added;
+        }
+    }
     if (it == nodes.end() && nodes.size() >= KBUCKET_SIZE) {
         // Not Found and The bucket is full, check pending list
         if (pending.size() >= KBUCKET_SIZE) {
@@ -32,11 +50,12 @@ auto RoutingTable::updateNode(const NodeEndpoint &endpoint) -> Status {
         notifyChanged();
         return Status::Pending;
     }
-    bucket.lastUpdate = std::chrono::steady_clock::now();
+    bucket.lastUpdate = mClock();
     if (it != nodes.end()) {
         // The node already exists, update it
         it->lastSeen = node.lastSeen;
         it->state    = Node::Good; // Mark the node as good
+        it->failures = 0;
         return Status::Updated;
     }
     nodes.emplace_back(std::move(node));
@@ -44,6 +63,49 @@ auto RoutingTable::updateNode(const NodeEndpoint &endpoint) -> Status {
     return Status::Added;
 }
 
+auto RoutingTable::restoreNode(const Node &node) -> Status {
+    auto status = insertRestored(node);
+    if (status == Status::Added) {
+        notifyChanged();
+    }
+    return status;
+}
+
+auto RoutingTable::restoreNodes(std::span<const Node> nodes) -> size_t {
+    size_t added = 0;
+    for (auto &node : nodes) {
+        added += insertRestored(node) == Status::Added;
+    }
+    if (added > 0) {
+        notifyChanged();
+    }
+    return added;
+}
+
+auto RoutingTable::insertRestored(const Node &node) -> Status {
+    if (mSecureIdPolicy == Require && !isSecure(node.endpoint)) {
+        return Status::Rejected;
+    }
+    size_t idx     = findBucketIndex(node.endpoint.id);
+    auto  &bucket  = mBuckets[idx];
+    auto  &nodes   = bucket.nodes;
+    auto   it      = std::find_if(nodes.begin(), nodes.end(), [&](const Node &n) { return n.endpoint == node.endpoint; });
+    if (it != nodes.end()) {
+        return Status::Updated;
+    }
+    if (nodes.size() >= KBUCKET_SIZE) {
+        if (bucket.pending.size() >= KBUCKET_SIZE) {
+            return Status::Pending;
+        }
+        bucket.pending.push_back(node);
+        return Status::Pending;
+    }
+    bucket.lastUpdate = std::max(bucket.lastUpdate, node.lastSeen);
+    nodes.push_back(node);
+    nodes.back().failures = 0;
+    return Status::Added;
+}
+
 auto RoutingTable::markBadNode(const NodeEndpoint &node) -> void {
     size_t idx    = findBucketIndex(node.id);
     auto  &bucket = mBuckets[idx];
@@ -52,8 +114,9 @@ auto RoutingTable::markBadNode(const NodeEndpoint &node) -> void {
     if (it == nodes.end()) { // The node not exists
         return;
     }
-    if (it->state == Node::Good) {
-        it->state = Node::Questionable; // Mark the node as questionable, if it's already questionable, drop it
+    it->failures += 1;
+    if (it->failures < NODE_MAX_FAILURES) {
+        it->state = Node::Questionable; // Mark the node as questionable, if it keeps failing, drop it
         DHT_LOG("Marking node {} as Questionable", node.id);
         return;
     }
@@ -198,10 +261,55 @@ auto RoutingTable::size() const -> size_t {
     return num;
 }
 
+auto RoutingTable::bucketSize(size_t idx) const -> size_t {
+    if (idx >= mBuckets.size()) {
+        return 0;
+    }
+    return mBuckets[idx].nodes.size();
+}
+
 auto RoutingTable::setOnNodeChanged(std::function<void()> &&callback) -> void {
     mOnNodeChanged = std::move(callback);
 }
 
+auto RoutingTable::setSecureIdPolicy(SecureIdPolicy policy) -> void {
+    mSecureIdPolicy = policy;
+}
+
+auto RoutingTable::setClock(std::function<std::chrono::steady_clock::time_point ()> clock) -> void {
+    mClock          = std::move(clock);
+    mInitTime       = mClock();
+    mInitTimeSystem = std::chrono::system_clock::now();
+}
+
+auto RoutingTable::resetId(const NodeId &id) -> void {
+    // The nodes first, then the pending ones, so the candidates only fill the room left or wait again
+    std::vector<Node> nodes;
+    std::vector<Node> pending;
+    for (auto &bucket : mBuckets) {
+        nodes.insert(nodes.end(), bucket.nodes.begin(), bucket.nodes.end());
+        pending.insert(pending.end(), bucket.pending.begin(), bucket.pending.end());
+        bucket.nodes.clear();
+        bucket.pending.clear();
+    }
+    mId = id;
+    for (auto &node : nodes) {
+        insertRestored(node);
+    }
+    for (auto &node : pending) {
+        insertRestored(node);
+    }
+    notifyChanged();
+}
+
+auto RoutingTable::accepts(const NodeEndpoint &node) const -> bool {
+    return mSecureIdPolicy != Require || isSecure(node);
+}
+
+auto RoutingTable::isSecure(const NodeEndpoint &node) const -> bool {
+    return mSecureIdPolicy == Ignore || isSecureNodeId(node.id, node.ip.address());
+}
+
 auto RoutingTable::translateTimepoint(std::chrono::steady_clock::time_point tp) const
     -> std::chrono::system_clock::time_point {
     auto diff = tp - mInitTime;
@@ -4,10 +4,12 @@
 #include "nodeid.hpp"
 #include "krpc.hpp"
 #include <algorithm>
+#include <functional>
 #include <vector>
 #include <chrono>
 #include <format>
 #include <deque>
+#include <span>
 #include <set>
 
 // https://www.bittorrent.org/beps/bep_0005.html
@@ -23,6 +25,7 @@ struct Node {
     std::chrono::steady_clock::time_point lastSeen;
     NodeEndpoint endpoint;
     State state;
+    uint8_t failures = 0; //< The queries failed in a row, reset on reply
 };
 
 struct KBucket {
@@ -41,6 +44,17 @@ public:
         Updated, // The node already exists and updated
         Added,   // The node is added to the bucket
         Pending, // The bucket is full, the node added to pending list
+        Rejected, // The id is not the BEP42 secure id of the ip, and the policy requires it
+    };
+
+    /**
+     * @brief How the BEP42 secure ids are treated
+     * 
+     */
+    enum SecureIdPolicy {
+        Ignore,  // Accept any id
+        Prefer,  // Accept any id, but a full bucket replaces the insecure node with the secure one
+        Require, // Reject the insecure id
     };
 
     RoutingTable(const NodeId &id);
@@ -57,7 +71,23 @@ public:
     auto updateNode(const NodeEndpoint &node) -> Status;
 
     /**
-     * @brief Mark a node as bad, such as don't respond
+     * @brief Restore a node from the snapshot, keep the state and last seen of it, don't touch the existing one
+     * 
+     * @param node 
+     */
+    auto restoreNode(const Node &node) -> Status;
+
+    /**
+     * @brief Restore the nodes from the snapshot, as restoreNode, but notify the change only once
+     * 
+     * @param nodes 
+     * @return size_t The number of the nodes added to the buckets
+     */
+    auto restoreNodes(std::span<const Node> nodes) -> size_t;
+
+    /**
+     * @brief Mark a node as bad, such as don't respond. A good one becomes questionable, a questionable one is dropped
+     * after it failed twice in a row, so a restored node survives one lost ping
      * 
      * @param node 
      */
@@ -107,17 +137,57 @@ public:
      */
     auto size() const -> size_t;
 
+    /**
+     * @brief The number of the nodes in the bucket
+     * 
+     * @param idx The bucket index (the distance exponent to us), in [0, 160)
+     * @return size_t 
+     */
+    auto bucketSize(size_t idx) const -> size_t;
+
     /**
      * @brief Set the Callback on node changed
      * 
      * @param callback 
      */
     auto setOnNodeChanged(std::function<void ()> &&callback) -> void;
+
+    /**
+     * @brief Set the BEP42 policy applied in updateNode and restoreNode, the local network ips are always accepted
+     * 
+     * @param policy 
+     */
+    auto setSecureIdPolicy(SecureIdPolicy policy) -> void;
+
+    /**
+     * @brief Check the node can be added by the BEP42 policy, only the Require one rejects
+     * 
+     * @param node 
+     * @return true 
+     */
+    auto accepts(const NodeEndpoint &node) const -> bool;
+
+    /**
+     * @brief Set the time source of the last seen, e.g. the virtual clock of a simulation, the steady clock by default
+     * 
+     * @param clock 
+     */
+    auto setClock(std::function<std::chrono::steady_clock::time_point ()> clock) -> void;
+
+    /**
+     * @brief Change the id of us, all the nodes are put into the buckets by the new id
+     * 
+     * @param id 
+     */
+    auto resetId(const NodeId &id) -> void;
 private:
+    auto isSecure(const NodeEndpoint &node) const -> bool;
+    auto insertRestored(const Node &node) -> Status; // restoreNode without the notify
     auto translateTimepoint(std::chrono::steady_clock::time_point) const -> std::chrono::system_clock::time_point;
     auto notifyChanged() -> void;
 
     NodeId mId; //< The id of us
+    SecureIdPolicy mSecureIdPolicy = Prefer;
     std::array<KBucket, 160> mBuckets; //< The buckets [0] is the closest
     std::set<IPEndpoint> mIps;
 
@@ -125,6 +195,8 @@ private:
     std::chrono::steady_clock::time_point mInitTime = std::chrono::steady_clock::now();
     std::chrono::system_clock::time_point mInitTimeSystem = std::chrono::system_clock::now();
 
+    std::function<std::chrono::steady_clock::time_point ()> mClock = std::chrono::steady_clock::now;
+
     // The Callback for notify the routing tabel change
     std::function<void ()> mOnNodeChanged;
 };
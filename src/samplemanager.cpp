@@ -2,14 +2,8 @@
 
 #include <ilias/task/when_any.hpp>
 
-#define MAX_PARALLEL_SAMPLE 30
-#define MAX_SAMPLE_INTERVAL (6 * 60 * 60)  // 6 hours
-#define MIN_SAMPLE_INTERVAL (10 * 60)      // 10 minutes
-#define RESAMPLE_INTERVAL 60               // 1 minutes
 #define RANDOM_DIFFUSION_INTERVAL (5 * 60) // 5 minutes
 #define SAMPLE_EXECUTION_DELAY 50          // 50 milliseconds
-#define MAX_ALLOWED_SAMPLE_FAILURES 10
-#define MAX_SAMPLE_TASKS 1000
 
 SampleManager::SampleManager(DhtSession &session) : mSession(session) {
     mSession.setOnQuery(std::bind(&SampleManager::onQuery, this, std::placeholders::_1, std::placeholders::_2));
@@ -24,59 +18,71 @@ SampleManager::~SampleManager() {
     mTaskScope.wait();
 }
 
-bool SampleManager::addSampleIpEndpoint(const IPEndpoint &endpoint) {
-    if (mIpEndpoints.find(endpoint) == mIpEndpoints.end()) {
-        mIpEndpoints.insert(endpoint);
-        mSampleNodes.emplace_back(std::make_shared<SampleNode>(SampleNode {.endpoint = endpoint}));
+bool SampleManager::addSampleIpEndpoint(const CompactEndpoint &endpoint, const NodeId &id) {
+    if (mSession.blocklist().contains(endpoint.address())) {
+        return false;
+    }
+    if (mIpEndpoints.insert(endpoint).second) {
+        auto node = std::make_shared<SampleNode>(SampleNode {.endpoint = endpoint, .id = id});
+        node->yield = mPolicy.targetYield; // Optimistic, so the new nodes are tried first
+        mSampleNodes.emplace(endpoint, node);
+        cover(*node);
+        schedule(node);
         mSampleEvent.set();
+        mWorkEvent.set();
         return true;
     }
     return false;
 }
 
-void SampleManager::removeSample(const IPEndpoint &endpoint) {
+void SampleManager::removeSample(const CompactEndpoint &endpoint) {
     mIpEndpoints.erase(endpoint);
-    if (auto it = std::find_if(mSampleNodes.begin(), mSampleNodes.end(),
-                               [&endpoint](const auto &node) { return node->endpoint == endpoint; });
-        it != mSampleNodes.end()) {
+    if (auto it = mSampleNodes.find(endpoint); it != mSampleNodes.end()) {
+        forget(*it->second);
         mSampleNodes.erase(it);
     }
 }
 
 void SampleManager::clearSamples() {
+    for (auto &[endpoint, node] : mSampleNodes) {
+        node->listed = false;
+    }
     mIpEndpoints.clear();
     mSampleNodes.clear();
+    mSchedule.clear();
+    mCoverage.clear();
 }
 
 auto SampleManager::getSampleIpEndpoints() const -> std::vector<IPEndpoint> {
     std::vector<IPEndpoint> ret;
-    for (const auto &node : mSampleNodes) {
-        ret.push_back(node->endpoint);
+    for (const auto &[endpoint, node] : mSampleNodes) {
+        ret.push_back(endpoint.toEndpoint());
     }
     return ret;
 }
 
 auto SampleManager::getSampleNodes() const -> std::vector<SampleNode> {
     std::vector<SampleNode> ret;
-    for (const auto &node : mSampleNodes) {
+    for (const auto &[endpoint, node] : mSampleNodes) {
         ret.push_back(*node);
     }
     return ret;
 }
 
 auto SampleManager::excludeIpEndpoints() -> std::vector<IPEndpoint> {
-    auto ips = mIpEndpoints;
-    for (const auto &node : mSampleNodes) {
-        ips.erase(node->endpoint);
+    std::vector<IPEndpoint> ret;
+    for (const auto &ip : mIpEndpoints) {
+        if (!mSampleNodes.contains(ip)) {
+            ret.push_back(ip.toEndpoint());
+        }
     }
-    return {ips.begin(), ips.end()};
+    return ret;
 }
 
-void SampleManager::excludeIpEndpoint(const IPEndpoint &endpoint) {
+void SampleManager::excludeIpEndpoint(const CompactEndpoint &endpoint) {
     mIpEndpoints.insert(endpoint);
-    if (auto it = std::find_if(mSampleNodes.begin(), mSampleNodes.end(),
-                               [&endpoint](const auto &node) { return node->endpoint == endpoint; });
-        it != mSampleNodes.end()) {
+    if (auto it = mSampleNodes.find(endpoint); it != mSampleNodes.end()) {
+        forget(*it->second);
         mSampleNodes.erase(it);
     }
 }
@@ -85,6 +91,7 @@ auto SampleManager::start() -> Task<> {
     mAutoSample = true;
     mSampleEvent.set();
     mTaskScope.spawn(autoSample());
+    spawnWorkers();
     co_return;
 }
 
@@ -93,9 +100,11 @@ auto SampleManager::stop() -> Task<> {
     mRandomDiffusion = false;
     mTaskScope.cancel();
     co_await mTaskScope;
-    for (auto &node : mSampleNodes) {
+    mWorkers = 0;
+    for (auto &[endpoint, node] : mSampleNodes) {
         if (node->status == SampleNode::Sampling) {
             node->status = SampleNode::NoStatus;
+            schedule(node);
         }
     }
     co_return;
@@ -111,6 +120,34 @@ void SampleManager::setRandomDiffusion(bool enable) {
     mSession.setRandomSearch(!enable);
 }
 
+void SampleManager::setConcurrency(const AdaptiveLimit::Config &config) {
+    mLimit.setConfig(config);
+    if (mAutoSample) {
+        spawnWorkers(); // The extra workers will quit by themselves when shrinking
+    }
+    mWorkEvent.set();
+}
+
+auto SampleManager::concurrency() const -> const AdaptiveLimit & {
+    return mLimit;
+}
+
+void SampleManager::setSamplePolicy(const SamplePolicy &policy) {
+    mPolicy = policy;
+}
+
+auto SampleManager::samplePolicy() const -> const SamplePolicy & {
+    return mPolicy;
+}
+
+auto SampleManager::coverage() const -> const KeyspaceCoverage & {
+    return mCoverage;
+}
+
+auto SampleManager::statistics() const -> const Statistics & {
+    return mStatistics;
+}
+
 void SampleManager::dump() {
     // Define column widths
     const int IP_WIDTH      = 48; // Increased for IPv6
@@ -122,6 +159,12 @@ void SampleManager::dump() {
     SAMPLE_LOG("SampleManager dump:");
     SAMPLE_LOG("  AutoSample: {}", mAutoSample);
     SAMPLE_LOG("  RandomDiffusion: {}", mRandomDiffusion);
+    SAMPLE_LOG("  Coverage: {}/{} regions sampled", mCoverage.coveredRegions(), mCoverage.regions());
+    SAMPLE_LOG("  Queries: {}, samples: {}, new hashes: {}, new hashes per packet: {:.3f}", mStatistics.queries,
+               mStatistics.samples, mStatistics.newHashes,
+               double(mStatistics.newHashes) / std::max<size_t>(mSession.statistics().queriesSent, 1));
+    SAMPLE_LOG("  Concurrency: {} sampling, limit {}, success rate {:.2f}, rtt {}", mSamplingCount, mLimit.limit(),
+               mLimit.successRate(), mLimit.averageRtt());
     SAMPLE_LOG("Sample Nodes:");
     SAMPLE_LOG("  | {:<{}} | {:<{}} | {:<{}} | {:<{}} | {:<{}} | {:<{}}", "IpEndpoint", IP_WIDTH, "Status",
                STATUS_WIDTH, "Timeout", TIMEOUT_WIDTH, "HashsCount", COUNT_WIDTH, "SuccessCount", COUNT_WIDTH,
@@ -129,7 +172,7 @@ void SampleManager::dump() {
     SAMPLE_LOG("  | {:<{}} | {:<{}} | {:<{}} | {:<{}} | {:<{}} | {:<{}}", "---------", IP_WIDTH, "------", STATUS_WIDTH,
                "-------", TIMEOUT_WIDTH, "---------", COUNT_WIDTH, "----------", COUNT_WIDTH, "----------",
                COUNT_WIDTH);
-    for (const auto &node : mSampleNodes) {
+    for (const auto &[endpoint, node] : mSampleNodes) {
         SAMPLE_LOG("  | {:<{}} | {:<{}} | {:<{}} | {:<{}} | {:<{}} | {:<{}}", node->endpoint.toString(), IP_WIDTH,
                    node->status, STATUS_WIDTH, std::max(0, (int)(node->timeout - now)), TIMEOUT_WIDTH, node->hashsCount,
                    COUNT_WIDTH, node->successCount, COUNT_WIDTH, node->failure, COUNT_WIDTH);
@@ -145,46 +188,51 @@ void SampleManager::dump() {
 }
 
 auto SampleManager::randomDiffusion(uint64_t &nextTime) -> Task<void> {
-    auto id  = NodeId::rand();
+    auto id  = mCoverage.randomTarget(mRandom); // Go where we know the least
     auto res = co_await mSession.findNode(id, DhtSession::FindAlgo::AStar);
+    mStatistics.diffusions += 1;
     if (!res) {
         SAMPLE_LOG("Failed to random diffusion, error: {}", res.error());
         co_return;
     }
     for (auto &node : *res) {
-        if (addSampleIpEndpoint(node.ip)) {
+        if (addSampleIpEndpoint(node.ip, node.id)) {
             nextTime = 0; // sample immediately
         }
     }
 }
 
-auto SampleManager::sample(std::shared_ptr<SampleNode> node, uint64_t &nextTime) -> Task<> {
-    while (mSamplingCount > MAX_PARALLEL_SAMPLE) {
-        mSampleEvent.clear();
-        if (auto ret = co_await mSampleEvent; !ret) { // wait for sampling count to decrease
-            node->status = SampleNode::NoStatus;
-            co_return;
-        }
-    }
+auto SampleManager::sample(std::shared_ptr<SampleNode> node) -> Task<> {
     mSamplingCount++;
     SAMPLE_LOG("Sample {}", node->endpoint);
-    auto res = co_await mSession.sampleInfoHashes(node->endpoint, NodeId::rand());
+    auto begin = std::chrono::steady_clock::now();
+    auto id    = node->id == NodeId {} ? std::nullopt : std::optional(node->id);
+    auto res   = co_await mSession.sampleInfoHashes(node->endpoint.toEndpoint(), NodeId::rand(), id);
+    mStatistics.queries += 1;
+    if (res) {
+        auto rtt = std::chrono::steady_clock::now() - begin;
+        mLimit.onSuccess(std::chrono::duration_cast<std::chrono::milliseconds>(rtt));
+    }
+    else if (res.error() != Error::Canceled && res.error() != KrpcError::RpcErrorMessage &&
+             res.error() != KrpcError::BadReply) { // No reply at all
+        mLimit.onLoss(node->successCount > 0);
+        mStatistics.lost += 1;
+    }
     if (!res) {
-        if (res.error() == KrpcError::RpcErrorMessage) {
-            node->timeout = MAX_SAMPLE_INTERVAL + mLastSampleTime;
+        if (res.error() == KrpcError::RpcErrorMessage) { // No BEP51, keep it until maxInterval, so it isn't added back
+            node->timeout = mPolicy.maxInterval.count() + mLastSampleTime;
             node->status  = SampleNode::BlackList;
-            node->failure = 114514;
         }
-        if (res.error() != Error::Canceled) {
-            if (auto ret = co_await mSession.ping(node->endpoint); !ret) {
-                node->timeout = MAX_SAMPLE_INTERVAL + mLastSampleTime;
+        else if (res.error() != Error::Canceled) {
+            node->failure += 1;
+            auto ret = co_await mSession.ping(node->endpoint.toEndpoint());
+            if (!ret || node->failure >= mPolicy.maxFailures) { // Gone, or alive but never answers the sample
+                node->timeout = mPolicy.maxInterval.count() + mLastSampleTime;
                 node->status  = SampleNode::BlackList;
-                node->failure = 114514;
             }
             else {
-                node->timeout = RESAMPLE_INTERVAL + mLastSampleTime;
+                node->timeout = mPolicy.retryDelay(node->failure).count() + mLastSampleTime;
                 node->status  = SampleNode::Retry;
-                node->failure += 5;
             }
         }
         SAMPLE_LOG("Failed to sample {}, error: {}", node->endpoint, res.error());
@@ -193,32 +241,38 @@ auto SampleManager::sample(std::shared_ptr<SampleNode> node, uint64_t &nextTime)
                          [](const InfoHash &hash) { return hash == InfoHash::zero(); })) {
         SAMPLE_LOG("Failed to sample {}, error: zero hash", node->endpoint);
         node->status  = SampleNode::BlackList;
-        node->failure = 114514;
+        // The junk node, don't talk with it at all
+        mSession.blocklist().block(node->endpoint.address(), mPolicy.maxInterval);
     }
     else {
-        node->timeout = std::clamp(res->interval, res->samples.size() < res->num ? MIN_SAMPLE_INTERVAL : (60 * 60),
-                                   MAX_SAMPLE_INTERVAL) +
-                        mLastSampleTime; // at least 10 min, at most 6 hours
+        uncover(*node);
+        node->id = res->id;
         node->successCount++;
+        cover(*node);
         node->failure    = 0;
         node->status     = SampleNode::NoStatus;
         int newHashCount = 0;
         if (mOnInfoHashs) {
             newHashCount += mOnInfoHashs(res->samples);
-            if (newHashCount == 0) {
-                node->timeout = MAX_SAMPLE_INTERVAL + mLastSampleTime;
-            }
         }
+        // The more new hashes it gives, the sooner and the earlier (when many are due) we ask it again
+        node->yield    = mPolicy.nextYield(node->yield, newHashCount);
+        auto interval  = mPolicy.resampleInterval(node->yield, std::chrono::seconds(std::max(res->interval, 0)),
+                                                  res->samples.size(), size_t(std::max(res->num, 0)));
+        node->timeout  = interval.count() + mLastSampleTime;
         node->hashsCount += newHashCount;
+        mStatistics.samples   += res->samples.size();
+        mStatistics.newHashes += newHashCount;
         if (mRandomDiffusion) {
             for (auto &hash : res->nodes) {
-                addSampleIpEndpoint(hash.ip);
+                addSampleIpEndpoint(hash.ip, hash.id);
             }
         }
     }
-    nextTime = std::min(nextTime, node->timeout - mLastSampleTime);
+    schedule(node);
     mSamplingCount--;
     mSampleEvent.set();
+    mWorkEvent.set();
 }
 
 auto SampleManager::autoSample() -> Task<void> {
@@ -229,43 +283,25 @@ auto SampleManager::autoSample() -> Task<void> {
                 break;
             }
         }
-        while (mTaskScope.runningTasks() > MAX_SAMPLE_TASKS) {
-            if (auto ret = co_await mSamplingEvent; !ret) {
-                break;
-            }
-        }
         mLastSampleTime =
             std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch())
                 .count();
-        uint64_t nextTime = MAX_SAMPLE_INTERVAL;
-        SAMPLE_LOG("Sample nodes: {}, time: {}", mSampleNodes.size(), mLastSampleTime);
-        for (auto it = mSampleNodes.begin(); it != mSampleNodes.end();) {
-            auto node = *it;
-            if (node->timeout <= mLastSampleTime) {
-                if (node->status == SampleNode::BlackList) {
-                    mIpEndpoints.erase(node->endpoint);
-                    it = mSampleNodes.erase(it);
-                    continue;
-                }
-                if (node->status != SampleNode::Sampling) {
-                    node->status = SampleNode::Sampling;
-                    mTaskScope.spawn(sample(node, nextTime));
-                }
-            }
-            else {
-                nextTime = std::min(nextTime, node->timeout - mLastSampleTime);
-            }
-            it = std::next(it);
-        }
-        if (nextTime == MAX_SAMPLE_INTERVAL) {
-            nextTime = MIN_SAMPLE_INTERVAL;
+        SAMPLE_LOG("Sample nodes: {}, sampling: {}, time: {}", mSampleNodes.size(), mSamplingCount, mLastSampleTime);
+        mWorkEvent.set(); // Some nodes may be due, the workers pull them
+        // Nothing or only the due ones, the workers wake us on finishing them
+        uint64_t nextTime = mPolicy.minInterval.count();
+        if (mSchedule.nextTimeout() > mLastSampleTime) {
+            nextTime = mSchedule.nextTimeout() - mLastSampleTime;
         }
-        if (mTaskScope.runningTasks() <= 1 && mRandomDiffusion) {
+        // On a timer, so a saturated pool doesn't starve the diffusion
+        if (mRandomDiffusion && mLastSampleTime >= mLastDiffusion + RANDOM_DIFFUSION_INTERVAL) {
+            mLastDiffusion = mLastSampleTime;
             co_await randomDiffusion(nextTime);
         }
         if (mAutoSample) {
             if (mRandomDiffusion) {
-                nextTime = std::min(nextTime, (uint64_t)(RANDOM_DIFFUSION_INTERVAL));
+                auto diffusionTime = mLastDiffusion + RANDOM_DIFFUSION_INTERVAL;
+                nextTime = std::min(nextTime, diffusionTime > mLastSampleTime ? diffusionTime - mLastSampleTime : 0);
             }
             nextTime = std::max(0ULL, nextTime);
             mSampleEvent.clear();
@@ -275,8 +311,74 @@ auto SampleManager::autoSample() -> Task<void> {
     co_return;
 }
 
+auto SampleManager::spawnWorkers() -> void {
+    while (mWorkers < mLimit.config().maxLimit) {
+        mWorkers += 1;
+        mTaskScope.spawn(sampleWorker());
+    }
+}
+
+auto SampleManager::sampleWorker() -> Task<void> {
+    while (mWorkers <= mLimit.config().maxLimit) {
+        auto node = mSamplingCount < mLimit.limit() ? nextDue() : nullptr;
+        if (!node) { // Nothing due or the limit reached, wait for the new node or a free slot
+            mWorkEvent.clear();
+            if (auto ret = co_await mWorkEvent; !ret) {
+                co_return;
+            }
+            continue;
+        }
+        co_await sample(node);
+    }
+    mWorkers -= 1; // Shrinking, quit this worker
+}
+
+auto SampleManager::nextDue() -> std::shared_ptr<SampleNode> {
+    mLastSampleTime =
+        std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    while (auto node = mSchedule.popDue(mLastSampleTime)) {
+        if (node->status == SampleNode::BlackList || mSession.blocklist().contains(node->endpoint.address())) {
+            // Blacklisted by us, or blocked by the session (the flood or the junk)
+            forget(*node);
+            mIpEndpoints.erase(node->endpoint);
+            mSampleNodes.erase(node->endpoint);
+            continue;
+        }
+        node->status = SampleNode::Sampling;
+        return node;
+    }
+    return nullptr;
+}
+
 auto SampleManager::onQuery(const BenObject &object, const IPEndpoint &ipendpoint) -> void {
     if (mAutoSample) {
-        addSampleIpEndpoint(ipendpoint);
+        NodeId id;
+        if (auto &args = object["a"]; args.isDict() && args["id"].isString() && args["id"].toString().size() == 20) {
+            id = NodeId::from(args["id"].toString().data(), 20);
+        }
+        addSampleIpEndpoint(ipendpoint, id);
+    }
+}
+
+auto SampleManager::cover(const SampleNode &node) -> void {
+    if (node.listed && node.id != NodeId {}) {
+        mCoverage.add(node.id, node.successCount > 0 ? KeyspaceCoverage::Sampled : KeyspaceCoverage::Known);
     }
+}
+
+auto SampleManager::uncover(const SampleNode &node) -> void {
+    if (node.listed && node.id != NodeId {}) {
+        mCoverage.remove(node.id, node.successCount > 0 ? KeyspaceCoverage::Sampled : KeyspaceCoverage::Known);
+    }
+}
+
+auto SampleManager::forget(SampleNode &node) -> void {
+    uncover(node);
+    node.listed = false;
+    mSchedule.compact(mSampleNodes.size()); // Don't keep the removed nodes alive in the heap until their timeouts
+}
+
+auto SampleManager::schedule(const std::shared_ptr<SampleNode> &node) -> void {
+    mSchedule.push(node);
+    mSchedule.compact(mSampleNodes.size());
 }
\ No newline at end of file
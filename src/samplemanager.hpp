@@ -1,59 +1,80 @@
 #pragma once
 
 #include "session.hpp"
+#include "coverage.hpp"
+#include "adaptivelimit.hpp"
+#include "samplepolicy.hpp"
+#include "sampleschedule.hpp"
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
 
 class SampleManager {
 public:
-    struct SampleNode {
-        enum Status {
-            NoStatus,
-            Retry,
-            BlackList,
-            Sampling,
-        };
-        IPEndpoint endpoint     = {};
-        uint64_t   timeout      = 0;
-        Status     status       = NoStatus;
-        int        failure      = 0; // weight of failure
-        int        successCount = 0;
-        int        hashsCount   = 0;
+    using SampleNode = ::SampleNode;
 
-        bool operator==(const SampleNode &other) const { return endpoint == other.endpoint; }
+    struct Statistics {
+        size_t queries    = 0; // The sample_infohashes we sent
+        size_t samples    = 0; // The hashes in the replies
+        size_t newHashes  = 0; // The hashes we never seen, told by the callback
+        size_t diffusions = 0; // The lookups of the random diffusion
+        size_t lost       = 0; // The sample_infohashes got no reply
     };
 
 public:
     SampleManager(DhtSession &session);
     ~SampleManager();
-    bool addSampleIpEndpoint(const IPEndpoint &endpoint);
-    void removeSample(const IPEndpoint &endpoint);
+    bool addSampleIpEndpoint(const CompactEndpoint &endpoint, const NodeId &id = {});
+    void removeSample(const CompactEndpoint &endpoint);
     void clearSamples();
     auto getSampleIpEndpoints() const -> std::vector<IPEndpoint>;
     auto getSampleNodes() const -> std::vector<SampleNode>;
     auto excludeIpEndpoints() -> std::vector<IPEndpoint>;
-    void excludeIpEndpoint(const IPEndpoint &endpoint);
+    void excludeIpEndpoint(const CompactEndpoint &endpoint);
     auto start() -> Task<>;
     auto stop() -> Task<>;
     void setOnInfoHashs(std::function<int(const std::vector<InfoHash> &)>);
     void setRandomDiffusion(bool enable);
+    void setConcurrency(const AdaptiveLimit::Config &config); // The range of the workers, adapted by the replies
+    auto concurrency() const -> const AdaptiveLimit &;
+    void setSamplePolicy(const SamplePolicy &policy); // Takes effect on the next result of each node
+    auto samplePolicy() const -> const SamplePolicy &;
+    auto coverage() const -> const KeyspaceCoverage &;
+    auto statistics() const -> const Statistics &;
     void dump();
 
 private:
     auto randomDiffusion(uint64_t &nextTime) -> Task<void>;
     auto autoSample() -> Task<void>;
-    auto sample(std::shared_ptr<SampleNode> node, uint64_t &nextTime) -> Task<>;
+    auto sampleWorker() -> Task<void>;
+    auto spawnWorkers() -> void;
+    auto nextDue() -> std::shared_ptr<SampleNode>; // Pop the next due node, nullptr if none
+    auto sample(std::shared_ptr<SampleNode> node) -> Task<>;
     auto onQuery(const BenObject &object, const IPEndpoint &ipendpoint) -> void;
+    auto cover(const SampleNode &node) -> void;   // Count the node in the coverage, if the id is known
+    auto uncover(const SampleNode &node) -> void;
+    auto forget(SampleNode &node) -> void;        // Uncover the node leaving the list, it may be still sampling
+    auto schedule(const std::shared_ptr<SampleNode> &node) -> void; // Push the node to the heap by its timeout
 
 private:
     TaskScope                                mTaskScope;
     DhtSession                              &mSession;
     uint64_t                                 mLastSampleTime = 0;
+    uint64_t                                 mLastDiffusion  = 0; // The time of the last random diffusion
     Event                                    mSampleEvent;
     bool                                     mAutoSample      = false;
     bool                                     mRandomDiffusion = true;
-    std::set<IPEndpoint>                     mIpEndpoints;
-    std::vector<std::shared_ptr<SampleNode>> mSampleNodes;
-    int                                      mSamplingCount = 0;
-    Event                                    mSamplingEvent;
+    std::unordered_set<CompactEndpoint>      mIpEndpoints;
+    std::unordered_map<CompactEndpoint, std::shared_ptr<SampleNode>> mSampleNodes;
+    SampleSchedule                           mSchedule; // The nodes by the timeouts, then by the yields
+    SamplePolicy                             mPolicy;
+    size_t                                   mSamplingCount = 0;
+    size_t                                   mWorkers       = 0; // The number of the workers in the pool
+    Event                                    mWorkEvent; // The node is due or the worker is free
+    AdaptiveLimit                            mLimit;     // The max nodes sampling at the same time
+    KeyspaceCoverage                         mCoverage; // The regions of the sampled and known nodes, for the diffusion
+    Statistics                               mStatistics;
+    std::mt19937                             mRandom {std::random_device {}()};
 
     std::function<int(const std::vector<InfoHash> &)> mOnInfoHashs;
 };
@@ -0,0 +1,27 @@
+#include "samplepolicy.hpp"
+#include <algorithm>
+#include <cmath>
+
+auto SamplePolicy::nextYield(double yield, size_t newHashes) const -> double {
+    auto alpha = std::clamp(yieldAlpha, 0.0, 1.0);
+    return yield * (1 - alpha) + double(newHashes) * alpha;
+}
+
+auto SamplePolicy::resampleInterval(double yield, std::chrono::seconds interval, size_t samples, size_t num) const
+    -> std::chrono::seconds {
+    auto minSecs = double(std::max<int64_t>(minInterval.count(), 1));
+    auto maxSecs = double(std::max<int64_t>(maxInterval.count(), minInterval.count()));
+    auto ratio   = targetYield > 0 ? std::clamp(yield / targetYield, 0.0, 1.0) : 1.0;
+    auto secs    = minSecs * std::pow(maxSecs / minSecs, 1 - ratio);
+    if (num > samples) { // The node holds more than it returned, the next sample is likely different
+        secs *= 1 - std::clamp(moreWeight, 0.0, 1.0) * (1 - double(samples) / double(num));
+    }
+    secs = std::clamp(secs, minSecs, maxSecs);
+    secs = std::max(secs, double(interval.count())); // The node's BEP-51 interval wins, even over maxInterval
+    return std::chrono::seconds(int64_t(secs));
+}
+
+auto SamplePolicy::retryDelay(int failures) const -> std::chrono::seconds {
+    auto shift = std::clamp(failures - 1, 0, 16);
+    return std::min(retryInterval * (int64_t(1) << shift), maxInterval);
+}
@@ -0,0 +1,62 @@
+/**
+ * @file samplepolicy.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The resample policy of the BEP51 nodes, by the new hashes they yield
+ * @version 0.1
+ * @date 2025-06-06
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include <cstddef>
+#include <chrono>
+
+/**
+ * @brief Decide when to sample a node again, the nodes giving more new hashes are sampled more often and first
+ *
+ * The yield of a node is the moving average of the new hashes per sample. The resample interval goes geometrically
+ * from maxInterval (no yield) to minInterval (targetYield or more), then shortened if the node has more hashes than
+ * it returned (num > samples, the next sample is another random subset), clamped to [minInterval, maxInterval] and
+ * never shorter than the interval the node asked for, even if it is over maxInterval. The failures back off from retryInterval, the node is dropped after maxFailures
+ *
+ */
+struct SamplePolicy {
+    std::chrono::seconds minInterval   = std::chrono::minutes(10);
+    std::chrono::seconds maxInterval   = std::chrono::hours(6);
+    std::chrono::seconds retryInterval = std::chrono::minutes(1); // The first retry after a timeout, doubled each time
+    double yieldAlpha  = 0.3;  // The weight of the last sample in the yield
+    double targetYield = 10;   // The yield sampled at minInterval, the new nodes start at it
+    double moreWeight  = 0.5;  // How much the unreturned part (1 - samples / num) shortens the interval
+    int    maxFailures = 3;    // The timeouts in a row to drop the node
+
+    /**
+     * @brief Update the yield by the result of a sample
+     *
+     * @param yield The current yield
+     * @param newHashes The hashes we never seen in the sample
+     * @return double
+     */
+    auto nextYield(double yield, size_t newHashes) const -> double;
+
+    /**
+     * @brief Get the time to the next sample
+     *
+     * @param yield The updated yield
+     * @param interval The "interval" of the reply
+     * @param samples The number of the hashes in the reply
+     * @param num The "num" of the reply, the hashes the node has
+     * @return std::chrono::seconds At least the interval, at most maxInterval unless the interval is longer
+     */
+    auto resampleInterval(double yield, std::chrono::seconds interval, size_t samples, size_t num) const
+        -> std::chrono::seconds;
+
+    /**
+     * @brief Get the time to retry after the timeouts
+     *
+     * @param failures The timeouts in a row
+     * @return std::chrono::seconds
+     */
+    auto retryDelay(int failures) const -> std::chrono::seconds;
+};
@@ -0,0 +1,59 @@
+#include "sampleschedule.hpp"
+#include <algorithm>
+#include <functional>
+
+#define SCHEDULE_COMPACT_MIN 64 // Don't bother rebuilding the small heaps
+
+static auto isStale(uint64_t timeout, const SampleNode &node) -> bool {
+    return !node.listed || node.timeout != timeout || node.status == SampleNode::Sampling;
+}
+
+auto SampleSchedule::push(const std::shared_ptr<SampleNode> &node) -> void {
+    if (node->listed && node->status != SampleNode::Sampling) {
+        mHeap.push_back({node->timeout, node});
+        std::push_heap(mHeap.begin(), mHeap.end(), std::greater<> {});
+    }
+}
+
+auto SampleSchedule::popDue(uint64_t now) -> std::shared_ptr<SampleNode> {
+    // Move the due nodes to the ready heap, the cost is the number of them, not the size of the list
+    while (!mHeap.empty() && mHeap.front().timeout <= now) {
+        std::pop_heap(mHeap.begin(), mHeap.end(), std::greater<> {});
+        auto [timeout, node] = std::move(mHeap.back());
+        mHeap.pop_back();
+        if (!isStale(timeout, *node)) {
+            mReady.push({node->yield, std::move(node)});
+        }
+    }
+    // The highest yield first, when there are more due nodes than the free workers
+    while (!mReady.empty()) {
+        auto node = mReady.top().node;
+        mReady.pop();
+        if (!node->listed || node->status == SampleNode::Sampling || node->timeout > now) { // Stale
+            continue;
+        }
+        return node;
+    }
+    return nullptr;
+}
+
+auto SampleSchedule::nextTimeout() const -> uint64_t {
+    return mHeap.empty() ? 0 : mHeap.front().timeout;
+}
+
+auto SampleSchedule::compact(size_t live) -> void {
+    if (mHeap.size() <= std::max<size_t>(live * 2, SCHEDULE_COMPACT_MIN)) {
+        return;
+    }
+    std::erase_if(mHeap, [](const Schedule &item) { return isStale(item.timeout, *item.node); });
+    std::make_heap(mHeap.begin(), mHeap.end(), std::greater<> {});
+}
+
+auto SampleSchedule::size() const -> size_t {
+    return mHeap.size();
+}
+
+auto SampleSchedule::clear() -> void {
+    mHeap.clear();
+    mReady = {};
+}
@@ -0,0 +1,109 @@
+/**
+ * @file sampleschedule.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The schedule of the BEP51 nodes, by their timeouts then by their yields
+ * @version 0.1
+ * @date 2025-06-06
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "endpoint.hpp"
+#include "nodeid.hpp"
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <vector>
+
+/**
+ * @brief The BEP51 node in the sample list
+ *
+ */
+struct SampleNode {
+    enum Status {
+        NoStatus,
+        Retry,
+        BlackList,
+        Sampling,
+    };
+    CompactEndpoint endpoint = {};
+    NodeId     id           = {}; // zero if not known yet
+    uint64_t   timeout      = 0;
+    Status     status       = NoStatus;
+    int        failure      = 0; // The timeouts in a row
+    int        successCount = 0;
+    int        hashsCount   = 0;
+    double     yield        = 0; // The moving average of the new hashes per sample, the priority of it
+    bool       listed       = true; // Still in the sample list, counted in the coverage
+
+    bool operator==(const SampleNode &other) const { return endpoint == other.endpoint; }
+};
+
+/**
+ * @brief The min-heap of the node timeouts, the due nodes are popped by the highest yield first
+ *
+ * The entries are deleted lazily, an entry is stale (skipped on pop) if its node left the list, is sampling or got
+ * another timeout since. So popping the due nodes costs the number of them, not the size of the list. The stale
+ * entries of the removed nodes are dropped by compact(), when they are more than twice the live nodes
+ *
+ */
+class SampleSchedule {
+public:
+    /**
+     * @brief Push the node by its current timeout, ignored if it left the list or is sampling
+     *
+     * @param node
+     */
+    auto push(const std::shared_ptr<SampleNode> &node) -> void;
+
+    /**
+     * @brief Pop the next due node at the time now, the highest yield first
+     *
+     * @param now The time in seconds, same clock as the timeouts
+     * @return std::shared_ptr<SampleNode> nullptr if nothing due
+     */
+    auto popDue(uint64_t now) -> std::shared_ptr<SampleNode>;
+
+    /**
+     * @brief Get the earliest timeout in the heap, it may be stale, 0 if empty
+     *
+     * @return uint64_t
+     */
+    auto nextTimeout() const -> uint64_t;
+
+    /**
+     * @brief Drop the stale entries if they are more than twice the live nodes
+     *
+     * @param live The nodes in the list
+     */
+    auto compact(size_t live) -> void;
+
+    /**
+     * @brief Get the number of the entries in the timeout heap, stale ones included
+     *
+     * @return size_t
+     */
+    auto size() const -> size_t;
+
+    auto clear() -> void;
+private:
+    struct Schedule {
+        uint64_t                    timeout;
+        std::shared_ptr<SampleNode> node;
+
+        bool operator>(const Schedule &other) const { return timeout > other.timeout; }
+    };
+
+    // The entry of the due nodes, the highest yield first
+    struct Ready {
+        double                      yield;
+        std::shared_ptr<SampleNode> node;
+
+        bool operator<(const Ready &other) const { return yield < other.yield; }
+    };
+
+    std::vector<Schedule>      mHeap;  // The min heap of the timeouts, kept by std::push_heap / std::pop_heap
+    std::priority_queue<Ready> mReady; // The due nodes waiting for a worker
+};
@@ -0,0 +1,198 @@
+#include "secureid.hpp"
+#include <optional>
+#include <random>
+#include <cstring>
+#include <array>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define CRC32C_X86 1
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+    #else
+        #include <nmmintrin.h>
+        #include <cpuid.h>
+    #endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    #define CRC32C_ARM 1
+    #include <arm_acle.h>
+#endif
+
+inline constexpr uint8_t SECURE_ID_MASK4[] = {0x03, 0x0f, 0x3f, 0xff};
+inline constexpr uint8_t SECURE_ID_MASK6[] = {0x01, 0x03, 0x07, 0x0f, 0x1f, 0x3f, 0x7f, 0xff};
+
+// The reflected polynomial 0x82F63B78
+inline constexpr auto CRC32C_TABLE = []() {
+    std::array<uint32_t, 256> table {};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0);
+        }
+        table[i] = crc;
+    }
+    return table;
+}();
+
+auto crc32cSoftware(std::span<const std::byte> data, uint32_t crc) -> uint32_t {
+    crc = ~crc;
+    for (auto byte : data) {
+        crc = CRC32C_TABLE[(crc ^ uint8_t(byte)) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#if defined(CRC32C_X86)
+static auto cpuHasSse42() -> bool {
+#if defined(_MSC_VER)
+    int info[4] {};
+    ::__cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!::__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (ecx & bit_SSE4_2) != 0;
+#endif
+}
+
+#if !defined(_MSC_VER)
+__attribute__((target("sse4.2")))
+#endif
+static auto crc32cSse42(std::span<const std::byte> data, uint32_t crc) -> uint32_t {
+    auto ptr = reinterpret_cast<const uint8_t *>(data.data());
+    auto n   = data.size();
+    crc = ~crc;
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc64 = crc;
+    for (; n >= 8; n -= 8, ptr += 8) {
+        uint64_t word;
+        ::memcpy(&word, ptr, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = uint32_t(crc64);
+#endif
+    for (; n > 0; --n, ++ptr) {
+        crc = _mm_crc32_u8(crc, *ptr);
+    }
+    return ~crc;
+}
+#endif
+
+#if defined(CRC32C_ARM)
+static auto crc32cArm(std::span<const std::byte> data, uint32_t crc) -> uint32_t {
+    auto ptr = reinterpret_cast<const uint8_t *>(data.data());
+    auto n   = data.size();
+    crc = ~crc;
+    for (; n >= 8; n -= 8, ptr += 8) {
+        uint64_t word;
+        ::memcpy(&word, ptr, 8);
+        crc = ::__crc32cd(crc, word);
+    }
+    for (; n > 0; --n, ++ptr) {
+        crc = ::__crc32cb(crc, *ptr);
+    }
+    return ~crc;
+}
+#endif
+
+auto crc32cHardware() -> bool {
+#if defined(CRC32C_X86)
+    static const bool supported = cpuHasSse42();
+    return supported;
+#elif defined(CRC32C_ARM)
+    return true;
+#else
+    return false;
+#endif
+}
+
+auto crc32c(std::span<const std::byte> data, uint32_t crc) -> uint32_t {
+#if defined(CRC32C_X86)
+    if (crc32cHardware()) {
+        return crc32cSse42(data, crc);
+    }
+#elif defined(CRC32C_ARM)
+    return crc32cArm(data, crc);
+#endif
+    return crc32cSoftware(data, crc);
+}
+
+// The crc of the masked ip with the r, the first 21 bits of the id must match it
+static auto secureIdCrc(const IPAddress &ip, uint8_t r) -> std::optional<uint32_t> {
+    auto bytes = ip.span();
+    std::array<std::byte, 8> masked {};
+    std::span<const uint8_t> mask;
+    if (bytes.size() == 4) {
+        mask = SECURE_ID_MASK4;
+    }
+    else if (bytes.size() == 16) {
+        mask = SECURE_ID_MASK6;
+    }
+    else {
+        return std::nullopt;
+    }
+    for (size_t i = 0; i < mask.size(); ++i) {
+        masked[i] = bytes[i] & std::byte(mask[i]);
+    }
+    masked[0] |= std::byte((r & 0x07) << 5);
+    return crc32c(std::span(masked).first(mask.size()));
+}
+
+auto secureNodeId(const IPAddress &ip, uint8_t r) -> NodeId {
+    static thread_local std::mt19937 gen(std::random_device{}());
+    auto crc = secureIdCrc(ip, r);
+    if (!crc) {
+        return NodeId::rand();
+    }
+    std::array<uint8_t, 20> id;
+    for (auto &byte : id) {
+        byte = uint8_t(gen());
+    }
+    id[0]  = uint8_t(*crc >> 24);
+    id[1]  = uint8_t(*crc >> 16);
+    id[2]  = uint8_t(((*crc >> 8) & 0xf8) | (id[2] & 0x07));
+    id[19] = r;
+    return NodeId::from(id.data(), id.size());
+}
+
+auto secureNodeId(const IPAddress &ip) -> NodeId {
+    static thread_local std::mt19937 gen(std::random_device{}());
+    return secureNodeId(ip, uint8_t(gen()));
+}
+
+auto isSecureNodeId(const NodeId &id, const IPAddress &ip) -> bool {
+    if (isSecureIdExempt(ip)) {
+        return true;
+    }
+    auto view = id.toStringView();
+    auto crc  = secureIdCrc(ip, uint8_t(view[19]));
+    if (!crc) {
+        return false;
+    }
+    return uint8_t(view[0]) == uint8_t(*crc >> 24) &&
+           uint8_t(view[1]) == uint8_t(*crc >> 16) &&
+           (uint8_t(view[2]) & 0xf8) == (uint8_t(*crc >> 8) & 0xf8);
+}
+
+auto isSecureIdExempt(const IPAddress &ip) -> bool {
+    auto bytes = ip.span();
+    auto at    = [&](size_t i) { return uint8_t(bytes[i]); };
+    if (bytes.size() == 4) {
+        return at(0) == 10 ||                              // 10.0.0.0/8
+               at(0) == 127 ||                             // 127.0.0.0/8
+               (at(0) == 172 && (at(1) & 0xf0) == 16) ||   // 172.16.0.0/12
+               (at(0) == 192 && at(1) == 168) ||           // 192.168.0.0/16
+               (at(0) == 169 && at(1) == 254);             // 169.254.0.0/16
+    }
+    if (bytes.size() == 16) {
+        static constexpr std::byte loopback[16] {std::byte {0}, std::byte {0}, std::byte {0}, std::byte {0},
+                                                 std::byte {0}, std::byte {0}, std::byte {0}, std::byte {0},
+                                                 std::byte {0}, std::byte {0}, std::byte {0}, std::byte {0},
+                                                 std::byte {0}, std::byte {0}, std::byte {0}, std::byte {1}};
+        return ::memcmp(bytes.data(), loopback, 16) == 0 || // ::1
+               (at(0) & 0xfe) == 0xfc ||                    // fc00::/7
+               (at(0) == 0xfe && (at(1) & 0xc0) == 0x80);   // fe80::/10
+    }
+    return false;
+}
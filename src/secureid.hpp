@@ -0,0 +1,71 @@
+/**
+ * @file secureid.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The BEP42 secure node id, the id is bound to the ip by the crc32c
+ * @version 0.1
+ * @date 2025-06-06
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "nodeid.hpp"
+#include "net.hpp"
+#include <cstdint>
+#include <span>
+
+// https://www.bittorrent.org/beps/bep_0042.html
+
+/**
+ * @brief The CRC32C (Castagnoli), by the sse4.2 / armv8 crc instructions if the cpu has them
+ *
+ * @param data
+ * @param crc The crc of the previous data, for computing in chunks
+ * @return uint32_t
+ */
+auto crc32c(std::span<const std::byte> data, uint32_t crc = 0) -> uint32_t;
+
+/**
+ * @brief The CRC32C by the table, the fallback of crc32c()
+ *
+ * @param data
+ * @param crc
+ * @return uint32_t
+ */
+auto crc32cSoftware(std::span<const std::byte> data, uint32_t crc = 0) -> uint32_t;
+
+/**
+ * @brief Check the crc32c() uses the hardware instructions
+ *
+ */
+auto crc32cHardware() -> bool;
+
+/**
+ * @brief Generate the secure node id of the ip
+ *
+ * @param ip Our external ip
+ * @param r The random number of the id (the last byte), only the lowest 3 bits are in the crc
+ * @return NodeId
+ */
+auto secureNodeId(const IPAddress &ip, uint8_t r) -> NodeId;
+auto secureNodeId(const IPAddress &ip) -> NodeId;
+
+/**
+ * @brief Check the id is the secure id of the ip, the local network ips are always passed
+ *
+ * @param id
+ * @param ip
+ * @return true
+ * @return false
+ */
+auto isSecureNodeId(const NodeId &id, const IPAddress &ip) -> bool;
+
+/**
+ * @brief Check the ip is exempted from BEP42 (the loopback, private and link local network)
+ *
+ * @param ip
+ * @return true
+ * @return false
+ */
+auto isSecureIdExempt(const IPAddress &ip) -> bool;
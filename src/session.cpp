@@ -8,6 +8,11 @@ using namespace std::literals;
 
 inline constexpr auto MAX_DEPTH = 20;
 inline constexpr auto BFS_UNTIL = 8;
+inline constexpr auto MAX_PEERS_PER_REPLY = 50; // 50 * 6 bytes, keep the reply in a udp packet
+inline constexpr auto SNAPSHOT_MAGIC   = "DHTSNAP\0"sv;
+inline constexpr auto SNAPSHOT_VERSION = 1;
+inline constexpr size_t WARM_START_MIN_ALIVE = KBUCKET_SIZE; // The warm start needs a bucket of the nodes replied
+inline constexpr size_t EXTERNAL_MIN_VOTES = 10; // Adopt the external address after this number of the subnets agree
 
 namespace node_utils {
 
@@ -25,22 +30,74 @@ auto sort(std::vector<NodeEndpoint> &vec, const NodeId &target) {
     vec.erase(std::unique(vec.begin(), vec.end()), vec.end());
 }
 struct AStarNode {
-    const NodeEndpoint *node;
-    int                 g; // The distance from the start node
-    int                 h; // The distance from the target node
-    int                 f; // The total cost
+    uint32_t node; // The index of the node in the visited set
+    int      g;    // The distance from the start node
+    int      h;    // The distance from the target node
+    int      f;    // The total cost
 
-    AStarNode(const NodeEndpoint *node, int g, int h) : node(node), g(g), h(h), f(g + h) {}
+    AStarNode(uint32_t node, int g, int h) : node(node), g(g), h(h), f(g + h) {}
 
     auto operator<=>(const AStarNode &b) const { return f <=> b.f; }
 };
 
 } // namespace node_utils
 
-DhtSession::DhtSession(IoContext &ctxt, const NodeId &id, UdpClient &client)
-    : mCtxt(ctxt), mScope(ctxt), mClient(client), mEndpoint(client.localEndpoint().value()), mId(id),
-      mRoutingTable(id) {
+/**
+ * @brief Peek the transaction id of the raw message without decoding it, only for a cheap check
+ *
+ * @param buffer
+ * @return std::string_view The first "1:t" string in it, empty on not found
+ */
+static auto peekTransactionId(std::span<const std::byte> buffer) -> std::string_view {
+    auto text = std::string_view(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+    auto pos  = text.find("1:t");
+    if (pos == text.npos) {
+        return {};
+    }
+    size_t len = 0;
+    for (pos += 3; pos < text.size() && text[pos] >= '0' && text[pos] <= '9' && len < 256; ++pos) {
+        len = len * 10 + size_t(text[pos] - '0');
+    }
+    if (pos >= text.size() || text[pos] != ':' || text.size() - pos - 1 < len) {
+        return {};
+    }
+    return text.substr(pos + 1, len);
+}
+
+/**
+ * @brief Check the address is a v4-mapped IPv6 one (::ffff:a.b.c.d), from a socket without IPV6_V6ONLY
+ *
+ * @param address
+ * @return true
+ */
+static auto isV4Mapped(const IPAddress &address) -> bool {
+    auto bytes = address.span();
+    if (bytes.size() != 16) {
+        return false;
+    }
+    for (size_t i = 0; i < 10; ++i) {
+        if (bytes[i] != std::byte(0)) {
+            return false;
+        }
+    }
+    return bytes[10] == std::byte(0xFF) && bytes[11] == std::byte(0xFF);
+}
+
+/**
+ * @brief Check the raw message is a query ("y" is "q") without decoding it
+ *
+ * @param buffer
+ * @return true
+ */
+static auto isRawQuery(std::span<const std::byte> buffer) -> bool {
+    auto text = std::string_view(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+    return text.find("1:y1:q") != text.npos;
+}
 
+DhtSession::DhtSession(IoContext &ctxt, const NodeId &id, DatagramTransport &transport)
+    : mCtxt(ctxt), mScope(ctxt), mFamily(transport.localEndpoint().value().family()), mId(id), mRoutingTable(id),
+      mRoutingTable6(id) {
+    addTransport(transport);
 }
 
 DhtSession::~DhtSession() {
@@ -48,42 +105,57 @@ DhtSession::~DhtSession() {
     mScope.wait();
 }
 
+auto DhtSession::addTransport(DatagramTransport &transport) -> bool {
+    auto endpoint = transport.localEndpoint();
+    if (!endpoint) {
+        return false;
+    }
+    auto &slot = endpoint->family() == AF_INET6 ? mTransport6 : mTransport;
+    if (slot) {
+        return false;
+    }
+    slot = &transport;
+    return true;
+}
+
 auto DhtSession::start() -> Task<void> {
-    const auto bootstrapNodes = {std::pair {"router.bittorrent.com", "6881"},
-                                 std::pair {"dht.transmissionbt.com", "6881"},
-                                 std::pair {"router.utorrent.com", "6881"}};
     // Do normal DHT management
     mScope.spawn(cleanupPeersThread());
     mScope.spawn(refreshTableThread());
+    mScope.spawn(verifyTableThread());
     mScope.spawn(randomSearchThread());
+    mBootstrapBegin = now();
+    // Warm start, the restored table is usable, only fill the ranges it missing
+    if (!mSkipBootstrap && totalNodes() >= mWarmStartNodes) {
+        DHT_LOG("Warm start with {} restored nodes, skip the dns seeds", totalNodes());
+        auto begin = now();
+        if (auto res = co_await refillTable(); !res && res.error() == Error::Canceled) {
+            co_return;
+        }
+        // The restored nodes stay in the table until they failed twice, only count the ones replied in the refill
+        if (auto alive = aliveNodes(begin); alive >= WARM_START_MIN_ALIVE) {
+            DHT_LOG("Warm start done, {} nodes, {} replied", totalNodes(), alive);
+            reportProgress(true);
+            co_return;
+        }
+        DHT_LOG("Warm start failed, only {} nodes replied, fallback to bootstrap", aliveNodes(begin));
+    }
     // Begin Bootstrap !
-    if (!mSkipBootstrap) {
-        bool booststraped = false;
-        while (!booststraped) {
-            for (const auto [host, port] : bootstrapNodes) {
-                addrinfo_t hints {.ai_family = mEndpoint.family()};
-                auto       info = co_await AddressInfo::fromHostnameAsync(host, port, hints);
-                if (!info) {
-                    if (info.error() == Error::Canceled) {
-                        co_return;
-                    }
-                    DHT_LOG("Failed to get the addrinfo of {}:{} => {}", host, port, info.error());
-                    continue;
-                }
-                for (auto &endpoint : info->endpoints()) {
-                    if (auto ret = co_await bootstrap(endpoint); ret) {
-                        booststraped = true;
-                        break;
-                    }
-                }
-            }
-            if (!booststraped) {
-                if (!mRetryBootstrap) {
-                    co_return;
-                }
-                DHT_LOG("Failed to bootstrap, retry after 5 minutes");
-                co_await sleep(std::chrono::minutes(5));
-            }
+    while (!mSkipBootstrap) {
+        auto seeds = co_await resolveSeeds();
+        if (!seeds) {
+            co_return;
+        }
+        auto ret = co_await bootstrap(*seeds);
+        if (ret) {
+            break;
+        }
+        if (ret.error() == Error::Canceled || !mRetryBootstrap) {
+            co_return;
+        }
+        DHT_LOG("Failed to bootstrap, retry after 5 minutes");
+        if (auto res = co_await sleep(std::chrono::minutes(5)); !res) {
+            co_return;
         }
     }
     DHT_LOG("All Bootstrap done");
@@ -91,42 +163,136 @@ auto DhtSession::start() -> Task<void> {
 }
 
 auto DhtSession::saveFile(const char *file) const -> void {
-    auto fp = ::fopen(file, "w");
+    // Binary snapshot: magic, version, count, then the records
+    // | id (20) | state (1) | lastSeen (8, unix seconds, little endian) | len (1) | compact endpoint (6 or 18) |
+    auto nodes      = mRoutingTable.rawNodes();
+    auto nodes6     = mRoutingTable6.rawNodes();
+    nodes.insert(nodes.end(), nodes6.begin(), nodes6.end());
+    auto nowSteady  = now();
+    auto nowSystem  = std::chrono::system_clock::now();
+    auto putInt     = [](std::string &buf, uint64_t value, size_t bytes) {
+        for (size_t i = 0; i < bytes; ++i) {
+            buf.push_back(char((value >> (i * 8)) & 0xFF));
+        }
+    };
+    std::string buffer(SNAPSHOT_MAGIC);
+    putInt(buffer, SNAPSHOT_VERSION, 4);
+    putInt(buffer, nodes.size(), 4);
+    for (auto &node : nodes) {
+        auto seen     = nowSystem - std::chrono::duration_cast<std::chrono::system_clock::duration>(nowSteady - node.lastSeen);
+        auto seconds  = std::chrono::duration_cast<std::chrono::seconds>(seen.time_since_epoch()).count();
+        auto endpoint = node.endpoint.ip.toStringView();
+        buffer.append(node.endpoint.id.toStringView());
+        buffer.push_back(char(node.state));
+        putInt(buffer, uint64_t(seconds), 8);
+        buffer.push_back(char(endpoint.size()));
+        buffer.append(endpoint);
+    }
+    auto fp = ::fopen(file, "wb");
     if (!fp) {
         return;
     }
-    for (auto &[id, ip] : mRoutingTable.nodes()) {
-        ::fprintf(fp, "%s-%s\n", id.toHex().c_str(), ip.toString().c_str());
-    }
+    ::fwrite(buffer.data(), 1, buffer.size(), fp);
     ::fclose(fp);
 }
 
 auto DhtSession::loadFile(const char *file) -> void {
-    auto fp = ::fopen(file, "r");
+    auto fp = ::fopen(file, "rb");
     if (!fp) {
         return;
     }
-    char buffer[256] {0};
-    while (::fgets(buffer, sizeof(buffer), fp)) {
-        auto line = std::string_view(buffer);
-        auto dash = line.find('-');
-        if (dash == std::string_view::npos) {
-            continue;
+    std::string content;
+    char buffer[4096];
+    while (auto n = ::fread(buffer, 1, sizeof(buffer), fp)) {
+        content.append(buffer, n);
+    }
+    ::fclose(fp);
+
+    // Restore them as questionable, the verify thread will ping them later, so the table is usable at once
+    auto nowSteady = now();
+    auto nowSystem = std::chrono::system_clock::now();
+    auto restored  = std::vector<Node> {};
+    auto restore   = [&](const NodeId &id, const CompactEndpoint &ip, std::chrono::system_clock::time_point seen) {
+        if (!transportOf(ip.family())) { // The family is not bound this time
+            return;
         }
-        auto id = NodeId::fromHex(line.substr(0, dash));
-        auto ip = IPEndpoint::fromString(line.substr(dash + 1));
-        if (ip && id != NodeId::zero()) {
-            // Spawn task to ping it
-            mScope.spawn([this, id, ip]() -> Task<void> {
-                auto res = co_await ping(*ip);
-                if (res == id) { // Same id, got it
-                    mRoutingTable.updateNode({id, *ip});
-                }
-            });
+        auto age = std::max<std::chrono::system_clock::duration>(nowSystem - seen, {});
+        restored.push_back({
+            .lastSeen = nowSteady - std::chrono::duration_cast<std::chrono::steady_clock::duration>(age),
+            .endpoint = {id, ip},
+            .state    = Node::Questionable,
+        });
+    };
+    auto commit    = [&]() { // Add them in one batch per table, so the table notifies once
+        auto v6 = std::stable_partition(restored.begin(), restored.end(), [](const Node &node) {
+            return node.endpoint.ip.family() != AF_INET6;
+        });
+        mRoutingTable.restoreNodes(std::span(restored.begin(), v6));
+        mRoutingTable6.restoreNodes(std::span(v6, restored.end()));
+    };
+
+    auto view = std::string_view(content);
+    if (!view.starts_with(SNAPSHOT_MAGIC)) { // The legacy text format, id-ip per line
+        size_t count = 0;
+        while (!view.empty()) {
+            auto pos  = view.find('\n');
+            auto line = view.substr(0, pos);
+            view      = pos == std::string_view::npos ? std::string_view {} : view.substr(pos + 1);
+            auto dash = line.find('-');
+            if (dash == std::string_view::npos) {
+                continue;
+            }
+            auto id = NodeId::fromHex(line.substr(0, dash));
+            auto ip = IPEndpoint::fromString(line.substr(dash + 1));
+            if (ip && id != NodeId::zero()) {
+                restore(id, *ip, nowSystem);
+                count += 1;
+            }
         }
-        ::memset(buffer, 0, sizeof(buffer));
+        commit();
+        DHT_LOG("DhtSession::loadFile restore {} nodes from the legacy file {}", count, file);
+        return;
     }
-    ::fclose(fp);
+
+    auto getInt = [&](size_t bytes) -> std::optional<uint64_t> {
+        if (view.size() < bytes) {
+            return std::nullopt;
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; ++i) {
+            value |= uint64_t(uint8_t(view[i])) << (i * 8);
+        }
+        view.remove_prefix(bytes);
+        return value;
+    };
+    view.remove_prefix(SNAPSHOT_MAGIC.size());
+    auto version = getInt(4);
+    auto count   = getInt(4);
+    if (version != SNAPSHOT_VERSION || !count) {
+        DHT_LOG("DhtSession::loadFile unsupported snapshot {}", file);
+        return;
+    }
+    for (uint64_t i = 0; i < *count; ++i) {
+        if (view.size() < 20 + 1) {
+            break;
+        }
+        auto id    = NodeId::from(view.data(), 20);
+        auto state = uint8_t(view[20]);
+        view.remove_prefix(20 + 1);
+        auto seen  = getInt(8);
+        auto len   = getInt(1);
+        if (!seen || !len || view.size() < *len) {
+            break;
+        }
+        auto raw   = CompactEndpoint::fromBytes(view.substr(0, *len));
+        view.remove_prefix(*len);
+        if (state == Node::Bad || !raw || id == NodeId::zero()) {
+            continue;
+        }
+        restore(id, *raw, std::chrono::system_clock::time_point(std::chrono::seconds(*seen)));
+    }
+    commit();
+    DHT_LOG("DhtSession::loadFile restore {} nodes from the snapshot {}", totalNodes(), file);
 }
 
 auto DhtSession::onQuery(const BenObject &message, const IPEndpoint &from) -> IoTask<void> {
@@ -141,10 +307,12 @@ auto DhtSession::onQuery(const BenObject &message, const IPEndpoint &from) -> Io
             DHT_LOG("Invalid ping query");
             co_return {};
         }
-        mRoutingTable.updateNode({ping->id, from});
+        routingTable(from.family()).updateNode({ping->id, from});
         auto reply   = PingReply {.transId = ping->transId, .id = mId};
-        auto encoded = reply.toMessage().encode();
-        if (auto res = co_await mClient.sendto(ilias::makeBuffer(encoded), from); !res) {
+        auto msg     = reply.toMessage();
+        fillMessageExternalEndpoint(msg, from);
+        auto encoded = msg.encode();
+        if (auto res = co_await transportOf(from.family())->sendto(ilias::makeBuffer(encoded), from); !res) {
             co_return unexpected(res.error());
         }
         co_return {};
@@ -155,14 +323,16 @@ auto DhtSession::onQuery(const BenObject &message, const IPEndpoint &from) -> Io
             DHT_LOG("Invalid find node query");
             co_return {};
         }
-        auto nodes = mRoutingTable.findClosestNodes(find->targetId, 8);
-        mRoutingTable.updateNode({find->id, from});
+        auto nodes = replyNodes(find->targetId, find->want, from);
+        routingTable(from.family()).updateNode({find->id, from});
         if (nodes.empty()) {
             DHT_LOG("No nodes found for {}", find->targetId);
         }
         auto reply   = FindNodeReply {.transId = find->transId, .id = mId, .nodes = nodes};
-        auto encoded = reply.toMessage().encode();
-        if (auto res = co_await mClient.sendto(ilias::makeBuffer(encoded), from); !res) {
+        auto msg     = reply.toMessage();
+        fillMessageExternalEndpoint(msg, from);
+        auto encoded = msg.encode();
+        if (auto res = co_await transportOf(from.family())->sendto(ilias::makeBuffer(encoded), from); !res) {
             co_return unexpected(res.error());
         }
         co_return {};
@@ -173,52 +343,60 @@ auto DhtSession::onQuery(const BenObject &message, const IPEndpoint &from) -> Io
             DHT_LOG("Invalid get peers query");
             co_return {};
         }
-        mRoutingTable.updateNode({getPeers->id, from});
-        auto nodes = mRoutingTable.findClosestNodes(getPeers->infoHash, 8);
+        routingTable(from.family()).updateNode({getPeers->id, from});
+        auto nodes = replyNodes(getPeers->infoHash, getPeers->want, from);
         if (nodes.empty()) {
             DHT_LOG("No nodes found for {}", getPeers->infoHash);
         }
         auto reply = GetPeersReply {.transId = getPeers->transId,
                                     .id      = mId,
-                                    .token   = "token", // TODO: Generate a token
+                                    .token   = mTokens.generate(from.address()),
                                     .nodes   = nodes};
-        // Find the peers and push them to the reply
-        auto it = mPeers.find(getPeers->infoHash);
-        if (it != mPeers.end()) {
-            auto &[_, set] = *it;
-            for (auto &peer : set) {
-                reply.values.push_back(peer);
-                if (reply.values.size() >= 100) { // TOO MANY PEERS
-                    break;
-                }
-            }
-            // If bigger than 8 random peers, send the reply
-            if (reply.values.size() >= KBUCKET_SIZE) {
-                std::shuffle(reply.values.begin(), reply.values.end(), mRandom);
+        // Pick the random peers to the reply, keep it in a udp packet
+        mPeers.pick(getPeers->infoHash, MAX_PEERS_PER_REPLY, mRandom, reply.values, getPeers->noseed);
+        if (getPeers->scrape) {
+            PeerStore::ScrapeFilter seeds, peers;
+            if (mPeers.scrape(getPeers->infoHash, seeds, peers)) {
+                reply.bfsd.resize(256);
+                reply.bfpe.resize(256);
+                seeds.toBytes(std::as_writable_bytes(std::span(reply.bfsd)).first<256>());
+                peers.toBytes(std::as_writable_bytes(std::span(reply.bfpe)).first<256>());
             }
         }
-        auto encoded = reply.toMessage().encode();
-        if (auto res = co_await mClient.sendto(ilias::makeBuffer(encoded), from); !res) {
+        auto msg     = reply.toMessage();
+        fillMessageExternalEndpoint(msg, from);
+        auto encoded = msg.encode();
+        if (auto res = co_await transportOf(from.family())->sendto(ilias::makeBuffer(encoded), from); !res) {
             co_return unexpected(res.error());
         }
         co_return {};
     }
     else if (query == "announce_peer") {
-        // TODO: Record it
         auto announce = AnnouncePeerQuery::fromMessage(message);
         if (!announce) {
             DHT_LOG("Invalid announce peer query");
             co_return {};
         }
+        if (!mTokens.verify(from.address(), announce->token)) { // Not from our get_peers, don't record or fetch it
+            DHT_LOG("Bad token of announce peer infoHash {} from {}", announce->infoHash, from);
+            auto error   = ErrorReply {.transId = announce->transId, .errorCode = 203, .error = "Bad Token"};
+            auto encoded = error.toMessage().encode();
+            if (auto res = co_await transportOf(from.family())->sendto(ilias::makeBuffer(encoded), from); !res) {
+                co_return unexpected(res.error());
+            }
+            co_return {};
+        }
         DHT_LOG("Announce peer infoHash {} from {}", announce->infoHash, from);
         if (mOnAnnouncePeer) {
             mOnAnnouncePeer(announce->infoHash, from);
         }
-        mPeers[announce->infoHash].insert(from);
-        mRoutingTable.updateNode({announce->id, from});
+        mPeers.announce(announce->infoHash, from, announce->seed);
+        routingTable(from.family()).updateNode({announce->id, from});
         auto reply   = AnnouncePeerReply {.transId = announce->transId, .id = mId};
-        auto encoded = reply.toMessage().encode();
-        if (auto res = co_await mClient.sendto(ilias::makeBuffer(encoded), from); !res) {
+        auto msg     = reply.toMessage();
+        fillMessageExternalEndpoint(msg, from);
+        auto encoded = msg.encode();
+        if (auto res = co_await transportOf(from.family())->sendto(ilias::makeBuffer(encoded), from); !res) {
             co_return unexpected(res.error());
         }
         co_return {};
@@ -227,7 +405,7 @@ auto DhtSession::onQuery(const BenObject &message, const IPEndpoint &from) -> Io
     DHT_LOG("Unknown query {}", query);
     auto error = ErrorReply {.transId = getMessageTransactionId(message), .errorCode = 204, .error = "Method Unknown"};
     auto encoded = error.toMessage().encode();
-    if (auto res = co_await mClient.sendto(makeBuffer(encoded), from); !res) {
+    if (auto res = co_await transportOf(from.family())->sendto(makeBuffer(encoded), from); !res) {
         co_return unexpected(res.error());
     }
     co_return {};
@@ -235,6 +413,10 @@ auto DhtSession::onQuery(const BenObject &message, const IPEndpoint &from) -> Io
 
 auto DhtSession::sendKrpc(const BenObject &message, const IPEndpoint &endpoint)
     -> IoTask<std::pair<BenObject, IPEndpoint>> {
+    auto transport = transportOf(endpoint.family());
+    if (!transport) { // No socket of the family
+        co_return unexpected(Error::OperationNotSupported);
+    }
     auto content            = message.encode();
     auto id                 = getMessageTransactionId(message);
     auto [sender, receiver] = oneshot::channel<std::pair<BenObject, IPEndpoint>>();
@@ -249,7 +431,8 @@ auto DhtSession::sendKrpc(const BenObject &message, const IPEndpoint &endpoint)
 #endif
     }
     // Send it
-    if (auto res = co_await mClient.sendto(makeBuffer(content), endpoint); !res) {
+    mStatistics.queriesSent += 1;
+    if (auto res = co_await transport->sendto(makeBuffer(content), endpoint); !res) {
         co_return unexpected(res.error());
     }
     auto res = co_await (receiver.recv() | setTimeout(mTimeout));
@@ -262,19 +445,22 @@ auto DhtSession::sendKrpc(const BenObject &message, const IPEndpoint &endpoint)
 
 auto DhtSession::findNode(const NodeId &target, const IPEndpoint &endpoint, FindAlgo algo)
     -> IoTask<std::vector<NodeEndpoint>> {
-    FindNodeEnv env;
+    FindNodeEnv                       env;
+    Result<std::vector<NodeEndpoint>> res = unexpected(Error::Unknown);
     if (algo == FindAlgo::AStar) {
-        co_return co_await aStarFind(target, std::nullopt, endpoint, env);
+        res = co_await aStarFind(target, std::nullopt, endpoint, env);
     }
     else if (algo == FindAlgo::BfsDfs) {
-        co_return co_await bfsDfsFind(target, std::nullopt, endpoint, 0, env);
+        res = co_await bfsDfsFind(target, std::nullopt, endpoint, 0, env);
     }
-    co_return unexpected(Error::Unknown);
+    mStatistics.lookups    += 1;
+    mStatistics.lookupHops += env.hops;
+    co_return res;
 }
 
 auto DhtSession::findNode(const NodeId &target, FindAlgo algo) -> IoTask<std::vector<NodeEndpoint>> {
     FindNodeEnv                                    env;
-    std::vector<NodeEndpoint>                      nodes = mRoutingTable.findClosestNodes(target, 3);
+    std::vector<NodeEndpoint>                      nodes = findStartNodes(target, 3);
     std::vector<IoTask<std::vector<NodeEndpoint>>> tasks;
     for (const auto &node : nodes) {
         if (algo == FindAlgo::AStar) {
@@ -294,6 +480,8 @@ auto DhtSession::findNode(const NodeId &target, FindAlgo algo) -> IoTask<std::ve
             res.insert(res.end(), v->begin(), v->end());
         }
     }
+    mStatistics.lookups    += 1;
+    mStatistics.lookupHops += env.hops;
     // Sort it by distance
     node_utils::sort(res, target);
     // Trim if exceeds 8
@@ -321,17 +509,74 @@ auto DhtSession::ping(const IPEndpoint &nodeIp) -> IoTask<NodeId> {
 }
 
 auto DhtSession::routingTable() const -> const RoutingTable & {
-    return mRoutingTable;
+    return routingTable(mFamily);
 }
 
 auto DhtSession::routingTable() -> RoutingTable & {
-    return mRoutingTable;
+    return routingTable(mFamily);
+}
+
+auto DhtSession::routingTable(int family) const -> const RoutingTable & {
+    return family == AF_INET6 ? mRoutingTable6 : mRoutingTable;
+}
+
+auto DhtSession::routingTable(int family) -> RoutingTable & {
+    return family == AF_INET6 ? mRoutingTable6 : mRoutingTable;
+}
+
+auto DhtSession::findClosestNodes(const NodeId &target, size_t max) const -> std::vector<NodeEndpoint> {
+    std::vector<NodeEndpoint> nodes;
+    if (mTransport) {
+        nodes = mRoutingTable.findClosestNodes(target, max);
+    }
+    if (mTransport6) {
+        auto nodes6 = mRoutingTable6.findClosestNodes(target, max);
+        nodes.insert(nodes.end(), nodes6.begin(), nodes6.end());
+        node_utils::sort(nodes, target);
+    }
+    return nodes;
+}
+
+auto DhtSession::findStartNodes(const NodeId &target, size_t max) const -> std::vector<NodeEndpoint> {
+    auto nodes  = findClosestNodes(target, max);
+    auto cached = mContacts.findClosestNodes(target, max);
+    nodes.insert(nodes.end(), cached.begin(), cached.end());
+    node_utils::sort(nodes, target);
+    if (nodes.size() > max) {
+        nodes.resize(max);
+    }
+    return nodes;
 }
 
-auto DhtSession::peers() const -> const std::map<InfoHash, std::set<IPEndpoint>> & {
+auto DhtSession::peers() const -> const PeerStore & {
     return mPeers;
 }
 
+auto DhtSession::id() const -> const NodeId & {
+    return mId;
+}
+
+auto DhtSession::externalAddress() const -> std::optional<IPEndpoint> {
+    return mExternalAddress;
+}
+
+auto DhtSession::setAdoptSecureId(bool enable) -> void {
+    mAdoptSecureId = enable;
+}
+
+auto DhtSession::setSecureIdPolicy(RoutingTable::SecureIdPolicy policy) -> void {
+    mRoutingTable.setSecureIdPolicy(policy);
+    mRoutingTable6.setSecureIdPolicy(policy);
+}
+
+auto DhtSession::blocklist() -> Blocklist & {
+    return mBlocklist;
+}
+
+auto DhtSession::contacts() -> ContactCache & {
+    return mContacts;
+}
+
 auto DhtSession::setOnAnouncePeer(std::function<void(const InfoHash &hash, const IPEndpoint &peer)> callback) -> void {
     mOnAnnouncePeer = std::move(callback);
 }
@@ -340,18 +585,67 @@ auto DhtSession::setOnQuery(std::function<void(const BenObject &object, const IP
     mOnQuery = std::move(callback);
 }
 
+auto DhtSession::setOnBootstrapProgress(std::function<void(const BootstrapProgress &progress)> callback) -> void {
+    mOnBootstrapProgress = std::move(callback);
+}
+
 auto DhtSession::setSkipBootstrap(bool skip) -> void {
     mSkipBootstrap = skip;
 }
 
+auto DhtSession::addBootstrapEndpoint(const IPEndpoint &endpoint) -> void {
+    mBootstrapEndpoints.push_back(endpoint);
+}
+
+auto DhtSession::setWarmStartThreshold(size_t nodes) -> void {
+    mWarmStartNodes = nodes;
+}
+
+auto DhtSession::setDnsSeeds(bool enable) -> void {
+    mDnsSeeds = enable;
+}
+
+auto DhtSession::setRateLimit(std::optional<RateLimiter::Config> config) -> void {
+    mLimiter.reset();
+    if (config) {
+        mLimiter.emplace(mBlocklist, *config);
+        mLimiter->setClock(mClock);
+    }
+}
+
+auto DhtSession::setClock(std::function<std::chrono::steady_clock::time_point()> clock) -> void {
+    mClock = std::move(clock);
+    mRoutingTable.setClock(mClock);
+    mRoutingTable6.setClock(mClock);
+    mContacts.setClock(mClock);
+    mPeers.setClock(mClock);
+    mTokens.setClock(mClock);
+    mBlocklist.setClock(mClock);
+    if (mLimiter) {
+        mLimiter->setClock(mClock);
+    }
+}
+
+auto DhtSession::now() const -> std::chrono::steady_clock::time_point {
+    return mClock();
+}
+
+auto DhtSession::statistics() const -> const Statistics & {
+    return mStatistics;
+}
+
 auto DhtSession::setRandomSearch(bool enable) -> void {
     mRandomSearch = enable;
 }
 
-auto DhtSession::sampleInfoHashes(const IPEndpoint &nodeIp, NodeId target) -> IoTask<SampleInfoHashesReply> {
-    SampleInfoHashesQuery query {.transId = allocateTransactionId(), .id = mId, .target = target};
+auto DhtSession::sampleInfoHashes(const IPEndpoint &nodeIp, NodeId target, std::optional<NodeId> id)
+    -> IoTask<SampleInfoHashesReply> {
+    SampleInfoHashesQuery query {.transId = allocateTransactionId(), .id = mId, .target = target, .want = defaultWant()};
     auto                  res = co_await sendKrpc(query.toMessage(), nodeIp);
     if (!res) {
+        if (id) {
+            mContacts.remove({*id, nodeIp});
+        }
         co_return unexpected(res.error());
     }
     auto &[message, from] = *res;
@@ -362,17 +656,24 @@ auto DhtSession::sampleInfoHashes(const IPEndpoint &nodeIp, NodeId target) -> Io
     if (!reply) {
         co_return unexpected(KrpcError::BadReply);
     }
+    addContact({reply->id, from});
     co_return *reply;
 }
 
-auto DhtSession::getPeers(const IPEndpoint &endpoint, const InfoHash &target) -> IoTask<GetPeersReply> {
+auto DhtSession::getPeers(const IPEndpoint &endpoint, const InfoHash &target, bool scrape, std::optional<NodeId> id)
+    -> IoTask<GetPeersReply> {
     GetPeersQuery query {
         .transId  = allocateTransactionId(),
         .id       = mId,
         .infoHash = target,
+        .scrape   = scrape,
+        .want     = defaultWant(),
     };
     auto res = co_await sendKrpc(query.toMessage(), endpoint);
     if (!res) {
+        if (id) {
+            mContacts.remove({*id, endpoint});
+        }
         co_return unexpected(res.error());
     }
     auto &[message, from] = *res;
@@ -383,27 +684,30 @@ auto DhtSession::getPeers(const IPEndpoint &endpoint, const InfoHash &target) ->
     if (!reply) {
         co_return unexpected(KrpcError::BadReply);
     }
+    addContact({reply->id, from});
     co_return *reply;
 }
 
-auto DhtSession::aStarFind(const NodeId &target, std::optional<NodeId> id, const IPEndpoint &endpoint, FindNodeEnv &env,
+auto DhtSession::aStarFind(const NodeId &target, std::optional<NodeId> id, const CompactEndpoint &endpoint, FindNodeEnv &env,
                            int max_parallel, int max_step) -> IoTask<std::vector<NodeEndpoint>> {
     std::priority_queue<node_utils::AStarNode> openSet;
-    auto item = env.visited.emplace_hint(env.visited.end(), NodeEndpoint {NodeId {}, endpoint});
-    openSet.emplace(node_utils::AStarNode(&(*item), 0, target.distanceExp(mId)));
+    auto [start, _] = env.visited.insert(NodeEndpoint {NodeId {}, endpoint});
+    openSet.emplace(node_utils::AStarNode(start, 0, target.distanceExp(mId)));
     int                                            step = std::max(max_step, 1);
     std::vector<IoTask<std::vector<NodeEndpoint>>> tasks;
     std::vector<int>                               tasksCost;
     while (!openSet.empty() && step-- > 0) {
         int parallel = std::min(max_parallel, 10);
         while (!openSet.empty() && parallel-- > 0) {
-            auto [nodeEndpoint, _1, _2, cost] = openSet.top();
-            DHT_LOG("Find node {} by node endpoint {} {}", target, nodeEndpoint->id, nodeEndpoint->ip);
+            auto [index, g, _2, cost] = openSet.top();
+            auto nodeEndpoint         = env.visited[index];
+            DHT_LOG("Find node {} by node endpoint {} {}", target, nodeEndpoint.id, nodeEndpoint.ip);
             openSet.pop();
+            env.hops = std::max<size_t>(env.hops, g + 1);
             tasksCost.push_back(cost);
             tasks.emplace_back(findNearNodes(
-                target, nodeEndpoint->id == NodeId {} ? std::optional<NodeId>() : std::optional(nodeEndpoint->id),
-                nodeEndpoint->ip, env));
+                target, nodeEndpoint.id == NodeId {} ? std::optional<NodeId>() : std::optional(nodeEndpoint.id),
+                nodeEndpoint.ip, env));
         }
         auto nearNodes = co_await whenAll(std::move(tasks));
         for (int i = 0; i < nearNodes.size(); ++i) {
@@ -415,11 +719,11 @@ auto DhtSession::aStarFind(const NodeId &target, std::optional<NodeId> id, const
                     env.closest = node;
                     co_return nearNodes[i];
                 }
-                if (env.visited.find({node.id, node.ip}) != env.visited.end()) {
+                auto [index, inserted] = env.visited.insert(node);
+                if (!inserted) {
                     continue;
                 }
-                auto item = env.visited.emplace_hint(env.visited.end(), node);
-                openSet.emplace(&(*item), tasksCost[i] + 1, target.distanceExp(node.id));
+                openSet.emplace(index, tasksCost[i] + 1, target.distanceExp(node.id));
                 if (!env.closest.has_value() || target.distance(node.id) < target.distance(env.closest.value().id)) {
                     env.closest = node;
                 }
@@ -429,7 +733,7 @@ auto DhtSession::aStarFind(const NodeId &target, std::optional<NodeId> id, const
         tasksCost.clear();
     }
     std::vector<NodeEndpoint> res;
-    for (auto nodeEndpointer : env.visited) {
+    for (auto &nodeEndpointer : env.visited.nodes()) {
         if (nodeEndpointer.id != NodeId {}) {
             res.push_back(nodeEndpointer);
         }
@@ -445,13 +749,14 @@ auto DhtSession::aStarFind(const NodeId &target, std::optional<NodeId> id, const
     co_return unexpected(KrpcError::TargetNotFound);
 }
 
-auto DhtSession::findNearNodes(const NodeId &target, std::optional<NodeId> id, const IPEndpoint &endpoint,
+auto DhtSession::findNearNodes(const NodeId &target, std::optional<NodeId> id, CompactEndpoint endpoint,
                                FindNodeEnv &env) -> IoTask<std::vector<NodeEndpoint>> {
-    FindNodeQuery query {.transId = allocateTransactionId(), .id = mId, .targetId = target};
-    auto          res = co_await sendKrpc(query.toMessage(), endpoint);
+    FindNodeQuery query {.transId = allocateTransactionId(), .id = mId, .targetId = target, .want = defaultWant()};
+    auto          res = co_await sendKrpc(query.toMessage(), endpoint.toEndpoint());
     if (!res) {
         if (id) { // If the id is known, try to mark it as bad node in routing table
-            mRoutingTable.markBadNode({*id, endpoint});
+            routingTable(endpoint.family()).markBadNode({*id, endpoint});
+            mContacts.remove({*id, endpoint});
         }
         co_return unexpected(res.error());
     }
@@ -465,8 +770,12 @@ auto DhtSession::findNearNodes(const NodeId &target, std::optional<NodeId> id, c
         co_return unexpected(KrpcError::BadReply);
     }
     auto reply = std::move(*replyParsed);
-    mRoutingTable.updateNode({reply.id, from}); // This node give us reply, add it to routing table
-    env.visited.insert({reply.id, from});       // Mark as visited
+    routingTable(from.family()).updateNode({reply.id, from}); // This node give us reply, add it to routing table
+    addContact({reply.id, from});
+    env.visited.insert({reply.id, from});                      // Mark as visited
+
+    // Drop the nodes of the family we can't reach
+    std::erase_if(reply.nodes, [this](const NodeEndpoint &node) { return !transportOf(node.ip.family()); });
 
     // Sort by distance, first is the closest
     node_utils::sort(reply.nodes, target);
@@ -478,18 +787,20 @@ auto DhtSession::findNearNodes(const NodeId &target, std::optional<NodeId> id, c
     co_return reply.nodes;
 }
 
-auto DhtSession::bfsDfsFind(const NodeId &target, std::optional<NodeId> id, const IPEndpoint &endpoint, size_t depth,
+auto DhtSession::bfsDfsFind(const NodeId &target, std::optional<NodeId> id, const CompactEndpoint &endpoint, size_t depth,
                             FindNodeEnv &env) -> IoTask<std::vector<NodeEndpoint>> {
     if (depth > MAX_DEPTH) { // MAX_DEPTH ?
         DHT_LOG("Max depth reached, target {}, endpoint {}, depth {}", target, endpoint, depth);
         co_return unexpected(Error::Unknown);
     }
     DHT_LOG("Find node {}, endpoint {}, depth {}", target, endpoint, depth);
-    FindNodeQuery query {.transId = allocateTransactionId(), .id = mId, .targetId = target};
-    auto          res = co_await sendKrpc(query.toMessage(), endpoint);
+    env.hops = std::max(env.hops, depth + 1);
+    FindNodeQuery query {.transId = allocateTransactionId(), .id = mId, .targetId = target, .want = defaultWant()};
+    auto          res = co_await sendKrpc(query.toMessage(), endpoint.toEndpoint());
     if (!res) {
         if (id) { // If the id is known, try to mark it as bad node in routing table
-            mRoutingTable.markBadNode({*id, endpoint});
+            routingTable(endpoint.family()).markBadNode({*id, endpoint});
+            mContacts.remove({*id, endpoint});
         }
         co_return unexpected(res.error());
     }
@@ -503,8 +814,12 @@ auto DhtSession::bfsDfsFind(const NodeId &target, std::optional<NodeId> id, cons
         co_return unexpected(KrpcError::BadReply);
     }
     auto reply = std::move(*replyParsed);
-    mRoutingTable.updateNode({reply.id, from}); // This node give us reply, add it to routing table
-    env.visited.insert({reply.id, from});       // Mark as visited
+    routingTable(from.family()).updateNode({reply.id, from}); // This node give us reply, add it to routing table
+    addContact({reply.id, from});
+    env.visited.insert({reply.id, from});                      // Mark as visited
+
+    // Drop the nodes of the family we can't reach
+    std::erase_if(reply.nodes, [this](const NodeEndpoint &node) { return !transportOf(node.ip.family()); });
 
     // Sort by distance, first is the closest
     node_utils::sort(reply.nodes, target);
@@ -543,8 +858,7 @@ auto DhtSession::bfsDfsFind(const NodeId &target, std::optional<NodeId> id, cons
     std::vector<NodeEndpoint> result;
     auto                      scope = co_await TaskScope::make();
     for (auto &[id, ip] : vec) {
-        auto [it, emplace] = env.visited.emplace(id, ip);
-        if (!emplace) { // Already visited
+        if (!env.visited.insert({id, ip}).second) { // Already visited
             // DHT_LOG("Node {} is already visited", id);
             continue; // Skip it
         }
@@ -588,31 +902,146 @@ auto DhtSession::bfsDfsFind(const NodeId &target, std::optional<NodeId> id, cons
     co_return result;
 }
 
-auto DhtSession::bootstrap(const IPEndpoint &nodeIp) -> IoTask<void> {
-    DHT_LOG("Bootstrap to {}", nodeIp);
-    auto res = co_await findNode(mId, nodeIp);
-    if (!res) {
-        DHT_LOG("Bootstrap to {} failed: {}", nodeIp, res.error());
+auto DhtSession::resolveSeeds() -> IoTask<std::vector<IPEndpoint>> {
+    const auto bootstrapNodes = {std::pair {"router.bittorrent.com", "6881"},
+                                 std::pair {"dht.transmissionbt.com", "6881"},
+                                 std::pair {"router.utorrent.com", "6881"}};
+    std::vector<IPEndpoint> seeds = mBootstrapEndpoints;
+    bool                    canceled = false;
+    auto                    scope = co_await TaskScope::make();
+    std::vector<int>        families;
+    if (mTransport) {
+        families.push_back(AF_INET);
+    }
+    if (mTransport6) {
+        families.push_back(AF_INET6);
+    }
+    for (const auto &node : bootstrapNodes) {
+        if (!mDnsSeeds) {
+            break;
+        }
+        for (auto family : families) { // Resolve the seeds of each family we have a transport of
+            scope.spawn([&, node, family]() -> Task<void> {
+                auto [host, port] = node;
+                addrinfo_t hints {.ai_family = family};
+                auto       info = co_await AddressInfo::fromHostnameAsync(host, port, hints);
+                if (!info) {
+                    canceled = canceled || info.error() == Error::Canceled;
+                    DHT_LOG("Failed to get the addrinfo of {}:{} => {}", host, port, info.error());
+                    co_return;
+                }
+                for (auto &endpoint : info->endpoints()) {
+                    seeds.push_back(endpoint);
+                }
+            });
+        }
+    }
+    co_await scope; // Join all the resolves
+    if (canceled) {
+        co_return unexpected(Error::Canceled);
+    }
+    std::sort(seeds.begin(), seeds.end());
+    seeds.erase(std::unique(seeds.begin(), seeds.end()), seeds.end());
+    co_return seeds;
+}
+
+auto DhtSession::bootstrap(const std::vector<IPEndpoint> &seeds) -> IoTask<void> {
+    DHT_LOG("Bootstrap from {} seeds", seeds.size());
+    bool canceled = false;
+    auto scope = co_await TaskScope::make();
+    for (const auto &seed : seeds) {
+        // Ask all the seeds for the nodes near us at the same time
+        scope.spawn([&, seed]() -> Task<void> {
+            auto res = co_await findNode(mId, seed);
+            if (!res) {
+                canceled = canceled || res.error() == Error::Canceled;
+                DHT_LOG("Bootstrap to {} failed: {}", seed, res.error());
+                co_return;
+            }
+            DHT_LOG("Bootstrap to {} success", seed);
+            reportProgress(false);
+        });
+    }
+    co_await scope; // Join all the seeds
+    if (canceled) {
+        co_return unexpected(Error::Canceled);
+    }
+    if (totalNodes() == 0) {
+        DHT_LOG("Bootstrap failed, no seed replied");
+        co_return unexpected(Error::Unknown);
+    }
+    // Walkthrough the whole address space
+    if (auto res = co_await refillTable(false); !res) {
         co_return unexpected(res.error());
     }
-    for (size_t i = 10; i < 150; i += 20) {
-        // Try 10, 40, 60, 80, 100, 120, 140, 150, walkthrough the whole address space
-        auto res = co_await findNode(mId.randWithDistance(i));
+    for (auto table : tables()) {
+        table->dumpInfo();
+    }
+    reportProgress(true);
+    DHT_LOG("Bootstrap done, {} nodes", totalNodes());
+    co_return {};
+}
+
+auto DhtSession::refillTable(bool onlyMissing) -> IoTask<void> {
+    // Try 10, 30, 50, 70, 90, 110, 130, each range walks in parallel
+    bool canceled = false;
+    auto scope = co_await TaskScope::make();
+    auto walk  = [&, this](NodeId target) -> Task<void> {
+        auto res = co_await findNode(target);
         if (!res) {
-            DHT_LOG("Bootstrap to {} failed: {}", nodeIp, res.error());
-            co_return unexpected(res.error());
+            canceled = canceled || res.error() == Error::Canceled;
+            co_return;
         }
-        if (mRoutingTable.size() >= 100) {
-            DHT_LOG("Encough nodes, done it !");
-            break;
+        reportProgress(false);
+    };
+    for (size_t i = 10; i < 150; i += 20) {
+        size_t count = 0;
+        for (auto table : tables()) {
+            for (size_t idx = i; idx < i + 20; ++idx) {
+                count += table->bucketSize(idx);
+            }
+        }
+        if (!onlyMissing || count == 0) {
+            scope.spawn(walk(mId.randWithDistance(i)));
         }
     }
-    mRoutingTable.dumpInfo();
-    DHT_LOG("Bootstrap to {} success", nodeIp);
+    scope.spawn(walk(mId)); // Always refresh the nodes near us
+    co_await scope;
+    if (canceled) {
+        co_return unexpected(Error::Canceled);
+    }
     co_return {};
 }
 
+auto DhtSession::reportProgress(bool done) -> void {
+    if (!mOnBootstrapProgress) {
+        return;
+    }
+    BootstrapProgress progress {
+        .elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now() - mBootstrapBegin),
+        .nodes   = totalNodes(),
+        .buckets = {},
+        .done    = done,
+    };
+    for (auto table : tables()) {
+        for (size_t i = 0; i < progress.buckets.size(); ++i) {
+            progress.buckets[i] += table->bucketSize(i);
+        }
+    }
+    mOnBootstrapProgress(progress);
+}
+
 auto DhtSession::processUdp(std::span<const std::byte> buffer, const IPEndpoint &endpoint) -> Task<void> {
+    // Drop the flood before spending anything on it, except the replies of our queries (a guessed id still gets parsed)
+    auto address  = endpoint.address();
+    auto tid      = peekTransactionId(buffer);
+    auto expected = !tid.empty() && mPendingQueries.contains(std::string(tid)) && !isRawQuery(buffer);
+    if (!transportOf(endpoint.family()) || isV4Mapped(address) || mBlocklist.contains(address) ||
+        (!expected && mLimiter && !mLimiter->allow(address))) {
+        mStatistics.datagramsDropped += 1;
+        co_return;
+    }
+
     // Try parse to BenObject
     auto message = BenObject::decode(buffer);
     if (message.isNull()) {
@@ -631,6 +1060,9 @@ auto DhtSession::processUdp(std::span<const std::byte> buffer, const IPEndpoint
         }
         auto sender = std::move(it->second);
         mPendingQueries.erase(it);
+        if (auto external = getMessageExternalEndpoint(message); external) {
+            voteExternalAddress(*external, endpoint);
+        }
         sender.send(std::pair {std::move(message), endpoint});
         co_return;
     }
@@ -642,6 +1074,97 @@ auto DhtSession::processUdp(std::span<const std::byte> buffer, const IPEndpoint
     }
 }
 
+auto DhtSession::voteExternalAddress(const IPEndpoint &external, const IPEndpoint &from) -> void {
+    if (external.family() != mFamily) { // Our id is for the first family, the other one can't vote on it
+        return;
+    }
+    // No agreement among too many addresses, or the round confirmed the current one long enough, start over
+    if (mExternalVotes.size() >= 64 || mExternalVoters.size() >= 1024) {
+        mExternalVotes.clear();
+        mExternalVoters.clear();
+    }
+    auto voter = SourceKey::from(from.address(), from.family() == AF_INET ? 24 : 64);
+    if (!mExternalVoters.insert(voter).second) { // One node (or a subnet of the sybils) can't outvote the others
+        return;
+    }
+    auto address = IPEndpoint(external.address(), 0);
+    auto count   = ++mExternalVotes[address];
+    if (count < EXTERNAL_MIN_VOTES || count * 2 <= mExternalVoters.size() || address == mExternalAddress) {
+        return;
+    }
+    // Most of the voters agree, start a new round, so a changed address (e.g. a new NAT mapping) can win later
+    mExternalVotes.clear();
+    mExternalVoters.clear();
+    mExternalAddress    = address;
+    DHT_LOG("External address is {}", address);
+    if (!mAdoptSecureId || isSecureNodeId(mId, address.address())) {
+        return;
+    }
+    mId = secureNodeId(address.address());
+    mRoutingTable.resetId(mId);
+    mRoutingTable6.resetId(mId);
+    DHT_LOG("Switch to the BEP42 secure id {}", mId);
+}
+
+auto DhtSession::addContact(const NodeEndpoint &node) -> void {
+    if (routingTable(node.ip.family()).accepts(node)) { // Or the insecure ids get in by the cache under Require
+        mContacts.add(node);
+    }
+}
+
+auto DhtSession::transportOf(int family) const -> DatagramTransport * {
+    switch (family) {
+        case AF_INET:  return mTransport;
+        case AF_INET6: return mTransport6;
+        default:       return nullptr;
+    }
+}
+
+auto DhtSession::tables() -> std::vector<RoutingTable *> {
+    std::vector<RoutingTable *> ret;
+    if (mTransport) {
+        ret.push_back(&mRoutingTable);
+    }
+    if (mTransport6) {
+        ret.push_back(&mRoutingTable6);
+    }
+    return ret;
+}
+
+auto DhtSession::totalNodes() const -> size_t {
+    return mRoutingTable.size() + mRoutingTable6.size();
+}
+
+auto DhtSession::aliveNodes(std::chrono::steady_clock::time_point since) const -> size_t {
+    size_t count = 0;
+    for (auto table : {&mRoutingTable, &mRoutingTable6}) {
+        for (auto &node : table->rawNodes()) {
+            count += node.state == Node::Good && node.lastSeen >= since;
+        }
+    }
+    return count;
+}
+
+auto DhtSession::defaultWant() const -> uint8_t {
+    return (mTransport && mTransport6) ? (WantNodes4 | WantNodes6) : WantDefault;
+}
+
+auto DhtSession::replyNodes(const NodeId &target, uint8_t want, const IPEndpoint &from) const
+    -> std::vector<NodeEndpoint> {
+    if (want == WantDefault) {
+        want = from.family() == AF_INET6 ? WantNodes6 : WantNodes4;
+    }
+    std::vector<NodeEndpoint> nodes;
+    if ((want & WantNodes4) && mTransport) {
+        nodes = mRoutingTable.findClosestNodes(target, KBUCKET_SIZE);
+    }
+    if ((want & WantNodes6) && mTransport6) {
+        auto nodes6 = mRoutingTable6.findClosestNodes(target, KBUCKET_SIZE);
+        nodes.insert(nodes.end(), nodes6.begin(), nodes6.end());
+    }
+    return nodes;
+}
+
 auto DhtSession::allocateTransactionId() -> std::string {
     if (mTransactionId == UINT16_MAX) {
         mTransactionId = 0;
@@ -658,8 +1181,9 @@ auto DhtSession::cleanupPeersThread() -> Task<void> {
             DHT_LOG("DhtSession::cleanupPeersThread request quit");
             break;
         }
-        mPeers.clear();
-        DHT_LOG("DhtSession::cleanupPeersThread clear peers");
+        auto dropped = mPeers.expire();
+        DHT_LOG("DhtSession::cleanupPeersThread drop {} expired peers, {} left", dropped, mPeers.size());
+        mBlocklist.expire();
     }
 }
 
@@ -669,31 +1193,71 @@ auto DhtSession::refreshTableThread() -> Task<void> {
             DHT_LOG("DhtSession::refreshTableThread request quit");
             break;
         }
-        auto node = mRoutingTable.nextRefresh();
-        if (!node) {
-            continue;
-        }
-        // Send ping request
-        auto res = co_await ping(node->ip);
-        if (!res && res.error() == Error::Canceled) {
-            DHT_LOG("DhtSession::refreshTableThread request quit");
-            break;
+        for (auto table : tables()) {
+            auto node = table->nextRefresh();
+            if (!node) {
+                continue;
+            }
+            // Send ping request
+            auto res = co_await ping(node->ip.toEndpoint());
+            if (!res && res.error() == Error::Canceled) {
+                DHT_LOG("DhtSession::refreshTableThread request quit");
+                co_return;
+            }
+            if (!res) {
+                DHT_LOG("DhtSession::refreshTableThread send ping request to {} failed: {}", *node, res.error());
+                table->markBadNode(*node);
+                continue;
+            }
+            if (*res != node->id) {
+                DHT_LOG("DhtSession::refreshTableThread send ping request to {} failed: id mismatch", *node);
+                table->markBadNode(*node);
+                continue;
+            }
+            table->updateNode(*node);
+            DHT_LOG("DhtSession::refreshTableThread send ping request to {} success", *node);
         }
-        if (!res) {
-            DHT_LOG("DhtSession::refreshTableThread send ping request to {} failed: {}", *node, res.error());
-            mRoutingTable.markBadNode(*node);
-            continue;
+    }
+}
+
+auto DhtSession::verifyTableThread() -> Task<void> {
+    while (true) {
+        auto scope = co_await TaskScope::make();
+        auto nodes  = mRoutingTable.rawNodes();
+        auto nodes6 = mRoutingTable6.rawNodes();
+        nodes.insert(nodes.end(), nodes6.begin(), nodes6.end());
+        for (auto &node : nodes) {
+            if (node.state != Node::Questionable) {
+                continue;
+            }
+            scope.spawn(verifyNode(node.endpoint));
+            if (auto res = co_await sleep(mVerifyInterval); !res) {
+                DHT_LOG("DhtSession::verifyTableThread request quit");
+                scope.cancel();
+                co_await scope;
+                co_return;
+            }
         }
-        if (*res != node->id) {
-            DHT_LOG("DhtSession::refreshTableThread send ping request to {} failed: id mismatch", *node);
-            mRoutingTable.markBadNode(*node);
-            continue;
+        co_await scope; // Wait all the pings done
+        if (auto res = co_await sleep(mRefreshInterval); !res) {
+            DHT_LOG("DhtSession::verifyTableThread request quit");
+            break;
         }
-        mRoutingTable.updateNode(*node);
-        DHT_LOG("DhtSession::refreshTableThread send ping request to {} success", *node);
     }
 }
 
+auto DhtSession::verifyNode(NodeEndpoint node) -> Task<void> {
+    auto res = co_await ping(node.ip.toEndpoint());
+    if (!res && res.error() == Error::Canceled) {
+        co_return;
+    }
+    if (!res || *res != node.id) {
+        routingTable(node.ip.family()).markBadNode(node);
+        co_return;
+    }
+    routingTable(node.ip.family()).updateNode(node);
+}
+
 auto DhtSession::randomSearchThread() -> Task<void> {
     while (true) {
         if (auto res = co_await sleep(mRandomSearchInterval); !res) {
@@ -3,16 +3,25 @@
 #include <ilias/sync.hpp>
 #include <ilias/net.hpp>
 #include <functional>
+#include <array>
 #include <random>
 #include <chrono>
 #include <vector>
 #include <set>
 #include <map>
+#include <unordered_set>
 #include <queue>
 
 #include "route.hpp"
+#include "nodeset.hpp"
+#include "contactcache.hpp"
 #include "krpc.hpp"
 #include "net.hpp"
+#include "transport.hpp"
+#include "peerstore.hpp"
+#include "token.hpp"
+#include "ratelimit.hpp"
+#include "secureid.hpp"
 
 class DhtSession {
 public:
@@ -22,10 +31,42 @@ public:
         Dfs    = 2,
     };
 
+    /**
+     * @brief The snapshot of the bootstrap, reported each time a seed or a range walk finished
+     *
+     */
+    struct BootstrapProgress {
+        std::chrono::milliseconds elapsed; // Since the bootstrap began
+        size_t                    nodes;   // The nodes in the routing table
+        std::array<size_t, 160>   buckets; // The nodes in each bucket
+        bool                      done;
+    };
+
+    /**
+     * @brief The counters of the session, used by the benchmarks
+     *
+     */
+    struct Statistics {
+        size_t queriesSent = 0; // The krpc queries we sent
+        size_t lookups     = 0; // The finished findNode
+        size_t lookupHops  = 0; // The sum of the hops (the rounds of the queries) of the lookups
+        size_t datagramsDropped = 0; // The datagrams dropped by the rate limiter or the blocklist
+    };
+
 public:
-    DhtSession(IoContext &ctxt, const NodeId &id, UdpClient &client);
+    DhtSession(IoContext &ctxt, const NodeId &id, DatagramTransport &transport);
     ~DhtSession();
 
+    /**
+     * @brief Add the transport of the other address family, so the session is dual-stack (BEP32), each family has its
+     * own routing table. Call it before loadFile and start
+     *
+     * @param transport
+     * @return true On added
+     * @return false On the family already has a transport
+     */
+    auto addTransport(DatagramTransport &transport) -> bool;
+
     /**
      * @brief Execute the session, doing the bootstrap and spawn background task, it will return if the init is done
      *
@@ -41,9 +82,9 @@ public:
     auto saveFile(const char *file) const -> void;
 
     /**
-     * @brief Load the routing table fromt the file
+     * @brief Load the routing table fromt the file, the nodes are restored as questionable and verified lazily
      *
-     * @param file
+     * @param file The binary snapshot, or the legacy text format (id-ip per line)
      */
     auto loadFile(const char *file) -> void;
 
@@ -64,7 +105,7 @@ public:
     auto ping(const IPEndpoint &nodeIp) -> IoTask<NodeId>;
 
     /**
-     * @brief Get the routing table
+     * @brief Get the routing table of the first transport's family
      *
      * @return const RoutingTable&
      */
@@ -77,12 +118,74 @@ public:
      */
     auto routingTable() -> RoutingTable &;
 
+    /**
+     * @brief Get the routing table of the address family
+     *
+     * @param family AF_INET or AF_INET6
+     * @return RoutingTable&
+     */
+    auto routingTable(int family) const -> const RoutingTable &;
+    auto routingTable(int family) -> RoutingTable &;
+
+    /**
+     * @brief Find the closest nodes of each family we have a transport of
+     *
+     * @param target
+     * @param max The max nodes per family
+     * @return std::vector<NodeEndpoint> (Sorted by distance)
+     */
+    auto findClosestNodes(const NodeId &target, size_t max = KBUCKET_SIZE) const -> std::vector<NodeEndpoint>;
+
+    /**
+     * @brief Find the nodes to start a lookup from, the closest ones of the routing tables and the recent contacts
+     *
+     * @param target
+     * @param max
+     * @return std::vector<NodeEndpoint> (Sorted by distance)
+     */
+    auto findStartNodes(const NodeId &target, size_t max = KBUCKET_SIZE) const -> std::vector<NodeEndpoint>;
+
+    /**
+     * @brief Get the id of us, it may change once to the BEP42 secure id (see setAdoptSecureId)
+     *
+     * @return const NodeId&
+     */
+    auto id() const -> const NodeId &;
+
+    /**
+     * @brief Get the external address of us, voted by the BEP42 "ip" of the replies
+     *
+     * @return std::optional<IPEndpoint> The address with port 0, nullopt if not known yet
+     */
+    auto externalAddress() const -> std::optional<IPEndpoint>;
+
+    /**
+     * @brief Enable/disable switching our id to the BEP42 secure one when the external address is known
+     *
+     * @param enable
+     */
+    auto setAdoptSecureId(bool enable) -> void;
+
     /**
      * @brief Get the peers that announced
      *
-     * @return const std::map<InfoHash, std::set<IPEndpoint> >&
+     * @return const PeerStore&
+     */
+    auto peers() const -> const PeerStore &;
+
+    /**
+     * @brief Get the blocklist of the abusive sources, all the datagrams from them are dropped
+     *
+     * @return Blocklist&
      */
-    auto peers() const -> const std::map<InfoHash, std::set<IPEndpoint>> &;
+    auto blocklist() -> Blocklist &;
+
+    /**
+     * @brief Get the cache of the nodes replied in the recent lookups, the new lookups start from them
+     *
+     * @return ContactCache&
+     */
+    auto contacts() -> ContactCache &;
 
     /**
      * @brief Set the callback triggered when a peer is announced
@@ -98,6 +201,13 @@ public:
      */
     auto setOnQuery(std::function<void(const BenObject &object, const IPEndpoint &peer)> callback) -> void;
 
+    /**
+     * @brief Set the callback triggered when the bootstrap made progress
+     *
+     * @param callback
+     */
+    auto setOnBootstrapProgress(std::function<void(const BootstrapProgress &progress)> callback) -> void;
+
     /**
      * @brief Set the Skip Bootstrap object
      *
@@ -105,6 +215,65 @@ public:
      */
     auto setSkipBootstrap(bool skip) -> void;
 
+    /**
+     * @brief Add an endpoint to bootstrap from, it is tried before the dns seeds (e.g. a node in lan, or a local
+     * stand-in node for offline testing)
+     *
+     * @param endpoint
+     */
+    auto addBootstrapEndpoint(const IPEndpoint &endpoint) -> void;
+
+    /**
+     * @brief Set the number of the restored nodes, that we treat the routing table as warm and skip the dns seeds
+     *
+     * @param nodes
+     */
+    auto setWarmStartThreshold(size_t nodes) -> void;
+
+    /**
+     * @brief enable/disable resolving the public dns seeds in bootstrap (e.g. disable it in the offline network)
+     *
+     * @param enable
+     */
+    auto setDnsSeeds(bool enable) -> void;
+
+    /**
+     * @brief Set the time source of the session, the routing tables, the contacts, the peers, the tokens, the blocklist
+     * and the rate limiter, e.g. the virtual clock of a simulation, so the simulated run is deterministic. The steady
+     * clock by default, set it before start
+     *
+     * @param clock
+     */
+    auto setClock(std::function<std::chrono::steady_clock::time_point()> clock) -> void;
+
+    /**
+     * @brief Get the current time of the time source
+     *
+     * @return std::chrono::steady_clock::time_point
+     */
+    auto now() const -> std::chrono::steady_clock::time_point;
+
+    /**
+     * @brief Set the config of the inbound rate limiter, nullopt to disable it (the blocklist is still checked)
+     *
+     * @param config
+     */
+    auto setRateLimit(std::optional<RateLimiter::Config> config) -> void;
+
+    /**
+     * @brief Set the BEP42 policy of the routing table
+     *
+     * @param policy
+     */
+    auto setSecureIdPolicy(RoutingTable::SecureIdPolicy policy) -> void;
+
+    /**
+     * @brief Get the counters of the session
+     *
+     * @return const Statistics&
+     */
+    auto statistics() const -> const Statistics &;
+
     /**
      * @brief enable/disable the random search
      *
@@ -117,18 +286,23 @@ public:
      *
      * @param nodeIp The node ip to sample
      * @param target The target id to find (see the sample_info_hash request in bep)
+     * @param id The id of the node if known, it is dropped from the contact cache on failed
      * @return IoTask<SampleInfoHashesReply>  The sampled info hashes
      */
-    auto sampleInfoHashes(const IPEndpoint &nodeIp, NodeId target = NodeId::rand()) -> IoTask<SampleInfoHashesReply>;
+    auto sampleInfoHashes(const IPEndpoint &nodeIp, NodeId target = NodeId::rand(), std::optional<NodeId> id = {})
+        -> IoTask<SampleInfoHashesReply>;
 
     /**
      * @brief Get the Peers from the remote tagrte
      *
      * @param endpoint
      * @param target
+     * @param scrape Ask for the BEP33 bloom filters of the swarm too
+     * @param id The id of the node if known, it is dropped from the contact cache on failed
      * @return IoTask<GetPeersReply>
      */
-    auto getPeers(const IPEndpoint &endpoint, const InfoHash &target) -> IoTask<GetPeersReply>;
+    auto getPeers(const IPEndpoint &endpoint, const InfoHash &target, bool scrape = false,
+                  std::optional<NodeId> id = {}) -> IoTask<GetPeersReply>;
 
     /**
      * @brief Process the udp input from the socket
@@ -139,8 +313,9 @@ public:
 
 private:
     struct FindNodeEnv {
-        std::set<NodeEndpoint>      visited;
+        NodeSet                     visited;
         std::optional<NodeEndpoint> closest; // The closest node to the target
+        size_t                      hops = 0; // The max rounds of the queries in the lookup
     };
 
     /**
@@ -181,21 +356,105 @@ private:
      * @param visited The visited nodes
      * @return IoTask<std::vector<NodeEndpoint> >
      */
-    auto bfsDfsFind(const NodeId &target, std::optional<NodeId> id, const IPEndpoint &endpoint, size_t depth,
+    auto bfsDfsFind(const NodeId &target, std::optional<NodeId> id, const CompactEndpoint &endpoint, size_t depth,
                     FindNodeEnv &env) -> IoTask<std::vector<NodeEndpoint>>;
 
-    auto aStarFind(const NodeId &target, std::optional<NodeId> id, const IPEndpoint &endpoint, FindNodeEnv &env,
+    auto aStarFind(const NodeId &target, std::optional<NodeId> id, const CompactEndpoint &endpoint, FindNodeEnv &env,
                    int max_parallel = 8, int max_step = 20) -> IoTask<std::vector<NodeEndpoint>>;
-    auto findNearNodes(const NodeId &target, std::optional<NodeId> id, const IPEndpoint &endpoint, FindNodeEnv &env)
+    auto findNearNodes(const NodeId &target, std::optional<NodeId> id, CompactEndpoint endpoint, FindNodeEnv &env)
         -> IoTask<std::vector<NodeEndpoint>>;
 
     /**
-     * @brief Init the session, bootstrap the node
+     * @brief Get the transport of the address family
      *
-     * @param nodeIp
+     * @param family
+     * @return DatagramTransport* nullptr on we can't reach the family
+     */
+    auto transportOf(int family) const -> DatagramTransport *;
+
+    /**
+     * @brief Add the node replied to the contact cache, if the routing table of its family accepts the id
+     *
+     * @param node
+     */
+    auto addContact(const NodeEndpoint &node) -> void;
+
+    /**
+     * @brief Get the routing tables of the families we have a transport of
+     *
+     * @return std::vector<RoutingTable *>
+     */
+    auto tables() -> std::vector<RoutingTable *>;
+
+    /**
+     * @brief Get the number of the nodes in all the routing tables
+     *
+     * @return size_t
+     */
+    auto totalNodes() const -> size_t;
+
+    /**
+     * @brief Get the number of the good nodes replied since the time point, in all the routing tables
+     *
+     * @param since
+     * @return size_t
+     */
+    auto aliveNodes(std::chrono::steady_clock::time_point since) const -> size_t;
+
+    /**
+     * @brief Get the "want" of our queries, both families if dual-stack
+     *
+     * @return uint8_t
+     */
+    auto defaultWant() const -> uint8_t;
+
+    /**
+     * @brief Get the closest nodes to put in the reply, by the "want" of the query
+     *
+     * @param target
+     * @param want
+     * @param from The requester, its family is used if want is WantDefault
+     * @return std::vector<NodeEndpoint>
+     */
+    auto replyNodes(const NodeId &target, uint8_t want, const IPEndpoint &from) const -> std::vector<NodeEndpoint>;
+
+    /**
+     * @brief Resolve the dns seeds concurrently, with the bootstrap endpoints first
+     *
+     * @return IoTask<std::vector<IPEndpoint> >
+     */
+    auto resolveSeeds() -> IoTask<std::vector<IPEndpoint>>;
+
+    /**
+     * @brief Init the session, ask all the seeds at the same time, then fill the distance ranges in parallel
+     *
+     * @param seeds
      * @return IoTask<void>
      */
-    auto bootstrap(const IPEndpoint &nodeIp) -> IoTask<void>;
+    auto bootstrap(const std::vector<IPEndpoint> &seeds) -> IoTask<void>;
+
+    /**
+     * @brief Walk the distance ranges in parallel
+     *
+     * @param onlyMissing Only walk the ranges that have no nodes in the routing table
+     * @return IoTask<void>
+     */
+    auto refillTable(bool onlyMissing = true) -> IoTask<void>;
+
+    /**
+     * @brief Report the bootstrap progress to the callback
+     *
+     * @param done
+     */
+    auto reportProgress(bool done) -> void;
+
+    /**
+     * @brief Count the BEP42 "ip" of a reply, adopt the address (and the secure id) when most voters agree
+     *
+     * @param external The endpoint of us the remote saw
+     * @param from The endpoint of the reply, a /24 (or /64) votes once a round
+     */
+    auto voteExternalAddress(const IPEndpoint &external, const IPEndpoint &from) -> void;
 
     /**
      * @brief Allocate a transaction id
@@ -218,6 +477,21 @@ private:
      */
     auto refreshTableThread() -> Task<void>;
 
+    /**
+     * @brief A user thread, to ping the questionable nodes (e.g. restored from the snapshot) at a limited rate
+     *
+     * @return Task<void>
+     */
+    auto verifyTableThread() -> Task<void>;
+
+    /**
+     * @brief Ping the node, update it on success, mark it bad on failed
+     *
+     * @param node
+     * @return Task<void>
+     */
+    auto verifyNode(NodeEndpoint node) -> Task<void>;
+
     /**
      * @brief A user thread, to do random search for expand the routing table
      *
@@ -227,32 +501,47 @@ private:
 
     IoContext                &mCtxt;
     TaskScope                 mScope;
-    UdpClient                &mClient;
-    IPEndpoint                mEndpoint;
+    DatagramTransport        *mTransport  = nullptr; // The IPv4 transport
+    DatagramTransport        *mTransport6 = nullptr; // The IPv6 transport
+    int                       mFamily; // The family of the first transport, our id is for it
     NodeId                    mId;
-    RoutingTable              mRoutingTable;
+    RoutingTable              mRoutingTable;  // The IPv4 nodes
+    RoutingTable              mRoutingTable6; // The IPv6 nodes
     std::chrono::milliseconds mTimeout         = std::chrono::seconds(10);
     std::chrono::milliseconds mRefreshInterval = std::chrono::minutes(5);  // Refresh the routing table every 5 minute
-    std::chrono::milliseconds mCleanupInterval = std::chrono::minutes(15); // Cleanup the peers every 15 minute
+    std::chrono::milliseconds mCleanupInterval = std::chrono::minutes(1); // Drop the expired peers every minute
     std::chrono::milliseconds mRandomSearchInterval = std::chrono::minutes(10);
+    std::chrono::milliseconds mVerifyInterval  = std::chrono::milliseconds(50); // Ping at most 20 questionable nodes per second
     std::mt19937              mRandom {std::random_device {}()};
 
     std::map<std::string, oneshot::Sender<std::pair<BenObject, IPEndpoint>>>
              mPendingQueries;    //< The pending queries, we sent, waiting for reply
     uint16_t mTransactionId = 0; //< The transaction id
-
-    std::map<InfoHash,
-             std::set<IPEndpoint> //< Use set to avoid duplicate
-             >
-        mPeers; //< The peers they announced
+    Statistics mStatistics;
+
+    PeerStore mPeers; //< The peers they announced
+    ContactCache mContacts; //< The nodes replied in the recent lookups, the new lookups start from them
+    TokenManager mTokens; //< The tokens of get_peers, checked by announce_peer
+    Blocklist mBlocklist; //< The abusive sources, shared with the SampleManager
+    std::optional<RateLimiter> mLimiter {std::in_place, mBlocklist}; //< The per source limiter of the inbound datagrams
+    std::map<IPEndpoint, size_t> mExternalVotes; //< The external address (port 0) the replies told us, and the count
+    std::unordered_set<SourceKey> mExternalVoters; //< The subnets voted in this round
+    std::optional<IPEndpoint> mExternalAddress;
     std::function<void(const InfoHash &hash, const IPEndpoint &peer)>
         mOnAnnouncePeer; //< The callback when we got a announce peer
     std::function<void(const BenObject &message, const IPEndpoint &from)> mOnQuery; // The callback when we got a query
+    std::function<void(const BootstrapProgress &progress)> mOnBootstrapProgress;
+    std::chrono::steady_clock::time_point mBootstrapBegin;
+    std::function<std::chrono::steady_clock::time_point()> mClock = std::chrono::steady_clock::now;
 
     // Config
     bool  mSkipBootstrap = false;
     bool  mRetryBootstrap = true;
     bool  mRandomSearch = true;
+    bool  mDnsSeeds = true;
+    bool  mAdoptSecureId = true;
+    size_t mWarmStartNodes = 32; // The restored table has at least this nodes, we skip the dns seeds
+    std::vector<IPEndpoint> mBootstrapEndpoints; // The endpoints tried before the dns seeds
 };
 
 enum class KrpcError {
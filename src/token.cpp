@@ -0,0 +1,104 @@
+#include "token.hpp"
+#include <random>
+#include <cstring>
+#include <bit>
+
+// SipHash-2-4, https://www.aumasson.jp/siphash/siphash.pdf
+static auto sipRound(uint64_t &v0, uint64_t &v1, uint64_t &v2, uint64_t &v3) -> void {
+    v0 += v1; v1 = std::rotl(v1, 13); v1 ^= v0; v0 = std::rotl(v0, 32);
+    v2 += v3; v3 = std::rotl(v3, 16); v3 ^= v2;
+    v0 += v3; v3 = std::rotl(v3, 21); v3 ^= v0;
+    v2 += v1; v1 = std::rotl(v1, 17); v1 ^= v2; v2 = std::rotl(v2, 32);
+}
+
+static auto readLE64(const std::byte *data, size_t n) -> uint64_t {
+    uint64_t value = 0;
+    for (size_t i = 0; i < n; ++i) {
+        value |= uint64_t(data[i]) << (i * 8);
+    }
+    return value;
+}
+
+static auto sipHash24(uint64_t k0, uint64_t k1, std::span<const std::byte> data) -> uint64_t {
+    uint64_t v0 = k0 ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = k1 ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = k0 ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = k1 ^ 0x7465646279746573ULL;
+    size_t   blocks = data.size() / 8;
+    for (size_t i = 0; i < blocks; ++i) {
+        auto m = readLE64(data.data() + i * 8, 8);
+        v3 ^= m;
+        sipRound(v0, v1, v2, v3);
+        sipRound(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    auto last = (uint64_t(data.size()) << 56) | readLE64(data.data() + blocks * 8, data.size() % 8);
+    v3 ^= last;
+    sipRound(v0, v1, v2, v3);
+    sipRound(v0, v1, v2, v3);
+    v0 ^= last;
+    v2 ^= 0xff;
+    for (int i = 0; i < 4; ++i) {
+        sipRound(v0, v1, v2, v3);
+    }
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static auto randomSecret() -> std::array<uint64_t, 2> {
+    std::random_device device;
+    auto next = [&]() { return (uint64_t(device()) << 32) | device(); };
+    return {next(), next()};
+}
+
+TokenManager::TokenManager(std::chrono::seconds interval) :
+    mCurrent(randomSecret()), mPrevious(randomSecret()), mRotateTime(Clock::now()), mInterval(interval) {
+
+}
+
+TokenManager::~TokenManager() {
+
+}
+
+auto TokenManager::generate(const IPAddress &ip) -> std::string {
+    rotateIfNeeded();
+    auto value = hash(mCurrent, ip);
+    std::string token(TokenSize, '\0');
+    ::memcpy(token.data(), &value, TokenSize);
+    return token;
+}
+
+auto TokenManager::verify(const IPAddress &ip, std::string_view token) -> bool {
+    if (token.size() != TokenSize) {
+        return false;
+    }
+    rotateIfNeeded();
+    uint64_t value = 0;
+    ::memcpy(&value, token.data(), TokenSize);
+    return value == hash(mCurrent, ip) || value == hash(mPrevious, ip);
+}
+
+auto TokenManager::rotate() -> void {
+    mPrevious   = mCurrent;
+    mCurrent    = randomSecret();
+    mRotateTime = mClock();
+}
+
+auto TokenManager::setClock(std::function<Clock::time_point ()> clock) -> void {
+    mClock      = std::move(clock);
+    mRotateTime = mClock();
+}
+
+auto TokenManager::hash(const Secret &secret, const IPAddress &ip) -> uint64_t {
+    return sipHash24(secret[0], secret[1], ip.span());
+}
+
+auto TokenManager::rotateIfNeeded() -> void {
+    auto elapsed = mClock() - mRotateTime;
+    if (elapsed < mInterval) {
+        return;
+    }
+    if (elapsed >= mInterval * 2) { // Idle for a long time, the previous secret is too old as well
+        mCurrent = randomSecret();
+    }
+    rotate();
+}
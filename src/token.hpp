@@ -0,0 +1,79 @@
+/**
+ * @file token.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The BEP5 announce token, the keyed hash of the requester ip with a rotating secret
+ * @version 0.1
+ * @date 2025-06-06
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "net.hpp"
+#include <string_view>
+#include <string>
+#include <functional>
+#include <chrono>
+#include <array>
+
+/**
+ * @brief Generate and verify the tokens of get_peers / announce_peer without any per requester state
+ *
+ * The token is the SipHash-2-4 of the ip address keyed by a random secret. The secret is rotated every interval
+ * (lazily, on the next call), the token made by the previous secret is still accepted, so a token lives between one
+ * and two intervals, as BEP5 suggests
+ *
+ */
+class TokenManager {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t TokenSize = 8;
+
+    TokenManager(std::chrono::seconds interval = std::chrono::minutes(5));
+    TokenManager(const TokenManager &) = delete;
+    ~TokenManager();
+
+    /**
+     * @brief Make the token for the ip by the current secret
+     *
+     * @param ip
+     * @return std::string
+     */
+    auto generate(const IPAddress &ip) -> std::string;
+
+    /**
+     * @brief Check the token is made for the ip by the current or the previous secret, no allocation
+     *
+     * @param ip
+     * @param token
+     * @return true
+     * @return false
+     */
+    auto verify(const IPAddress &ip, std::string_view token) -> bool;
+
+    /**
+     * @brief Replace the secret now, the current one becomes the previous one
+     *
+     */
+    auto rotate() -> void;
+
+    /**
+     * @brief Set the time source of the rotation, the secrets are kept and the interval starts again, e.g. the virtual clock of a simulation, the steady clock by default
+     *
+     * @param clock
+     */
+    auto setClock(std::function<Clock::time_point ()> clock) -> void;
+private:
+    using Secret = std::array<uint64_t, 2>;
+
+    static auto hash(const Secret &secret, const IPAddress &ip) -> uint64_t;
+    auto rotateIfNeeded() -> void;
+
+    Secret            mCurrent;
+    Secret            mPrevious;
+    std::function<Clock::time_point ()> mClock = Clock::now;
+    Clock::time_point mRotateTime;
+    Clock::duration   mInterval;
+};
@@ -0,0 +1,156 @@
+#include "transport.hpp"
+#include "log.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__linux__)
+#include <sys/socket.h>
+#include <cerrno>
+
+inline constexpr size_t MMSG_BATCH         = 64;   // The max datagrams per sendmmsg / recvmmsg
+inline constexpr size_t MMSG_DATAGRAM_SIZE = 2048; // The dht and utp datagrams are smaller than the mtu
+#endif
+
+UdpTransport::UdpTransport(UdpClient &client) : mClient(client) {
+
+}
+
+auto UdpTransport::sendto(std::span<const std::byte> buffer, const IPEndpoint &endpoint) -> IoTask<size_t> {
+    return mClient.sendto(buffer, endpoint);
+}
+
+auto UdpTransport::recvfrom(std::span<std::byte> buffer, IPEndpoint &endpoint) -> IoTask<size_t> {
+    return mClient.recvfrom(buffer, endpoint);
+}
+
+auto UdpTransport::localEndpoint() -> Result<IPEndpoint> {
+    return mClient.localEndpoint();
+}
+
+auto UdpTransport::client() -> UdpClient & {
+    return mClient;
+}
+
+#if defined(__linux__)
+MmsgTransport::MmsgTransport(UdpClient &client) : mClient(client) {
+
+}
+
+MmsgTransport::~MmsgTransport() {
+    mScope.cancel();
+    mScope.wait();
+}
+
+auto MmsgTransport::sendto(std::span<const std::byte> buffer, const IPEndpoint &endpoint) -> IoTask<size_t> {
+    mSendQueue.push_back({std::vector<std::byte>(buffer.begin(), buffer.end()), endpoint});
+    if (!mFlushing) {
+        mFlushing = true;
+        mScope.spawn(flushThread());
+    }
+    co_return buffer.size();
+}
+
+auto MmsgTransport::recvfrom(std::span<std::byte> buffer, IPEndpoint &endpoint) -> IoTask<size_t> {
+    while (mRecvQueue.empty()) {
+        if (auto res = co_await fill(); !res) {
+            co_return unexpected(res.error());
+        }
+    }
+    auto datagram = std::move(mRecvQueue.front());
+    mRecvQueue.pop_front();
+    auto n   = std::min(buffer.size(), datagram.data.size());
+    endpoint = datagram.endpoint;
+    ::memcpy(buffer.data(), datagram.data.data(), n);
+    co_return n;
+}
+
+auto MmsgTransport::localEndpoint() -> Result<IPEndpoint> {
+    return mClient.localEndpoint();
+}
+
+auto MmsgTransport::oversized() const -> size_t {
+    return mOversized;
+}
+
+auto MmsgTransport::flushThread() -> Task<void> {
+    // Let the other sends in this event loop turn join the batch
+    if (auto res = co_await sleep(std::chrono::milliseconds(0)); !res) {
+        co_return;
+    }
+    auto fd = mClient.socket().get();
+    while (!mSendQueue.empty()) {
+        ::mmsghdr msgs[MMSG_BATCH] {};
+        ::iovec   iovs[MMSG_BATCH] {};
+        auto      n = std::min(mSendQueue.size(), MMSG_BATCH);
+        for (size_t i = 0; i < n; ++i) {
+            auto &datagram              = mSendQueue[i];
+            iovs[i].iov_base            = datagram.data.data();
+            iovs[i].iov_len             = datagram.data.size();
+            msgs[i].msg_hdr.msg_iov     = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen  = 1;
+            msgs[i].msg_hdr.msg_name    = (void *) &datagram.endpoint.cast<::sockaddr>();
+            msgs[i].msg_hdr.msg_namelen = datagram.endpoint.length();
+        }
+        auto ret = ::sendmmsg(fd, msgs, n, MSG_DONTWAIT);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { // The send buffer is full, wait it
+                if (auto res = co_await mClient.poll(PollEvent::Out); !res) {
+                    break;
+                }
+                continue;
+            }
+            // The first one is bad (e.g. unreachable), drop it and send the rest
+            DO_LOG("[Transport]", "sendmmsg to {} failed: {}", mSendQueue.front().endpoint, ::strerror(errno));
+            mSendQueue.pop_front();
+            continue;
+        }
+        mSendQueue.erase(mSendQueue.begin(), mSendQueue.begin() + ret);
+    }
+    mFlushing = false;
+}
+
+auto MmsgTransport::fill() -> IoTask<void> {
+    auto fd = mClient.socket().get();
+    if (mRecvStorage.empty()) {
+        mRecvStorage.resize(MMSG_BATCH * MMSG_DATAGRAM_SIZE);
+    }
+    auto storage = mRecvStorage.data();
+    while (true) {
+        ::mmsghdr          msgs[MMSG_BATCH] {};
+        ::iovec            iovs[MMSG_BATCH] {};
+        ::sockaddr_storage addrs[MMSG_BATCH] {};
+        for (size_t i = 0; i < MMSG_BATCH; ++i) {
+            iovs[i].iov_base            = storage + i * MMSG_DATAGRAM_SIZE;
+            iovs[i].iov_len             = MMSG_DATAGRAM_SIZE;
+            msgs[i].msg_hdr.msg_iov     = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen  = 1;
+            msgs[i].msg_hdr.msg_name    = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+        auto ret = ::recvmmsg(fd, msgs, MMSG_BATCH, MSG_DONTWAIT, nullptr);
+        if (ret < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { // Nothing to read, wait it
+                if (auto res = co_await mClient.poll(PollEvent::In); !res) {
+                    co_return unexpected(res.error());
+                }
+                continue;
+            }
+            co_return unexpected(SystemError::fromErrno());
+        }
+        for (int i = 0; i < ret; ++i) {
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) { // Too large, not a dht or utp packet
+                mOversized += 1;
+                DO_LOG("[Transport]", "Drop the datagram larger than {} bytes, {} dropped", MMSG_DATAGRAM_SIZE,
+                       mOversized);
+                continue;
+            }
+            auto endpoint = IPEndpoint::fromRaw(&addrs[i], msgs[i].msg_hdr.msg_namelen);
+            auto data     = storage + i * MMSG_DATAGRAM_SIZE;
+            if (endpoint) {
+                mRecvQueue.push_back({std::vector<std::byte>(data, data + msgs[i].msg_len), *endpoint});
+            }
+        }
+        co_return {};
+    }
+}
+#endif
@@ -0,0 +1,117 @@
+/**
+ * @file transport.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The datagram transport used by the protocol code, so the socket can be replaced
+ * @version 0.1
+ * @date 2025-06-04
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include <ilias/sync.hpp>
+#include <vector>
+#include <deque>
+#include <span>
+#include "net.hpp"
+
+/**
+ * @brief The interface of the datagram socket
+ *
+ */
+class DatagramTransport {
+public:
+    virtual ~DatagramTransport() = default;
+
+    /**
+     * @brief Send the datagram to the endpoint
+     *
+     * @param buffer
+     * @param endpoint
+     * @return IoTask<size_t> The bytes sent
+     */
+    virtual auto sendto(std::span<const std::byte> buffer, const IPEndpoint &endpoint) -> IoTask<size_t> = 0;
+
+    /**
+     * @brief Receive a datagram
+     *
+     * @param buffer The buffer to receive, the datagram is truncated if the buffer is too small
+     * @param endpoint The endpoint of the sender
+     * @return IoTask<size_t> The bytes received
+     */
+    virtual auto recvfrom(std::span<std::byte> buffer, IPEndpoint &endpoint) -> IoTask<size_t> = 0;
+
+    /**
+     * @brief Get the local endpoint of the transport
+     *
+     * @return Result<IPEndpoint>
+     */
+    virtual auto localEndpoint() -> Result<IPEndpoint> = 0;
+};
+
+/**
+ * @brief The transport on the real udp socket, one syscall per datagram
+ *
+ */
+class UdpTransport final : public DatagramTransport {
+public:
+    UdpTransport(UdpClient &client);
+    UdpTransport(const UdpTransport &) = delete;
+
+    auto sendto(std::span<const std::byte> buffer, const IPEndpoint &endpoint) -> IoTask<size_t> override;
+    auto recvfrom(std::span<std::byte> buffer, IPEndpoint &endpoint) -> IoTask<size_t> override;
+    auto localEndpoint() -> Result<IPEndpoint> override;
+
+    /**
+     * @brief Get the socket
+     *
+     * @return UdpClient&
+     */
+    auto client() -> UdpClient &;
+private:
+    UdpClient &mClient;
+};
+
+#if defined(__linux__)
+/**
+ * @brief The transport on the real udp socket, batch the datagrams with sendmmsg / recvmmsg
+ *
+ * The sends in the same event loop turn are queued and flushed by one sendmmsg, the receiving reads up to
+ * MMSG_BATCH datagrams when the socket is readable. So the send is fire and forget, the error is only logged
+ *
+ */
+class MmsgTransport final : public DatagramTransport {
+public:
+    MmsgTransport(UdpClient &client);
+    MmsgTransport(const MmsgTransport &) = delete;
+    ~MmsgTransport();
+
+    auto sendto(std::span<const std::byte> buffer, const IPEndpoint &endpoint) -> IoTask<size_t> override;
+    auto recvfrom(std::span<std::byte> buffer, IPEndpoint &endpoint) -> IoTask<size_t> override;
+    auto localEndpoint() -> Result<IPEndpoint> override;
+
+    /**
+     * @brief Get the number of the datagrams dropped for being larger than the receive slot
+     *
+     * @return size_t
+     */
+    auto oversized() const -> size_t;
+private:
+    struct Datagram {
+        std::vector<std::byte> data;
+        IPEndpoint             endpoint;
+    };
+
+    auto flushThread() -> Task<void>;
+    auto fill() -> IoTask<void>; // Wait the socket readable and read a batch
+
+    UdpClient             &mClient;
+    TaskScope              mScope;
+    std::deque<Datagram>   mSendQueue;
+    std::deque<Datagram>   mRecvQueue;
+    std::vector<std::byte> mRecvStorage; // The slots of a recvmmsg batch, allocated on the first fill
+    size_t                 mOversized = 0;
+    bool                   mFlushing = false;
+};
+#endif
@@ -0,0 +1,276 @@
+#include "uring.hpp"
+
+#if defined(DHT_HAS_URING)
+#include "log.hpp"
+#include <sys/eventfd.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+
+inline constexpr unsigned URING_ENTRIES     = 512;
+inline constexpr unsigned URING_BUFFERS     = 512;  // The number of the provided buffers, power of 2
+inline constexpr size_t   URING_BUFFER_SIZE = 2048; // The header + the address + the payload
+inline constexpr uint16_t URING_BUFFER_GROUP = 0;
+inline constexpr uint64_t URING_RECV_TAG    = 1;    // The user data of the recv, sends use the sequence >= 2
+inline constexpr size_t   URING_MAX_QUEUE   = 8192; // Drop the datagram if the app is too slow, as udp does
+inline constexpr auto     URING_REARM_DELAY = std::chrono::milliseconds(10); // Between the retries of the recv
+
+// The multishot recvmsg needs linux 6.0
+static auto kernelSupported() -> bool {
+    ::utsname name {};
+    if (::uname(&name) != 0) {
+        return false;
+    }
+    int major = 0;
+    if (::sscanf(name.release, "%d", &major) != 1) {
+        return false;
+    }
+    return major >= 6;
+}
+
+UringTransport::UringTransport(IoContext &ctxt, UdpClient &client) : mCtxt(ctxt), mClient(client), mScope(ctxt) {
+
+}
+
+UringTransport::~UringTransport() {
+    mScope.cancel();
+    mScope.wait();
+    if (mEventDesc) {
+        mCtxt.removeDescriptor(mEventDesc);
+    }
+    if (mBufRing) {
+        ::io_uring_free_buf_ring(&mRing, mBufRing, URING_BUFFERS, URING_BUFFER_GROUP);
+    }
+    if (mRingInited) {
+        ::io_uring_queue_exit(&mRing); // Cancel all the inflight operations
+    }
+    if (mEventFd >= 0) {
+        ::close(mEventFd);
+    }
+}
+
+auto UringTransport::create(IoContext &ctxt, UdpClient &client) -> std::unique_ptr<UringTransport> {
+    std::unique_ptr<UringTransport> transport(new UringTransport(ctxt, client));
+    if (!transport->init()) {
+        return nullptr;
+    }
+    return transport;
+}
+
+auto UringTransport::init() -> bool {
+    if (!kernelSupported()) {
+        URING_LOG("The kernel is too old for the multishot recvmsg");
+        return false;
+    }
+    if (auto ret = ::io_uring_queue_init(URING_ENTRIES, &mRing, 0); ret < 0) {
+        URING_LOG("io_uring_queue_init failed: {}", ::strerror(-ret));
+        return false;
+    }
+    mRingInited = true;
+
+    // Check the opcodes
+    auto probe = ::io_uring_get_probe_ring(&mRing);
+    if (!probe) {
+        return false;
+    }
+    bool supported = ::io_uring_opcode_supported(probe, IORING_OP_SENDMSG) &&
+                     ::io_uring_opcode_supported(probe, IORING_OP_RECVMSG);
+    ::io_uring_free_probe(probe);
+    if (!supported) {
+        URING_LOG("The sendmsg / recvmsg opcodes are not supported");
+        return false;
+    }
+
+    // Register the provided buffers
+    int ret = 0;
+    mBufRing = ::io_uring_setup_buf_ring(&mRing, URING_BUFFERS, URING_BUFFER_GROUP, 0, &ret);
+    if (!mBufRing) {
+        URING_LOG("io_uring_setup_buf_ring failed: {}", ::strerror(-ret));
+        return false;
+    }
+    mBuffers.resize(URING_BUFFERS * URING_BUFFER_SIZE);
+    for (unsigned i = 0; i < URING_BUFFERS; ++i) {
+        ::io_uring_buf_ring_add(mBufRing, mBuffers.data() + i * URING_BUFFER_SIZE, URING_BUFFER_SIZE, i,
+                                ::io_uring_buf_ring_mask(URING_BUFFERS), i);
+    }
+    ::io_uring_buf_ring_advance(mBufRing, URING_BUFFERS);
+
+    // Let the event loop know the completions by the eventfd
+    mEventFd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mEventFd < 0 || ::io_uring_register_eventfd(&mRing, mEventFd) != 0) {
+        URING_LOG("Failed to register the eventfd");
+        return false;
+    }
+    auto desc = mCtxt.addDescriptor(mEventFd, IoDescriptor::Unknown);
+    if (!desc) {
+        URING_LOG("Failed to add the eventfd to the context: {}", desc.error());
+        return false;
+    }
+    mEventDesc = *desc;
+
+    // The name buffer in each provided buffer, no control message
+    mRecvMsg.msg_namelen    = sizeof(::sockaddr_storage);
+    mRecvMsg.msg_controllen = 0;
+    if (!armRecv() || ::io_uring_submit(&mRing) < 0) {
+        return false;
+    }
+    mScope.spawn(reapThread());
+    return true;
+}
+
+auto UringTransport::armRecv() -> bool {
+    auto sqe = getSqe();
+    if (!sqe) {
+        return false;
+    }
+    ::io_uring_prep_recvmsg_multishot(sqe, mClient.socket().get(), &mRecvMsg, 0);
+    sqe->flags     |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group  = URING_BUFFER_GROUP;
+    ::io_uring_sqe_set_data64(sqe, URING_RECV_TAG);
+    mPending += 1;
+    return true;
+}
+
+auto UringTransport::getSqe() -> ::io_uring_sqe * {
+    auto sqe = ::io_uring_get_sqe(&mRing);
+    if (!sqe) { // The submission queue is full, submit them now
+        ::io_uring_submit(&mRing);
+        mPending = 0;
+        sqe      = ::io_uring_get_sqe(&mRing);
+    }
+    return sqe;
+}
+
+auto UringTransport::sendto(std::span<const std::byte> buffer, const IPEndpoint &endpoint) -> IoTask<size_t> {
+    auto send = std::make_unique<Send>();
+    send->data              = std::vector<std::byte>(buffer.begin(), buffer.end());
+    send->endpoint          = endpoint;
+    send->iov.iov_base      = send->data.data();
+    send->iov.iov_len       = send->data.size();
+    send->msg.msg_name      = (void *) &send->endpoint.cast<::sockaddr>();
+    send->msg.msg_namelen   = send->endpoint.length();
+    send->msg.msg_iov       = &send->iov;
+    send->msg.msg_iovlen    = 1;
+
+    auto sqe = getSqe();
+    if (!sqe) {
+        co_return unexpected(Error::Unknown);
+    }
+    auto seq = mSendSeq++;
+    ::io_uring_prep_sendmsg(sqe, mClient.socket().get(), &send->msg, 0);
+    ::io_uring_sqe_set_data64(sqe, seq);
+    mInflight.emplace(seq, std::move(send));
+    mPending += 1;
+    if (!mFlushing) { // Submit all the sends of this turn at once
+        mFlushing = true;
+        mScope.spawn(flushThread());
+    }
+    co_return buffer.size();
+}
+
+auto UringTransport::recvfrom(std::span<std::byte> buffer, IPEndpoint &endpoint) -> IoTask<size_t> {
+    while (mRecvQueue.empty()) {
+        mRecvEvent.clear();
+        if (auto res = co_await mRecvEvent; !res) {
+            co_return unexpected(Error::Canceled);
+        }
+    }
+    auto datagram = std::move(mRecvQueue.front());
+    mRecvQueue.pop_front();
+    auto n   = std::min(buffer.size(), datagram.data.size());
+    endpoint = datagram.endpoint;
+    ::memcpy(buffer.data(), datagram.data.data(), n);
+    co_return n;
+}
+
+auto UringTransport::localEndpoint() -> Result<IPEndpoint> {
+    return mClient.localEndpoint();
+}
+
+auto UringTransport::flushThread() -> Task<void> {
+    if (auto res = co_await sleep(std::chrono::milliseconds(0)); !res) {
+        co_return;
+    }
+    if (mPending > 0) {
+        ::io_uring_submit(&mRing);
+        mPending = 0;
+    }
+    mFlushing = false;
+}
+
+auto UringTransport::reapThread() -> Task<void> {
+    while (true) {
+        if (auto res = co_await mCtxt.poll(mEventDesc, PollEvent::In); !res) {
+            co_return;
+        }
+        uint64_t value = 0;
+        if (::read(mEventFd, &value, sizeof(value)) < 0 && errno != EAGAIN) { // Reset the counter
+            URING_LOG("Failed to read the eventfd: {}", ::strerror(errno));
+        }
+
+        unsigned         head  = 0;
+        unsigned         count = 0;
+        ::io_uring_cqe  *cqe   = nullptr;
+        io_uring_for_each_cqe(&mRing, head, cqe) {
+            if (cqe->user_data == URING_RECV_TAG) {
+                handleRecv(cqe);
+            }
+            else if (auto it = mInflight.find(cqe->user_data); it != mInflight.end()) {
+                if (cqe->res < 0) {
+                    URING_LOG("sendmsg to {} failed: {}", it->second->endpoint, ::strerror(-cqe->res));
+                }
+                mInflight.erase(it);
+            }
+            count += 1;
+        }
+        ::io_uring_cq_advance(&mRing, count);
+        if (mPending > 0) { // The recv rearmed in the handling
+            ::io_uring_submit(&mRing);
+            mPending = 0;
+        }
+    }
+}
+
+auto UringTransport::handleRecv(const ::io_uring_cqe *cqe) -> void {
+    bool more = cqe->flags & IORING_CQE_F_MORE;
+    if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+        auto bid = uint16_t(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        auto buf = mBuffers.data() + bid * URING_BUFFER_SIZE;
+        auto out = ::io_uring_recvmsg_validate(buf, cqe->res, &mRecvMsg);
+        if (out && !(out->flags & MSG_TRUNC) && mRecvQueue.size() < URING_MAX_QUEUE) {
+            auto endpoint = IPEndpoint::fromRaw(::io_uring_recvmsg_name(out), out->namelen);
+            auto payload  = static_cast<const std::byte *>(::io_uring_recvmsg_payload(out, &mRecvMsg));
+            auto len      = ::io_uring_recvmsg_payload_length(out, cqe->res, &mRecvMsg);
+            if (endpoint) {
+                mRecvQueue.push_back({std::vector<std::byte>(payload, payload + len), *endpoint});
+                mRecvEvent.set();
+            }
+        }
+        // Give the buffer back to the kernel
+        ::io_uring_buf_ring_add(mBufRing, buf, URING_BUFFER_SIZE, bid, ::io_uring_buf_ring_mask(URING_BUFFERS), 0);
+        ::io_uring_buf_ring_advance(mBufRing, 1);
+    }
+    else if (cqe->res < 0 && cqe->res != -ENOBUFS) { // ENOBUFS: all the buffers are in use, just rearm
+        URING_LOG("recvmsg failed: {}", ::strerror(-cqe->res));
+    }
+    if (!more && !mRearming && !armRecv()) { // The multishot is terminated, submit it again
+        URING_LOG("Failed to rearm the recvmsg, retry later");
+        mRearming = true;
+        mScope.spawn(rearmThread());
+    }
+}
+
+auto UringTransport::rearmThread() -> Task<void> {
+    // Without the recv armed nothing is received, so keep trying
+    while (!armRecv()) {
+        if (auto res = co_await sleep(URING_REARM_DELAY); !res) {
+            co_return;
+        }
+    }
+    ::io_uring_submit(&mRing);
+    mPending  = 0;
+    mRearming = false;
+}
+#endif
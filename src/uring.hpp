@@ -0,0 +1,90 @@
+/**
+ * @file uring.hpp
+ * @author BusyStudent (fyw90mc@gmail.com)
+ * @brief The io_uring datagram transport for the udp hot path (linux only, needs liburing)
+ * @version 0.1
+ * @date 2025-06-05
+ *
+ * @copyright Copyright (c) 2025
+ *
+ */
+#pragma once
+
+#include "transport.hpp"
+
+#if defined(__linux__) && __has_include(<liburing.h>)
+#define DHT_HAS_URING 1
+
+#include <liburing.h>
+#include <sys/socket.h>
+#include <unordered_map>
+#include <memory>
+#include <deque>
+
+/**
+ * @brief The transport on the udp socket driven by io_uring
+ *
+ * The receiving uses one multishot recvmsg with a provided buffer ring, so the kernel fills the datagrams without
+ * any syscall per packet. The sends are queued as sendmsg sqes and submitted once per event loop turn. The ring
+ * notifies the event loop by the registered eventfd
+ *
+ */
+class UringTransport final : public DatagramTransport {
+public:
+    UringTransport(const UringTransport &) = delete;
+    ~UringTransport();
+
+    /**
+     * @brief Create the transport on the socket
+     *
+     * @param ctxt The io context to poll the eventfd
+     * @param client The bound udp socket
+     * @return std::unique_ptr<UringTransport> nullptr on the kernel lacks the support (multishot recvmsg, buffer ring)
+     */
+    static auto create(IoContext &ctxt, UdpClient &client) -> std::unique_ptr<UringTransport>;
+
+    auto sendto(std::span<const std::byte> buffer, const IPEndpoint &endpoint) -> IoTask<size_t> override;
+    auto recvfrom(std::span<std::byte> buffer, IPEndpoint &endpoint) -> IoTask<size_t> override;
+    auto localEndpoint() -> Result<IPEndpoint> override;
+private:
+    struct Send {
+        std::vector<std::byte> data;
+        IPEndpoint             endpoint;
+        ::iovec                iov;
+        ::msghdr               msg;
+    };
+
+    struct Datagram {
+        std::vector<std::byte> data;
+        IPEndpoint             endpoint;
+    };
+
+    UringTransport(IoContext &ctxt, UdpClient &client);
+
+    auto init() -> bool;
+    auto armRecv() -> bool; // Submit the multishot recvmsg
+    auto getSqe() -> ::io_uring_sqe *; // Get a sqe, submit the pending ones if the queue is full
+    auto reapThread() -> Task<void>; // Wait the eventfd and handle the completions
+    auto flushThread() -> Task<void>; // Submit the queued sends at the end of the turn
+    auto handleRecv(const ::io_uring_cqe *cqe) -> void;
+    auto rearmThread() -> Task<void>; // Retry arming the recv until it succeeds
+
+    IoContext             &mCtxt;
+    UdpClient             &mClient;
+    TaskScope              mScope;
+    ::io_uring             mRing {};
+    bool                   mRingInited = false;
+    ::io_uring_buf_ring   *mBufRing    = nullptr;
+    std::vector<std::byte> mBuffers;     // The memory of the provided buffers
+    ::msghdr               mRecvMsg {};  // The template of the multishot recvmsg
+    int                    mEventFd    = -1;
+    IoDescriptor          *mEventDesc  = nullptr;
+    uint64_t               mSendSeq    = 2; // The user data of the next send
+    size_t                 mPending    = 0; // The sqes not submitted yet
+    bool                   mFlushing   = false;
+    bool                   mRearming   = false; // The rearm of the recv failed, retrying
+    std::unordered_map<uint64_t, std::unique_ptr<Send>> mInflight; // The sends not completed, by the user data
+    std::deque<Datagram>   mRecvQueue;
+    Event                  mRecvEvent; // The receive queue is not empty
+};
+#endif
@@ -72,7 +72,7 @@ public:
     utp_socket *sock = nullptr;
 };
 
-UtpContext::UtpContext(UdpClient &client) : mClient(client) {
+UtpContext::UtpContext(DatagramTransport &transport) : mTransport(transport) {
     mCtxt = utp_init(2);
     utp_context_set_userdata(mCtxt, this);
     utp_set_callback(mCtxt, UTP_SENDTO, [](utp_callback_arguments *args) -> uint64 {
@@ -136,7 +136,7 @@ auto UtpContext::processUdp(std::span<const std::byte> buffer, const IPEndpoint
 
 auto UtpContext::onSendto(std::pmr::vector<std::byte> buffer, IPEndpoint target) -> Task<void> {
     UTP_LOG("Send data to {}", target);
-    co_await mClient.sendto(buffer, target);
+    co_await mTransport.sendto(buffer, target);
 }
 
 
@@ -4,11 +4,12 @@
 #include <memory>
 #include <ilias/sync.hpp>
 #include "net.hpp"
+#include "transport.hpp"
 #include "../libutp/utp.h"
 
 class UtpContext {
 public:
-    UtpContext(UdpClient &client);
+    UtpContext(DatagramTransport &transport);
     UtpContext(const UtpContext &) = delete;
     ~UtpContext();
 
@@ -24,9 +25,9 @@ private:
     auto onSendto(std::pmr::vector<std::byte> buffer, IPEndpoint target) -> Task<void>;
 
     std::pmr::unsynchronized_pool_resource mBufferResource;
-    utp_context *mCtxt = nullptr;
-    UdpClient   &mClient;
-    TaskScope    mScope;
+    utp_context       *mCtxt = nullptr;
+    DatagramTransport &mTransport;
+    TaskScope          mScope;
 friend class UtpClient;
 };
 
@@ -2,7 +2,27 @@
 #include "src/nodeid.hpp"
 #include "src/route.hpp"
 #include "src/krpc.hpp"
+#include "src/hashstore.hpp"
+#include "src/hashindex.hpp"
+#include "src/peerstore.hpp"
+#include "src/token.hpp"
+#include "src/ratelimit.hpp"
+#include "src/secureid.hpp"
+#include "src/nodeset.hpp"
+#include "src/contactcache.hpp"
+#include "src/coverage.hpp"
+#include "src/adaptivelimit.hpp"
+#include "src/samplepolicy.hpp"
+#include "src/sampleschedule.hpp"
+#include "src/transport.hpp"
+#include "src/session.hpp"
+#include "src/getpeersmanager.hpp"
+#include "src/bloomfilter.hpp"
+#include "bench/simnet.hpp"
+#include <ilias/platform.hpp>
 #include <gtest/gtest.h>
+#include <filesystem>
+#include <set>
 
 TEST(Bencode, decode) {
     auto str = BenObject::decode("1:a");
@@ -167,12 +187,826 @@ TEST(Kad, Route) {
     }
 }
 
+TEST(Kad, ResetId) {
+    auto id = NodeId::rand();
+    RoutingTable table(id);
+    std::vector<NodeEndpoint> nodes;
+    while (nodes.size() < KBUCKET_SIZE + 4) { // The farthest bucket full, the rest are pending
+        auto other = NodeId::rand();
+        if (other.distanceExp(id) == 160) {
+            auto endpoint = IPEndpoint::fromString(std::format("127.0.0.1:{}", 1000 + nodes.size())).value();
+            nodes.push_back({other, endpoint});
+            table.updateNode(nodes.back());
+        }
+    }
+    ASSERT_EQ(table.size(), KBUCKET_SIZE);
+    size_t changed = 0;
+    table.setOnNodeChanged([&]() { changed += 1; });
+    table.resetId(id);
+    ASSERT_EQ(changed, 1); // Notified once
+    ASSERT_EQ(table.size(), KBUCKET_SIZE);
+
+    // The pending ones are kept, a dropped node is replaced by one of them
+    table.markBadNode(nodes.front());
+    table.markBadNode(nodes.front());
+    ASSERT_EQ(table.size(), KBUCKET_SIZE);
+}
+
 TEST(Kad, Distance) {
     auto id1 = NodeId::fromHex("0019c6bcd5ebd44b91b768fcd94c5ff8b80dab14");
     auto id2 = NodeId::fromHex("0000013aa3b5a4def0df03e27646f3b2666a8e85");
     ASSERT_TRUE(id1 > id2);
 }
 
+TEST(HashStore, InsertErase) {
+    InfoHashStore store;
+    std::vector<InfoHash> hashes;
+    for (size_t i = 0; i < 10000; i++) {
+        hashes.push_back(InfoHash::rand());
+        ASSERT_TRUE(store.insert(hashes.back()));
+    }
+    ASSERT_FALSE(store.insert(hashes.front()));
+    ASSERT_FALSE(store.insert(InfoHash::zero()));
+    ASSERT_EQ(store.size(), hashes.size());
+    for (size_t i = 0; i < hashes.size(); i += 2) {
+        store.erase(hashes[i]);
+    }
+    for (size_t i = 0; i < hashes.size(); i++) {
+        ASSERT_EQ(store.contains(hashes[i]), i % 2 == 1);
+    }
+}
+
+TEST(HashStore, MemoryLimit) {
+    InfoHashStore store {1024 * 1024};
+    InfoHash last;
+    for (size_t i = 0; i < 500000; i++) {
+        last = InfoHash::rand();
+        store.insert(last);
+    }
+    ASSERT_LE(store.memoryUsage(), 1024 * 1024);
+    ASSERT_TRUE(store.contains(last)); // The newest one must be remembered
+}
+
+static auto indexPath(const char *name) -> std::string {
+    auto path = (std::filesystem::temp_directory_path() / name).string();
+    std::filesystem::remove(path);
+    return path;
+}
+
+TEST(HashIndex, UpsertFind) {
+    auto path  = indexPath("dht_test_upsert.index");
+    auto index = InfoHashIndex::open(path.c_str());
+    ASSERT_TRUE(index);
+    auto hash = InfoHash::rand();
+    ASSERT_FALSE(index->find(hash));
+    ASSERT_TRUE(index->touch(hash, InfoHashIndex::Sample));
+    ASSERT_EQ(index->touch(hash, InfoHashIndex::Announce)->seenCount, 2);
+    index->setState(hash, InfoHashIndex::Fetched);
+    auto record = index->find(hash);
+    ASSERT_TRUE(record);
+    ASSERT_EQ(record->source, InfoHashIndex::Sample); // The first source is kept
+    ASSERT_EQ(record->state, InfoHashIndex::Fetched);
+    ASSERT_EQ(index->size(), 1);
+    ASSERT_FALSE(index->touch(InfoHash::zero(), InfoHashIndex::Sample));
+    index.reset();
+    std::filesystem::remove(path);
+}
+
+TEST(HashIndex, GrowReopen) {
+    auto path  = indexPath("dht_test_grow.index");
+    auto index = InfoHashIndex::open(path.c_str());
+    ASSERT_TRUE(index);
+    auto capacity = index->capacity();
+    std::vector<InfoHash> hashes;
+    for (size_t i = 0; i < capacity; i++) { // Over the 0.75 load factor
+        hashes.push_back(InfoHash::rand());
+        ASSERT_TRUE(index->touch(hashes.back(), InfoHashIndex::Sample));
+    }
+    ASSERT_EQ(index->capacity(), capacity * 2);
+    ASSERT_FALSE(std::filesystem::exists(path + ".tmp"));
+    index.reset();
+
+    index = InfoHashIndex::open(path.c_str());
+    ASSERT_TRUE(index);
+    ASSERT_EQ(index->size(), hashes.size());
+    for (auto &hash : hashes) {
+        ASSERT_TRUE(index->find(hash));
+    }
+    index.reset();
+    std::filesystem::remove(path);
+}
+
+TEST(HashIndex, PrefixScan) {
+    auto path  = indexPath("dht_test_scan.index");
+    auto index = InfoHashIndex::open(path.c_str());
+    ASSERT_TRUE(index);
+    std::vector<InfoHash> hashes;
+    for (size_t i = 0; i < 10000; i++) {
+        hashes.push_back(InfoHash::rand());
+        index->touch(hashes.back(), InfoHashIndex::Sample);
+    }
+    auto prefix = hashes.front();
+    for (size_t bits : {0, 4, 8, 12, 20}) {
+        size_t expected = 0;
+        for (auto &hash : hashes) {
+            expected += (hash ^ prefix).clz() >= bits;
+        }
+        size_t count = 0;
+        index->scan(prefix, bits, [&](const InfoHashIndex::Record &record) {
+            EXPECT_GE((record.hash ^ prefix).clz(), bits);
+            count += 1;
+            return true;
+        });
+        ASSERT_EQ(count, expected) << "bits " << bits;
+    }
+
+    // Page through the whole index by the cursor, the record stopped at is visited again on the next page
+    size_t cursor = 0;
+    size_t pages  = 0;
+    std::set<InfoHash> visited;
+    while (cursor < index->capacity()) {
+        size_t count = 0;
+        cursor = index->scanFrom(cursor, [&](const InfoHashIndex::Record &record) {
+            if (count == 100) {
+                return false;
+            }
+            count += 1;
+            return visited.insert(record.hash).second;
+        });
+        pages += 1;
+    }
+    ASSERT_EQ(visited.size(), hashes.size());
+    ASSERT_EQ(pages, hashes.size() / 100);
+    index.reset();
+    std::filesystem::remove(path);
+}
+
+TEST(PeerStore, Caps) {
+    PeerStore store {std::chrono::minutes(30), 8, 20};
+    auto hash = InfoHash::rand();
+    for (int i = 0; i < 16; i++) {
+        ASSERT_TRUE(store.announce(hash, IPEndpoint::fromString(std::format("127.0.0.1:{}", 1000 + i)).value()));
+    }
+    ASSERT_EQ(store.count(hash), 8); // The oldest ones are replaced
+    ASSERT_TRUE(store.announce(hash, IPEndpoint::fromString("127.0.0.1:1015").value())); // Refresh
+    ASSERT_EQ(store.size(), 8);
+
+    auto other = InfoHash::rand();
+    for (int i = 0; i < 16; i++) {
+        store.announce(other, IPEndpoint::fromString(std::format("[::1]:{}", 1000 + i)).value());
+    }
+    ASSERT_EQ(store.size(), 16);
+    for (int i = 0; i < 4; i++) {
+        ASSERT_TRUE(store.announce(InfoHash::rand(), IPEndpoint::fromString("127.0.0.1:1").value()));
+    }
+    ASSERT_FALSE(store.announce(InfoHash::rand(), IPEndpoint::fromString("127.0.0.1:1").value())); // Full
+    ASSERT_EQ(store.size(), 20);
+    ASSERT_EQ(store.hashes(), 6);
+
+    std::mt19937 random {114514};
+    std::vector<IPEndpoint> peers;
+    ASSERT_EQ(store.pick(other, 5, random, peers), 5);
+    std::sort(peers.begin(), peers.end());
+    ASSERT_EQ(std::unique(peers.begin(), peers.end()), peers.end());
+    ASSERT_EQ(peers.front().family(), AF_INET6);
+    ASSERT_EQ(store.expire(), 0);
+
+    // Expired by the clock given
+    auto now = std::chrono::steady_clock::time_point {};
+    store.setClock([&]() { return now; });
+    ASSERT_TRUE(store.announce(hash, IPEndpoint::fromString("127.0.0.1:1000").value()));
+    now += std::chrono::minutes(32); // The ttl and the slot it was announced in
+    ASSERT_EQ(store.expire(), 1);
+    ASSERT_EQ(store.count(hash), 0);
+}
+
+TEST(PeerStore, Scrape) {
+    PeerStore store;
+    auto hash = InfoHash::rand();
+    PeerStore::ScrapeFilter seeds, peers;
+    ASSERT_FALSE(store.scrape(hash, seeds, peers));
+    store.announce(hash, IPEndpoint::fromString("1.2.3.4:1000").value(), true);
+    ASSERT_TRUE(store.scrape(hash, seeds, peers));
+    store.announce(hash, IPEndpoint::fromString("1.2.3.5:1000").value()); // Added to the built filters
+    store.announce(hash, IPEndpoint::fromString("1.2.3.6:1000").value());
+    ASSERT_TRUE(store.scrape(hash, seeds, peers));
+    ASSERT_TRUE(seeds.testIP(IPAddress::fromString("1.2.3.4").value()));
+    ASSERT_TRUE(peers.testIP(IPAddress::fromString("1.2.3.5").value()));
+    ASSERT_TRUE(peers.testIP(IPAddress::fromString("1.2.3.6").value()));
+    ASSERT_NEAR(peers.calculateEstimatedSize(), 2, 0.5);
+
+    std::mt19937 random {114514};
+    std::vector<IPEndpoint> values;
+    ASSERT_EQ(store.pick(hash, 50, random, values, true), 2); // noseed
+
+    // Round trip by the krpc
+    auto seedsBytes = seeds.toBytes();
+    auto reply = GetPeersReply {.transId = "aa", .id = NodeId::rand(), .token = "token"};
+    reply.bfsd.assign(reinterpret_cast<const char *>(seedsBytes.data()), seedsBytes.size());
+    reply.bfpe = reply.bfsd;
+    ASSERT_EQ(GetPeersReply::fromMessage(reply.toMessage()), reply);
+    auto query = GetPeersQuery {.transId = "aa", .id = NodeId::rand(), .infoHash = hash, .scrape = true, .noseed = true};
+    ASSERT_EQ(GetPeersQuery::fromMessage(query.toMessage()), query);
+}
+
+TEST(Token, Rotate) {
+    TokenManager tokens;
+    auto ip    = IPAddress::fromString("1.2.3.4").value();
+    auto other = IPAddress::fromString("::1").value();
+    auto token = tokens.generate(ip);
+    ASSERT_TRUE(tokens.verify(ip, token));
+    ASSERT_FALSE(tokens.verify(other, token));
+    ASSERT_FALSE(tokens.verify(ip, "token"));
+    tokens.rotate();
+    ASSERT_TRUE(tokens.verify(ip, token)); // The previous secret
+    ASSERT_NE(tokens.generate(ip), token);
+    tokens.rotate();
+    ASSERT_FALSE(tokens.verify(ip, token));
+
+    // Rotated by the clock given, two intervals later the token is gone
+    auto now = std::chrono::steady_clock::time_point {};
+    tokens.setClock([&]() { return now; });
+    token = tokens.generate(ip);
+    now  += std::chrono::minutes(6);
+    ASSERT_TRUE(tokens.verify(ip, token));
+    now  += std::chrono::minutes(6);
+    ASSERT_FALSE(tokens.verify(ip, token));
+}
+
+TEST(RateLimiter, BucketAndBlock) {
+    Blocklist   blocklist;
+    RateLimiter limiter {blocklist, {.ipBurst = 10, .subnetBurst = 15, .maxSources = 4, .blockAfter = 5}};
+    auto ip = IPAddress::fromString("1.2.3.4").value();
+    size_t allowed = 0;
+    for (int i = 0; i < 20; i++) {
+        allowed += limiter.allow(ip);
+    }
+    ASSERT_EQ(allowed, 10);
+    ASSERT_TRUE(blocklist.contains(ip)); // Denied 5 times in a row
+    allowed = 0;
+    for (int i = 0; i < 20; i++) {
+        allowed += limiter.allow(IPAddress::fromString("1.2.3.5").value());
+    }
+    ASSERT_EQ(allowed, 5); // The rest of the /24
+
+    for (int i = 0; i < 100; i++) {
+        limiter.allow(IPAddress::fromString(std::format("10.0.{}.1", i)).value());
+    }
+    ASSERT_EQ(limiter.sources(), 4); // The lru is bounded
+
+    // Unblocked by the clock given
+    auto now = std::chrono::steady_clock::time_point {};
+    blocklist.setClock([&]() { return now; });
+    blocklist.block(ip, std::chrono::minutes(1));
+    ASSERT_TRUE(blocklist.contains(ip));
+    now += std::chrono::minutes(2);
+    ASSERT_FALSE(blocklist.contains(ip));
+    ASSERT_EQ(blocklist.expire(), 1);
+}
+
+TEST(Kad, SecureId) {
+    // The test vectors of BEP42, only the first 21 bits and the last byte are defined
+    struct Vector {
+        const char *ip;
+        uint8_t     r;
+        uint32_t    prefix;
+    } vectors[] = {
+        {"124.31.75.21", 1, 0x5fbfbf}, {"21.75.31.124", 86, 0x5a3ce9}, {"65.23.51.170", 22, 0xa5d432},
+        {"84.124.73.14", 65, 0x1b0321}, {"43.213.53.83", 90, 0xe56f6c},
+    };
+    for (auto &vec : vectors) {
+        auto ip   = IPAddress::fromString(vec.ip).value();
+        auto id   = secureNodeId(ip, vec.r);
+        auto view = id.toStringView();
+        auto bits = uint32_t(uint8_t(view[0])) << 16 | uint32_t(uint8_t(view[1])) << 8 | uint8_t(view[2]);
+        ASSERT_EQ(bits & 0xfffff8, vec.prefix & 0xfffff8);
+        ASSERT_EQ(uint8_t(view[19]), vec.r);
+        ASSERT_TRUE(isSecureNodeId(id, ip));
+        ASSERT_FALSE(isSecureNodeId(NodeId::rand(), ip) && isSecureNodeId(NodeId::rand(), ip));
+    }
+    ASSERT_TRUE(isSecureNodeId(NodeId::rand(), IPAddress::fromString("192.168.1.1").value())); // Exempted
+    ASSERT_EQ(crc32c(std::as_bytes(std::span("123456789", 9))), 0xe3069283);
+
+    RoutingTable table {NodeId::rand()};
+    table.setSecureIdPolicy(RoutingTable::Require);
+    auto endpoint = IPEndpoint::fromString("124.31.75.21:6881").value();
+    ASSERT_EQ(table.updateNode({secureNodeId(endpoint.address()), endpoint}), RoutingTable::Added);
+    ASSERT_EQ(table.updateNode({NodeId::rand(), endpoint}), RoutingTable::Rejected);
+    ASSERT_TRUE(table.accepts({secureNodeId(endpoint.address()), endpoint}));
+    ASSERT_FALSE(table.accepts({NodeId::rand(), endpoint})); // Nor the contact cache
+    table.setSecureIdPolicy(RoutingTable::Prefer);
+    ASSERT_TRUE(table.accepts({NodeId::rand(), endpoint}));
+}
+
+TEST(Kad, DualStackNodes) {
+    // 19 v4 nodes are 494 bytes, the same as 13 v6 nodes, the family comes from the key
+    FindNodeReply reply {.transId = "aa", .id = NodeId::rand()};
+    for (int i = 0; i < 19; i++) {
+        reply.nodes.push_back({NodeId::rand(), IPEndpoint::fromString(std::format("1.2.3.{}:6881", i)).value()});
+    }
+    for (int i = 0; i < 2; i++) {
+        reply.nodes.push_back({NodeId::rand(), IPEndpoint::fromString(std::format("[2001:db8::{}]:6881", i)).value()});
+    }
+    auto msg = reply.toMessage();
+    ASSERT_EQ(msg["r"]["nodes"].toString().size(), 494);
+    ASSERT_EQ(msg["r"]["nodes6"].toString().size(), 2 * 38);
+    auto decoded = FindNodeReply::fromMessage(BenObject::decode(msg.encode())).value();
+    ASSERT_EQ(decoded.nodes, reply.nodes);
+    ASSERT_FALSE(decodeNodes(std::string(38, 'x'), AF_INET).has_value());
+
+    // BEP32 want
+    FindNodeQuery query {.transId = "aa", .id = NodeId::rand(), .targetId = NodeId::rand(), .want = WantNodes4 | WantNodes6};
+    ASSERT_EQ(FindNodeQuery::fromMessage(query.toMessage()).value(), query);
+    query.want = WantDefault;
+    ASSERT_FALSE(query.toMessage()["a"].hasKey("want"));
+    ASSERT_EQ(FindNodeQuery::fromMessage(query.toMessage())->want, WantDefault);
+}
+
+TEST(Kad, CompactEndpoint) {
+    auto v4 = IPEndpoint::fromString("1.2.3.4:6881").value();
+    auto v6 = IPEndpoint::fromString("[2001:db8::1]:51413").value();
+    CompactEndpoint c4 = v4;
+    CompactEndpoint c6 = v6;
+    ASSERT_EQ(c4.bytes().size(), 6);
+    ASSERT_EQ(c6.bytes().size(), 18);
+    ASSERT_EQ(c4.toStringView(), encodeIPEndpoint(v4)); // Same as the wire form
+    ASSERT_EQ(c6.toStringView(), encodeIPEndpoint(v6));
+    ASSERT_EQ(c4.toEndpoint(), v4);
+    ASSERT_EQ(c6.toEndpoint(), v6);
+    ASSERT_EQ(c4.port(), 6881);
+    ASSERT_EQ(c6.family(), AF_INET6);
+    ASSERT_EQ(CompactEndpoint::fromBytes(c6.toStringView()), c6);
+    ASSERT_FALSE(CompactEndpoint::fromBytes(std::string_view("12345")));
+    ASSERT_FALSE(CompactEndpoint().isValid());
+    ASSERT_EQ(CompactEndpoint().address(), IPAddress {}); // Not the wrapped size of the empty one
+    ASSERT_EQ(CompactEndpoint().port(), 0);
+
+    // Equal endpoints are equal and hash the same, the port matters
+    CompactEndpoint other = IPEndpoint::fromString("1.2.3.4:6882").value();
+    ASSERT_EQ(CompactEndpoint(v4), c4);
+    ASSERT_EQ(std::hash<CompactEndpoint>()(CompactEndpoint(v4)), std::hash<CompactEndpoint>()(c4));
+    ASSERT_NE(other, c4);
+    ASSERT_TRUE(c4 < other);
+    ASSERT_LT(sizeof(NodeEndpoint), 20 + sizeof(IPEndpoint));
+}
+
+TEST(Kad, NodeSet) {
+    NodeSet set;
+    std::vector<NodeEndpoint> nodes;
+    for (int i = 0; i < 1000; ++i) { // Grow it a few times
+        CompactEndpoint ip = IPEndpoint(IPAddress::fromString("10.0.0.1").value(), uint16_t(1000 + i));
+        nodes.push_back({NodeId::rand(), ip});
+        auto [index, inserted] = set.insert(nodes.back());
+        ASSERT_TRUE(inserted);
+        ASSERT_EQ(index, i);
+    }
+    ASSERT_EQ(set.size(), 1000);
+    for (int i = 0; i < 1000; ++i) {
+        ASSERT_TRUE(set.contains(nodes[i]));
+        ASSERT_EQ(set[i], nodes[i]); // The index is stable
+        auto [index, inserted] = set.insert(nodes[i]);
+        ASSERT_FALSE(inserted);
+        ASSERT_EQ(index, i);
+    }
+
+    // Same id from another endpoint and the zero id are different nodes
+    CompactEndpoint other = IPEndpoint::fromString("10.0.0.2:1000").value();
+    ASSERT_FALSE(set.contains({nodes[0].id, other}));
+    ASSERT_TRUE(set.insert({NodeId {}, nodes[0].ip}).second);
+    ASSERT_EQ(set.nodes().size(), 1001);
+
+    set.clear();
+    ASSERT_EQ(set.size(), 0);
+    ASSERT_FALSE(set.contains(nodes[0]));
+}
+
+TEST(Kad, ContactCache) {
+    ContactCache cache(8, 4);
+    CompactEndpoint ip = IPEndpoint::fromString("10.0.0.1:6881").value();
+    std::vector<NodeEndpoint> nodes;
+    for (int i = 0; i < 500; ++i) {
+        nodes.push_back({NodeId::rand(), ip});
+        cache.add(nodes.back());
+    }
+    cache.add(nodes.front()); // Refresh, not a new one
+    ASSERT_LE(cache.size(), 256 * 4);
+    ASSERT_GT(cache.size(), 256);
+
+    // Sorted by the distance, and a cached id finds itself first
+    auto target  = NodeId::rand();
+    auto closest = cache.findClosestNodes(target, 8);
+    ASSERT_EQ(closest.size(), 8);
+    ASSERT_TRUE(std::is_sorted(closest.begin(), closest.end(), [&](const NodeEndpoint &a, const NodeEndpoint &b) {
+        return a.id.distance(target) < b.id.distance(target);
+    }));
+    ASSERT_EQ(cache.findClosestNodes(closest.front().id, 1).front(), closest.front());
+
+    cache.remove(closest.front());
+    ASSERT_NE(cache.findClosestNodes(target, 1).front(), closest.front());
+
+    // The oldest one in the full bucket is replaced
+    ContactCache small(0, 2);
+    small.add(nodes[0]);
+    small.add(nodes[1]);
+    small.add(nodes[2]);
+    ASSERT_EQ(small.size(), 2);
+    ASSERT_EQ(small.findClosestNodes(target, 8).size(), 2);
+    small.clear();
+    ASSERT_TRUE(small.findClosestNodes(target, 8).empty());
+
+    // Expired by the clock given
+    auto now = std::chrono::steady_clock::time_point {};
+    small.setClock([&]() { return now; });
+    small.add(nodes[0]);
+    ASSERT_EQ(small.findClosestNodes(target, 8).size(), 1);
+    now += std::chrono::minutes(10);
+    ASSERT_TRUE(small.findClosestNodes(target, 8).empty());
+}
+
+TEST(Kad, KeyspaceCoverage) {
+    KeyspaceCoverage coverage(4);
+    std::mt19937 random {42};
+    ASSERT_EQ(coverage.regions(), 16);
+
+    // Cover all the regions but one, the target must fall in it
+    auto hole = NodeId::rand();
+    for (int i = 0; i < 1000; ++i) {
+        auto id = NodeId::rand();
+        if (coverage.prefixOf(id) != coverage.prefixOf(hole)) {
+            coverage.add(id, KeyspaceCoverage::Sampled);
+        }
+    }
+    ASSERT_EQ(coverage.coveredRegions(), 15);
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_EQ(coverage.prefixOf(coverage.randomTarget(random)), coverage.prefixOf(hole));
+    }
+
+    // The known nodes count less than the sampled ones, and removing them restores the score
+    coverage.add(hole, KeyspaceCoverage::Known);
+    ASSERT_EQ(coverage.score(coverage.prefixOf(hole)), 1);
+    coverage.remove(hole, KeyspaceCoverage::Known);
+    coverage.add(hole, KeyspaceCoverage::Sampled);
+    ASSERT_EQ(coverage.score(coverage.prefixOf(hole)), 2);
+    ASSERT_EQ(coverage.coveredRegions(), 16);
+    coverage.remove(hole, KeyspaceCoverage::Sampled);
+    ASSERT_EQ(coverage.coveredRegions(), 15);
+
+    coverage.clear();
+    ASSERT_EQ(coverage.coveredRegions(), 0);
+}
+
+TEST(Kad, SampleSchedule) {
+    SampleSchedule schedule;
+    std::vector<std::shared_ptr<SampleNode>> nodes;
+    auto add = [&](uint64_t timeout, double yield) {
+        auto node     = std::make_shared<SampleNode>();
+        node->timeout = timeout;
+        node->yield   = yield;
+        nodes.push_back(node);
+        schedule.push(node);
+        return node;
+    };
+
+    // 1000 nodes not due yet, popping the due ones must not touch them
+    for (int i = 0; i < 1000; ++i) {
+        add(1000 + i, 100);
+    }
+    auto low  = add(10, 1);
+    auto high = add(20, 5);
+    auto mid  = add(30, 3);
+    ASSERT_EQ(schedule.nextTimeout(), 10);
+    ASSERT_EQ(schedule.popDue(5), nullptr);
+    ASSERT_EQ(schedule.size(), 1003);
+
+    // All due at 100, the highest yield first, only the due ones left the heap
+    ASSERT_EQ(schedule.popDue(100), high);
+    ASSERT_EQ(schedule.size(), 1000);
+    high->status = SampleNode::Sampling;
+    ASSERT_EQ(schedule.popDue(100), mid);
+    ASSERT_EQ(schedule.popDue(100), low);
+    ASSERT_EQ(schedule.popDue(100), nullptr);
+
+    // The stale entries are skipped, the node rescheduled is popped by its new timeout
+    high->status  = SampleNode::NoStatus;
+    high->timeout = 50;
+    schedule.push(high);
+    mid->timeout = 60;
+    schedule.push(mid);
+    mid->timeout = 5000; // The entry of 60 is stale now
+    schedule.push(mid);
+    ASSERT_EQ(schedule.popDue(100), high);
+    ASSERT_EQ(schedule.popDue(100), nullptr);
+
+    // Remove most of the nodes, the heap is compacted to the live ones
+    for (size_t i = 0; i < 900; ++i) {
+        nodes[i]->listed = false;
+    }
+    schedule.compact(2000);
+    ASSERT_EQ(schedule.size(), 1001);
+    schedule.compact(101);
+    ASSERT_EQ(schedule.size(), 101);
+    ASSERT_EQ(schedule.nextTimeout(), 1900);
+
+    schedule.clear();
+    ASSERT_EQ(schedule.size(), 0);
+    ASSERT_EQ(schedule.nextTimeout(), 0);
+}
+
+TEST(Kad, AdaptiveLimit) {
+    AdaptiveLimit limit({.minLimit = 4, .maxLimit = 64, .initialLimit = 10});
+    ASSERT_EQ(limit.limit(), 10);
+
+    // Grow about one per window on the fast replies
+    for (int i = 0; i < 200; ++i) {
+        limit.onSuccess(std::chrono::milliseconds(100));
+    }
+    auto grown = limit.limit();
+    ASSERT_GT(grown, 20);
+    ASSERT_LE(grown, 64);
+
+    // The slow replies don't grow it
+    for (int i = 0; i < 200; ++i) {
+        limit.onSuccess(std::chrono::seconds(5));
+    }
+    ASSERT_EQ(limit.limit(), grown);
+
+    // A few losses among the replies are the dead nodes, ignore them
+    limit.onLoss();
+    ASSERT_EQ(limit.limit(), grown);
+
+    // Shrink on the losses, once per window, never below the min
+    for (int i = 0; i < 20; ++i) {
+        limit.onLoss();
+    }
+    ASSERT_LT(limit.limit(), grown);
+    ASSERT_GT(limit.limit(), grown / 2);
+    for (int i = 0; i < 1000; ++i) {
+        limit.onLoss();
+    }
+    ASSERT_EQ(limit.limit(), 4);
+    ASSERT_LT(limit.successRate(), 0.1f);
+
+    // Sample a population with 40% of the nodes dead (never replied), the limit isn't collapsed by them
+    AdaptiveLimit sample;
+    std::mt19937  random {42};
+    for (int i = 0; i < 2000; ++i) {
+        if (random() % 10 < 4) {
+            sample.onLoss(false);
+        }
+        else {
+            sample.onSuccess(std::chrono::milliseconds(200));
+        }
+    }
+    ASSERT_GE(sample.limit(), sample.config().initialLimit);
+}
+
+TEST(Kad, SamplePolicy) {
+    using namespace std::chrono_literals;
+    SamplePolicy policy;
+
+    // The yield follows the new hashes
+    double yield = policy.targetYield;
+    for (int i = 0; i < 20; ++i) {
+        yield = policy.nextYield(yield, 0);
+    }
+    ASSERT_LT(yield, 0.1);
+    ASSERT_NEAR(policy.nextYield(0, 10), 10 * policy.yieldAlpha, 1e-9);
+
+    // No yield -> max, target yield -> min, and the interval of the node is respected
+    ASSERT_EQ(policy.resampleInterval(0, 0s, 20, 20), policy.maxInterval);
+    ASSERT_EQ(policy.resampleInterval(policy.targetYield, 0s, 20, 20), policy.minInterval);
+    ASSERT_EQ(policy.resampleInterval(policy.targetYield, 1h, 20, 20), 1h);
+    ASSERT_EQ(policy.resampleInterval(policy.targetYield, 24h, 20, 20), 24h); // Over maxInterval, still respected
+    auto low  = policy.resampleInterval(1, 0s, 20, 20);
+    auto high = policy.resampleInterval(5, 0s, 20, 20);
+    ASSERT_LT(high, low);
+
+    // The node has more than it returned, ask it sooner
+    ASSERT_LT(policy.resampleInterval(1, 0s, 20, 2000), low);
+    ASSERT_EQ(policy.resampleInterval(policy.targetYield, 0s, 20, 2000), policy.minInterval);
+
+    // Back off on the failures
+    ASSERT_EQ(policy.retryDelay(1), policy.retryInterval);
+    ASSERT_EQ(policy.retryDelay(3), policy.retryInterval * 4);
+    ASSERT_EQ(policy.retryDelay(100), policy.maxInterval);
+}
+
+TEST(Session, SnapshotRoundTrip) {
+    SimContext ctxt;
+    ctxt.install();
+    SimNetwork network(ctxt, {});
+    auto path = (std::filesystem::temp_directory_path() / "dht_test_session.cache").string();
+    auto id   = NodeId::rand();
+    auto sort = [](std::vector<NodeEndpoint> nodes) {
+        std::sort(nodes.begin(), nodes.end(), [](auto &a, auto &b) { return a.id < b.id; });
+        return nodes;
+    };
+    std::vector<NodeEndpoint> saved;
+    {
+        DhtSession session(ctxt, id, network.addNode());
+        for (int i = 0; i < 500; i++) {
+            auto endpoint = IPEndpoint::fromString(std::format("1.2.{}.{}:6881", i / 250, i % 250 + 1)).value();
+            session.routingTable().updateNode({NodeId::rand(), endpoint});
+        }
+        saved = sort(session.routingTable().nodes());
+        session.saveFile(path.c_str());
+    }
+
+    DhtSession session(ctxt, id, network.addNode());
+    size_t     changed = 0;
+    session.routingTable().setOnNodeChanged([&]() { changed += 1; });
+    session.loadFile(path.c_str());
+    ASSERT_EQ(changed, 1); // Restored in one batch
+    ASSERT_EQ(sort(session.routingTable().nodes()), saved);
+    for (auto &node : session.routingTable().rawNodes()) {
+        ASSERT_EQ(node.state, Node::Questionable);
+    }
+
+    // A restored node survives one lost ping, and is dropped on the second
+    auto node = saved.front();
+    session.routingTable().markBadNode(node);
+    ASSERT_EQ(session.routingTable().size(), saved.size());
+    session.routingTable().markBadNode(node);
+    ASSERT_EQ(session.routingTable().size(), saved.size() - 1);
+    std::filesystem::remove(path);
+}
+
+TEST(Session, WarmStart) {
+    // The fresh node restored the nodes of a live network, or the nodes all gone since the last run
+    for (bool alive : {true, false}) {
+        SimContext ctxt;
+        ctxt.install();
+        SimNetwork                               network(ctxt, {.loss = 0});
+        std::vector<std::unique_ptr<DhtSession>> sessions;
+        TaskScope                                scope(ctxt);
+        auto addSession = [&]() -> DhtSession & {
+            auto &transport = network.addNode();
+            auto &session   = *sessions.emplace_back(std::make_unique<DhtSession>(ctxt, NodeId::rand(), transport));
+            session.setRandomSearch(false);
+            session.setDnsSeeds(false);
+            session.setClock([&ctxt]() { return ctxt.timePoint(); });
+            transport.setHandler([&](std::vector<std::byte> buffer, const IPEndpoint &from) {
+                scope.spawn([&session, buffer = std::move(buffer), from]() -> Task<void> {
+                    co_await session.processUdp(buffer, from);
+                });
+            });
+            return session;
+        };
+        std::vector<NodeEndpoint> endpoints;
+        for (size_t i = 0; i < 64; i++) {
+            auto &session = addSession();
+            endpoints.push_back({session.id(), network.nodes().back()->localEndpoint().value()});
+        }
+        for (size_t i = 0; i < endpoints.size(); i++) {
+            for (size_t j = 0; j < endpoints.size(); j++) {
+                if (i != j) {
+                    sessions[i]->routingTable().updateNode(endpoints[j]);
+                }
+            }
+        }
+        // The seed is known by no one, it only gets queries if the fresh node falls back to bootstrap
+        auto &seed = addSession();
+        auto &seedTransport = *network.nodes().back();
+        for (auto &endpoint : endpoints) {
+            seed.routingTable().updateNode(endpoint);
+        }
+
+        auto &fresh = addSession();
+        std::vector<Node> restored;
+        for (auto &endpoint : endpoints) {
+            restored.push_back({
+                .lastSeen = fresh.now() - std::chrono::hours(1),
+                .endpoint = endpoint,
+                .state    = Node::Questionable,
+            });
+        }
+        fresh.routingTable().restoreNodes(restored);
+        fresh.addBootstrapEndpoint(seedTransport.localEndpoint().value());
+        for (size_t i = 0; i < endpoints.size() && !alive; i++) {
+            network.nodes()[i]->setOnline(false);
+        }
+        bool done    = false;
+        auto elapsed = std::chrono::milliseconds(0);
+        fresh.setOnBootstrapProgress([&](const DhtSession::BootstrapProgress &progress) {
+            done    = progress.done;
+            elapsed = progress.elapsed;
+        });
+        scope.spawn(&DhtSession::start, &fresh);
+        ctxt.runUntil([&]() { return done || ctxt.now() > std::chrono::minutes(30); });
+        EXPECT_TRUE(done);
+        EXPECT_EQ(seedTransport.sent() > 0, !alive) << "alive " << alive;
+        EXPECT_LE(elapsed, ctxt.now()); // Timed by the virtual clock, the timeouts of the dead nodes cost no real time
+        EXPECT_TRUE(alive || elapsed >= std::chrono::seconds(10));
+
+        scope.cancel();
+        scope.wait();
+    }
+}
+
+TEST(Session, ScrapeEstimate) {
+    // Two nodes close to the hash reply the scripted bloom filters, the estimate is the size of their union
+    SimContext ctxt;
+    ctxt.install();
+    SimNetwork network(ctxt, {.loss = 0});
+    TaskScope  scope(ctxt);
+    auto       hash = InfoHash::rand();
+
+    auto &transport = network.addNode();
+    DhtSession session(ctxt, NodeId::rand(), transport);
+    session.setClock([&ctxt]() { return ctxt.timePoint(); });
+    transport.setHandler([&](std::vector<std::byte> buffer, const IPEndpoint &from) {
+        scope.spawn([&session, buffer = std::move(buffer), from]() -> Task<void> {
+            co_await session.processUdp(buffer, from);
+        });
+    });
+
+    // The first one knows the seeds 1.0.0.1 - 100, the second 1.0.0.51 - 150, both the downloaders 2.0.0.1 - 50
+    auto toWire = [](const BEP33BloomFilter<> &filter) {
+        std::string bytes(256, '\0');
+        filter.toBytes(std::as_writable_bytes(std::span(bytes)).first<256>());
+        return bytes;
+    };
+    for (int first : {1, 51}) {
+        BEP33BloomFilter<> seeds;
+        BEP33BloomFilter<> peers;
+        for (int i = first; i < first + 100; i++) {
+            seeds.insertIP(IPAddress::fromString(std::format("1.0.0.{}", i)).value());
+        }
+        for (int i = 1; i <= 50; i++) {
+            peers.insertIP(IPAddress::fromString(std::format("2.0.0.{}", i)).value());
+        }
+        auto *node = &network.addNode();
+        auto  id   = NodeId::rand();
+        node->setHandler([&, node, id, bfsd = toWire(seeds), bfpe = toWire(peers)](std::vector<std::byte> buffer,
+                                                                                 const IPEndpoint      &from) {
+            auto query = GetPeersQuery::fromMessage(BenObject::decode(buffer));
+            if (!query || !query->scrape || query->infoHash != hash) {
+                return;
+            }
+            auto reply = GetPeersReply {
+                .transId = query->transId,
+                .id      = id,
+                .token   = "token",
+                .bfsd    = bfsd,
+                .bfpe    = bfpe,
+            };
+            scope.spawn([node, data = reply.toMessage().encode(), from]() -> Task<void> {
+                co_await node->sendto(std::as_bytes(std::span(data)), from);
+            });
+        });
+        session.routingTable().updateNode({id, node->localEndpoint().value()});
+    }
+
+    GetPeersManager manager(session);
+    std::optional<GetPeersManager::SwarmEstimate> estimate;
+    scope.spawn([&]() -> Task<void> { estimate = co_await manager.estimateSwarm(hash); });
+    ctxt.runUntil([&]() { return estimate || ctxt.now() > std::chrono::minutes(1); });
+    ASSERT_TRUE(estimate);
+    EXPECT_EQ(estimate->responses, 2);
+    EXPECT_NEAR(estimate->seeds, 150, 15);
+    EXPECT_NEAR(estimate->peers, 50, 5);
+
+    scope.cancel();
+    scope.wait();
+}
+
+#if defined(__linux__)
+TEST(Transport, Mmsg) {
+    PlatformContext ctxt;
+    ctxt.install();
+    auto test = [&]() -> Task<void> {
+        auto      any = IPEndpoint::fromString("127.0.0.1:0").value();
+        UdpClient a(ctxt, AF_INET);
+        UdpClient b(ctxt, AF_INET);
+        a.bind(any).value();
+        b.bind(any).value();
+        MmsgTransport sender(a);
+        MmsgTransport receiver(b);
+        auto          to = receiver.localEndpoint().value();
+        for (int i = 0; i < 100; i++) { // More than a batch, queued and flushed together
+            auto text = std::to_string(i);
+            EXPECT_EQ((co_await sender.sendto(std::as_bytes(std::span(text)), to)).value(), text.size());
+        }
+        co_await sleep(std::chrono::milliseconds(10));
+        std::vector<std::byte> large(4096); // Over the receive slot, dropped and counted
+        co_await a.sendto(large, to);
+        co_await sender.sendto(std::as_bytes(std::span("end", 3)), to);
+
+        std::byte  buffer[2048];
+        IPEndpoint from;
+        for (int i = 0; i < 100; i++) {
+            auto n = co_await receiver.recvfrom(buffer, from);
+            EXPECT_EQ(std::string_view(reinterpret_cast<char *>(buffer), n.value()), std::to_string(i));
+            EXPECT_EQ(from, a.localEndpoint().value());
+        }
+        auto n = co_await receiver.recvfrom(buffer, from);
+        EXPECT_EQ(std::string_view(reinterpret_cast<char *>(buffer), n.value()), "end");
+        EXPECT_EQ(receiver.oversized(), 1);
+    };
+    test().wait();
+}
+#endif
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
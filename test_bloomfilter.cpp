@@ -5,6 +5,7 @@
 #include <array>
 #include <string>
 #include <cstdint>
+#include <random>
 
 #include "src/bloomfilter.hpp"
 
@@ -57,6 +58,88 @@ TEST(BloomFilterTest, TestBloomFilter) {
     EXPECT_EQ(bf1, bf2);
 }
 
+TEST(BloomFilterTest, InsertMerge) {
+    // The hash once then insert by it is the same as the insert of the data
+    std::array<std::byte, 4> ip4 = {std::byte {10}, std::byte {0}, std::byte {0}, std::byte {1}};
+    BEP33BloomFilter<>       a;
+    BEP33BloomFilter<>       b;
+    a.insertHash(BEP33BloomFilter<>::hash(ip4));
+    b.insert(ip4);
+    EXPECT_EQ(a, b);
+    EXPECT_TRUE(a.testHash(BEP33BloomFilter<>::hash(ip4)));
+    ip4[3] = std::byte {2};
+    EXPECT_FALSE(a.test(ip4));
+
+    // Merge the wire format, the result is the union, the wrong size is refused
+    b.reset();
+    b.insert(ip4);
+    auto bytes  = b.toBytes();
+    auto before = a;
+    EXPECT_TRUE(a.merge(bytes));
+    EXPECT_EQ(a, before | b);
+    EXPECT_TRUE(a.test(ip4));
+    ip4[3] = std::byte {1};
+    EXPECT_TRUE(a.test(ip4));
+    EXPECT_FALSE(a.merge(std::span(bytes).first(10)));
+    EXPECT_EQ(BEP33BloomFilter<>::fromHexString(a.toHexString()), a);
+}
+
+TEST(CuckooFilterTest, InsertEraseMerge) {
+    CuckooFilter<>        filter(100000);
+    std::vector<uint64_t> hashes;
+    std::mt19937_64       random(114514);
+    for (int i = 0; i < 100000; i++) {
+        hashes.push_back(random());
+        EXPECT_TRUE(filter.insertHash(hashes.back()));
+    }
+    for (auto hash : hashes) {
+        EXPECT_TRUE(filter.containsHash(hash));
+    }
+    size_t falsePositive = 0;
+    for (int i = 0; i < 100000; i++) {
+        falsePositive += filter.containsHash(random());
+    }
+    EXPECT_LT(falsePositive, 100); // ~0.012% expected
+
+    // Persist and restore
+    auto restored = CuckooFilter<>::fromBytes(filter.toBytes());
+    ASSERT_TRUE(restored);
+    EXPECT_EQ(restored->size(), filter.size());
+    EXPECT_TRUE(restored->containsHash(hashes.front()));
+
+    // Delete half of them
+    for (size_t i = 0; i < hashes.size() / 2; i++) {
+        EXPECT_TRUE(filter.eraseHash(hashes[i]));
+    }
+    for (size_t i = hashes.size() / 2; i < hashes.size(); i++) {
+        EXPECT_TRUE(filter.containsHash(hashes[i]));
+    }
+
+    // Merge
+    CuckooFilter<> a(1000), b(1000);
+    std::array<std::byte, 4> ip4 = {std::byte {192}, std::byte {0}, std::byte {2}, std::byte {1}};
+    a.insert(ip4);
+    ip4[3] = std::byte {2};
+    b.insert(ip4);
+    EXPECT_TRUE(a.merge(b));
+    EXPECT_TRUE(a.contains(ip4));
+    EXPECT_EQ(a.size(), 2);
+}
+
+TEST(CuckooFilterTest, Attach) {
+    std::vector<uint64_t> memory(CuckooFilter<>::requiredBytes(1000) / sizeof(uint64_t), 0);
+    auto span = std::as_writable_bytes(std::span(memory));
+    {
+        auto filter = CuckooFilter<>::attach(span, 1000);
+        ASSERT_TRUE(filter);
+        filter->insertHash(42);
+    }
+    auto filter = CuckooFilter<>::attach(span, 1000);
+    ASSERT_TRUE(filter);
+    EXPECT_EQ(filter->size(), 1);
+    EXPECT_TRUE(filter->containsHash(42));
+}
+
 int main() {
     testing::InitGoogleTest();
     return RUN_ALL_TESTS();
@@ -2,6 +2,9 @@ add_rules("mode.debug", "mode.release")
 add_rules("plugin.compile_commands.autoupdate", {lsp = "cpptools", outputdir = ".vscode"})
 add_repositories("btk-repo https://github.com/Btk-Project/xmake-repo.git")
 add_requires("gtest", "ilias")
+if is_plat("linux") then
+    add_requires("liburing", {optional = true, system = true}) -- The io_uring transport, skipped if not found
+end
 
 set_languages("c++23")
 
@@ -14,14 +17,15 @@ target("main")
     add_files("ui/*")
     add_files("ui/widgets/*.cpp")
     add_files("ui/widgets/*.hpp")
-    add_packages("ilias")
+    add_packages("ilias", "liburing")
 
 target("test")
     set_default(false)
-    add_packages("gtest", "ilias")
+    add_packages("gtest", "ilias", "liburing")
     set_kind("binary")
     add_files("src/*.cpp")
     add_files("src/*.c")
+    add_files("bench/simnet.cpp")
     add_files("test.cpp")
 
 target("test_bloomfilter")
@@ -32,6 +36,29 @@ target("test_bloomfilter")
     add_files("src/*.c")
     add_files("test_bloomfilter.cpp")
 
+target("bench_lookup")
+    set_default(false)
+    add_packages("ilias", "liburing")
+    set_kind("binary")
+    add_files("src/*.cpp")
+    add_files("src/*.c")
+    add_files("bench/simnet.cpp", "bench/bench_lookup.cpp")
+
+target("bench_bloomfilter")
+    set_default(false)
+    add_packages("ilias")
+    set_kind("binary")
+    add_files("src/*.c")
+    add_files("bench/bench_bloomfilter.cpp")
+
+target("bench_secureid")
+    set_default(false)
+    add_packages("ilias", "liburing")
+    set_kind("binary")
+    add_files("src/*.cpp")
+    add_files("src/*.c")
+    add_files("bench/bench_secureid.cpp")
+
 --
 -- If you want to known more usage about xmake, please see https://xmake.io
 --